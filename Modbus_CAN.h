@@ -37,7 +37,19 @@
 *  
 *   As conclusion, 11-bits message IDs fix perfectly with our purpose and is enough. In any case, CAN is able to send other types of
 *   messages as remote frames, so, in the future, if it is needed to make more differences, it can be used the 29-bits message IDs.
+*
+*   That is what MODBUS_CAN_SEQUENCE does. When it is set, the chunks are sent with 29-bits message IDs: the 11 lower bits are the same
+*   as above (header + request/answer bit + slave), bits 11 to 15 keep the number of the chunk inside the PDU (0 to 31, enough for
+*   MAX_PDU) and bits 16 to 24 keep the total length of the PDU. The receiver knows which chunk has to arrive next, so a lost chunk is
+*   detected as soon as the following one arrives: the master gives up the answer and resends the request at once, without waiting for
+*   the unicast timeout, and the slave throws away the request. Chunks of a long PDU whose beginning was not received are thrown away.
+*   Master and slaves have to be built with the same value.
 *   
+*   The chunks are not sent one by one waiting between them. Modbus_CAN_FixOutput() puts them in a TX queue and returns at once; the
+*   queue is emptied by the CAN interrupt, which loads batches of up to MODBUS_CAN_TX_OBJECTS chunks into the transmit message objects
+*   1, 2, 3... The CAN controller always sends first the lowest message object, so the chunks leave in order, back-to-back, and
+*   only the last message object of a batch raises the TX interruption to load the next batch.
+*
 *   The elements and functions that are explained in this module, instead of the module CAN Master or CAN Slave, are common between
 *   the master and slaves, therefore, it is not needed to make a distinction and are used in the same way in both parts.
 *   The functions in this module are the common ones in the master and in the slave.
@@ -51,6 +63,27 @@
 #define MAX_PDU 256
 //! CAN only can send chunks of 8 bytes.
 #define MAX_FRAME 8
+//! Transmit message objects (1 to MODBUS_CAN_TX_OBJECTS) used to send the chunks.
+#define MODBUS_CAN_TX_OBJECTS 16
+//! Chunks that can wait to be sent in the TX queue. It has to be a power of two, 256 as maximum.
+#define MODBUS_CAN_TX_QUEUE 64
+//! 1 to send the chunks with 29-bits message IDs carrying sequence number and total length, 0 for the 11-bits message IDs.
+//! The two formats cannot talk to each other, so every node of the bus must be built with the same value; it is 0 by default
+//! to keep talking with the nodes that use the 11-bits message IDs.
+#ifndef MODBUS_CAN_SEQUENCE
+#define MODBUS_CAN_SEQUENCE 0
+#endif
+
+#if MODBUS_CAN_SEQUENCE
+//! First bit of the chunk number inside the 29-bits message ID.
+#define MODBUS_CAN_SEQ_SHIFT 11
+//! Mask of the chunk number once shifted.
+#define MODBUS_CAN_SEQ_MASK 0x1F
+//! First bit of the PDU total length inside the 29-bits message ID.
+#define MODBUS_CAN_LENGTH_SHIFT 16
+//! Mask of the PDU total length once shifted.
+#define MODBUS_CAN_LENGTH_MASK 0x1FF
+#endif
 
 //!Possible bit rate ranges implemented
 enum Modbus_CAN_BitRate
@@ -82,6 +115,13 @@ enum Modbus_CAN_BitRate
 *   something was wrong and master will try to send again the request. The values of the timeouts will be explained deeply in the proper 
 *   functions.
 * 
+*   As every slave answers with its own ID, the master does not need to wait for one slave before talking to the next one. Each request is
+*   kept in a transaction of its own, with its own chain of receive message objects (a hardware FIFO inside 17 to 32), its own state and
+*   its own unicast timeout, so up to MODBUS_CAN_MAX_TRANSACTIONS slaves can be served at the same time, one request per slave.
+*   The chain keeps the next segments of a long answer while the interruption of the previous one is being served, so slaves can send
+*   them back-to-back. A broadcast still needs the whole bus: it
+*   is only sent when there are no transactions in flight and no new transaction is started until its turnaround finishes.
+*
 *   Additionaly, to understand the code, it has to be kept in my mind that master works following the next behaviour according to the Modbus 
 *   specifications:
 *
@@ -91,6 +131,21 @@ enum Modbus_CAN_BitRate
 //*****************************************************************************
 /** @{ */
 
+//! Receive message objects chained as a hardware FIFO for every transaction. It must divide 16.
+#define MODBUS_CAN_RX_FIFO_DEPTH 2
+//! Maximum number of transactions in flight, one per slave. The receive message objects 17 to 32 are shared among them.
+#define MODBUS_CAN_MAX_TRANSACTIONS (16 / MODBUS_CAN_RX_FIFO_DEPTH)
+//! Receive message object of the first transaction; the transaction i uses the message objects from MODBUS_CAN_RX_OBJECT + i * MODBUS_CAN_RX_FIFO_DEPTH on.
+#define MODBUS_CAN_RX_OBJECT 17
+//! Value used when there is no transaction.
+#define MODBUS_CAN_NO_TRANSACTION 0xFF
+//! Highest slave number whose round-trip time is learnt.
+#define MODBUS_CAN_MAX_SLAVE 247
+//! Floor in ms of the timeouts learnt from the round-trip times.
+#define MODBUS_CAN_RTO_MIN_MS 5
+//! Ceiling in ms of the timeouts learnt from the round-trip times.
+#define MODBUS_CAN_RTO_MAX_MS 2000
+
 //! This are the possible master states according to the Modbus specifications.
 enum Modbus_MainState
 {
@@ -99,7 +154,8 @@ enum Modbus_MainState
     MODBUS_WAITREPLY,      //!< Waiting for an unicast answer
     MODBUS_TURNAROUND,     //!< Waiting for broascast answers
     MODBUS_PROCESSING,     //!< Reply process state
-    MODBUS_ERROR           //!< Error process state
+    MODBUS_ERROR,          //!< Error process state
+    MODBUS_BACKOFF         //!< Waiting on the transaction timer before resending (retry backoff)
 };
 
 /////////////////////////////////////////////MASTER PROTOTYPES//////////////////////////////////////////////
@@ -108,7 +164,9 @@ enum Modbus_MainState
 *
 *    This is the function to initialise the CAN module. The system and some variables used for Modbus are also initialised.
 *    The message object 1 would be set up for transfers in the function made to send data.
-*    The message object 17 will be put as receive message object for unicast requests.
+*    The message objects 17 to 32 will be put as receive message objects for the unicast requests, MODBUS_CAN_RX_FIFO_DEPTH per transaction.
+*    The timer wheel (Modbus_Timer_Init()) is started on Timer 0 to keep the unicast timeouts of all transactions and the broadcast
+*    timeout, so the Timer 0 interrupt vector has to point to Modbus_Timer_IntHandler().
 *    CAN message's IDs(11-bit) in Modbus will be compound by a header(3 bits) and a slave number (8 bits)
 *    Modbus header frames in CAN as was previously mentioned are as follows:
 *
@@ -121,7 +179,7 @@ enum Modbus_MainState
 *    @param bit_rate Indicate the bit rate to be used in the communications.
 *    @param attempts Maximum number of sending attempts.
 *    @note It is assumed that number of attempts is at least 1.
-*    @sa SysCtlPeripheralEnable, IntMasterEnable, TimerConfigure,IntEnable,TimerIntEnable, GPIOPinTypeGPIOOutput 
+*    @sa SysCtlPeripheralEnable, IntMasterEnable, Modbus_Timer_Init, IntEnable, GPIOPinTypeGPIOOutput 
 *    @sa GPIOPinTypeCAN, CANInit, CANSetBitTiming, CANEnable, CANIntEnable, Modbus_SetMainState, ledOff, ledOn
 */
 void Modbus_CAN_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char attempts);
@@ -130,7 +188,8 @@ void Modbus_CAN_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char attempts);
 *     @brief Function to send information.
 *
 *     This function is called when the master wants to send data. The messages in CAN are built up as 8 bytes as maximum, so, this function
-*     will process all data sending chunks of 8 bytes. That makes to have some kind of control to know which chunk is expected, therefore,
+*     will process all data putting chunks of 8 bytes in the TX queue, from where they are sent by the CAN interrupt; it does not wait
+*     for them to leave. That makes to have some kind of control to know which chunk is expected, therefore,
 *     there are 4 types of messages with the following different headers in the message ID, in this way it can be known when the big messages 
 *     start and when they finish:
 *
@@ -140,14 +199,17 @@ void Modbus_CAN_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char attempts);
 *               -111: End Long Frame + request bit
 *
 *     The rest of the message ID will be the slave number. 
-*     When the function splits up all the data and sends the last chunk, the timer is set up to be triggered if a complete reception does 
-*     not arrive.
+*     In an unicast request, the transaction of the slave is taken (the same one if the request is being resent) and the request is
+*     copied into it from APP layer.
+*     When the function splits up all the data and sends the last chunk, the timeout of the transaction is set up to be triggered if a 
+*     complete reception does not arrive.
 *     @param mb_req_pdu The information to be sent.
 *     @param slave The number of the slave who will receive the data.
 *     @param pdu_length The amount of data to be sent.
 *     @param amount_guess A guess of the amount of data (in bytes) that will pass through the bus.
-*     @note Slave number is supposed to be right.
-*     @sa CANMessageSet, Modbus_CAN_ReceptionConfiguration, Modbus_CAN_Delay, Modbus_SetMainState, Modbus_CAN_UnicastTimeout, Modbus_CAN_BroadcastTimeout
+*     @note Slave number is supposed to be right and a transaction available for it (Modbus_CAN_Transaction_Available()).
+*     @sa Modbus_CAN_ReceptionConfiguration, Modbus_CAN_UnicastTimeout, Modbus_CAN_BroadcastTimeout
+*     @sa Modbus_App_Actual_Req_Get
 */
 void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char slave, unsigned char pdu_length, uint16_t amount_guess);
 
@@ -155,19 +217,32 @@ void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char slave, unsign
 *     @brief Function to configure the message object to receive data.
 * 
 *     This function is called when the master wants to send data to a particular slave and receive an answer. In such way, it is configured 
-*     the receive message object (num. 17). It is set up with the ID equal to the number of the slave, because it is expected the message 
-*     from the slave we send data. The mask is put to receive all messages from that slave which are responses (request bit=0), independently
-*     of the other two bits of the header, which indicates the type of frame as was explained previously.
+*     the chain of receive message objects of the transaction (MODBUS_CAN_RX_FIFO_DEPTH objects from num. 17 + transaction * MODBUS_CAN_RX_FIFO_DEPTH),
+*     all but the last one with the FIFO bit so the hardware fills them in order. They are set up with the ID equal to the number of the slave, because
+*     it is expected the message from the slave we send data. The mask is put to receive all messages from that slave which are responses 
+*     (request bit=0), independently of the other two bits of the header, which indicates the type of frame as was explained previously.
+*     @param transaction The transaction which owns the receive message object.
 *     @param slave The number of the slave from whom it will be received the data.
 *     @note Slave number is supposed to be right.
 *     @sa CANMessageSet, Modbus_CAN_FixOutput
 */
-void Modbus_CAN_ReceptionConfiguration(unsigned char slave);
+void Modbus_CAN_ReceptionConfiguration(unsigned char transaction, unsigned char slave);
+
+/**
+*     @brief Function to know if a request can be sent right now.
+*
+*     An unicast request can be sent if its slave has no transaction in flight and there is a free one. A broadcast request can be
+*     sent only if there are no transactions at all. Nothing can be sent while a broadcast turnaround is running.
+*     @param slave The number of the slave, 0 for a broadcast.
+*     @return <b>1</b> If the request can be sent, or <b>0</b> if it has to wait.
+*/
+unsigned char Modbus_CAN_Transaction_Available(unsigned char slave);
 
 /** 
 *    @brief Function to acknowledge if a forward is needed.
 *
-*    This function is called to know if a resend should be done. After get the proper value, the forward flag is cleared.
+*    This function is called to know if a resend of the transaction being handled should be done. After get the proper value, the forward
+*    flag is cleared.
 *    A resend has to be done if an unicast timeout was triggered with a reception not completed.
 *    @note A resend is always possible as much as the maximum number of forward attempts is not achieved.
 *    @return <b>0</b> If it is not needed a forward, or <b>1</b> if it is needed.
@@ -177,47 +252,47 @@ unsigned char Modbus_CAN_GetForwardFlag(void);
 /**
 *   @brief Function to reset the number of sending attempts.
 *
-*   This function is called when there is a completely new transmission. So, the actual number of sending attempts has to be
-*   reset.
+*   This function is called when there is a completely new transmission. So, the actual number of sending attempts of the transaction
+*   being handled has to be reset.
 */
 void Modbus_CAN_Reset_Attempt(void);
 
 /**
 *   @brief Function to repeat a request.
 * 
-*   This function checks if it is possible to send a request again, probably because an error.
-*   If it is possible, _modbus_forward_flag_ is marked, if it is not possible because
+*   This function checks if it is possible to send the request of the transaction being handled again, probably because an error.
+*   The maximum number of attempts and the wait before the resend come from the retry policy of the request. If it is possible
+*   and there is no wait, _modbus_forward_flag_ is marked; with a wait, the transaction passes to _MODBUS_BACKOFF_ and its timer
+*   is armed, so the transaction keeps its slave while the other transactions go on. If it is not possible because
 *   it was already achieved the maximum number of attempts, then it is notified to APP layer to discard this request.
-*   @sa Modbus_App_No_Response
+*   @sa Modbus_App_No_Response, Modbus_App_Max_Attempts, Modbus_App_Backoff
 */
 void Modbus_CAN_Repeat_Request(void);
 
 /**
 *   @brief This function is used to change the master state in case a timeout shows up.
 * 
-*   This function is called when one timeout is trigered. If the timeout was the unicast timeout,
-*   then, it is marked as _MODBUS_ERROR_, to lately, try to resend the request. If it was the broadcast timeout, it is assumed all slaves
-*   received the broadcast message, then is passed to _MODBUS_IDLE_ to deal with the next request.
-*   @sa Modbus_GetMainState, Modbus_SetMainState, Modbus_CAN_Error_Management
+*   This function is called when one timeout is trigered. If the timeout was the unicast timeout of a transaction,
+*   then, such a transaction is marked as _MODBUS_ERROR_, to lately, try to resend the request. If it was the broadcast timeout, it is
+*   assumed all slaves received the broadcast message, then the master is passed to _MODBUS_IDLE_ to deal with the next request.
+*   @param transaction The transaction whose timeout was triggered, or MODBUS_CAN_NO_TRANSACTION for the broadcast timeout.
+*   @sa Modbus_CAN_Error_Management
 */
-void Modbus_CAN_Timeouts(void);
-
-/**
-*    @brief Function to handle the unicast timeout interruption.
-* 
-*    This function is triggered to handle the timeout interruption when the timer
-*    was configured with the unicast time value. If the completely reception was not processed, then
-*    it is called to _Modbus_CAN_Timeouts_. If the reception was processed nothing happens.
-*    @sa TimerIntClear, Modbus_CAN_Timeouts
-*/
-void Modbus_CAN_UnicastTimeoutHandler(void);
+void Modbus_CAN_Timeouts(unsigned char transaction);
 
 /**
 *    @brief Function to configure the unicast timeout value.
 *
-*    This function is called when an unicast request has to be made; Timer is set up with the value indicated in _modbus_unicast_timeout_, 
-*    which will depend on the CAN bit rate range chosen and a guess of the amount data which will pass through the bus in both the request
-*    as in the answer.
+*    This function is called when an unicast request has to be made; The timer of the transaction is armed in the timer wheel. When
+*    it expires and the complete reception was not processed, then it is called to _Modbus_CAN_Timeouts_.
+*
+*    The master measures the round-trip time of every answer to a first attempt (answers to resent requests are ambiguous and are not
+*    used) and keeps for every slave a smoothed mean and a mean deviation, as TCP does (Jacobson/Karels). Once the slave has samples,
+*    the timeout is the smoothed round-trip time plus four times its deviation, between MODBUS_CAN_RTO_MIN_MS and MODBUS_CAN_RTO_MAX_MS,
+*    and it is doubled on every new attempt up to the ceiling.
+*
+*    Until then, the value indicated in _modbus_unicast_timeout_ is used, which will depend on the CAN bit rate range chosen and a guess of
+*    the amount data which will pass through the bus in both the request as in the answer.
 *    The unicast timeout value is compounded by:
 *
 *              -(amount_guess * 933333) = Transfer time; It represents how much time is needed to transfer _amount_guess_ bytes through a bus working at
@@ -226,30 +301,22 @@ void Modbus_CAN_UnicastTimeoutHandler(void);
 *              -((modbus_attempts-1) * 8000) = Congestion avoidance; It simulates a congestion avoidance regulator, as more attempts are done, 
 *                      more the master will wait.
 *
+*    @param transaction The transaction which waits the answer.
 *    @param amount_guess A guess of the amount data that will pass through the bus in this transfer.
-*    @warning Timeout value is not needed to be as high as it is right now, but as it is used serial port and a terminal for debugging,
-*    then, value has to be that high. It is more than known that showing stuff on screen is slower than CPU.
-*    @sa TimerLoadSet, TimerEnable, Modbus_SetBitRate
+*    @warning The fixed value above is only a first guess, generous enough for a slave which has not answered yet; once the slave has
+*    samples the learnt timeout replaces it, so the guess does not limit how fast a lost answer is detected.
+*    @sa Modbus_Timer_Arm, Modbus_SetBitRate, MODBUS_CAN_RTO_MIN_MS, MODBUS_CAN_RTO_MAX_MS
 */
-void Modbus_CAN_UnicastTimeout(uint16_t amount_guess);
-
-/**
-*       @brief Function to handle the broadcast timeout interruption.
-*
-*       This function is triggered to handle the timeout interruption when the timer
-*       was configured with the broadcast time value. As it is not expected any answer when is used a broadcast,
-*       then it is called directly to Modbus_CAN_Timeouts().
-*       @sa TimerIntClear, Modbus_CAN_Timeouts
-*/
-void Modbus_CAN_BroadcastTimeoutHandler(void);
+void Modbus_CAN_UnicastTimeout(unsigned char transaction, uint16_t amount_guess);
 
 /** 
 *       @brief Function to configure the broadcast timeout value.
 *
-*       This function is called when a broadcast sending has to be made; Then the timer is set up with the value indicated in
-*       _modbus_broadcast_timeout_, which will depend on the CAN bit rate range chosen and a guess of the amount data which will 
+*       This function is called when a broadcast sending has to be made; Then the broadcast timer is armed in the timer wheel with the
+*       value indicated in _modbus_broadcast_timeout_; as no answer is expected, Modbus_CAN_Timeouts() is called directly when it expires. If the round-trip time of some slaves is already known, it is the longest timeout learnt among them
+*       (see Modbus_CAN_UnicastTimeout()). Otherwise, it will depend on the CAN bit rate range chosen and a guess of the amount data which will 
 *       pass through the bus in the request.
-*       The broadcast timeout is compounded by:
+*       The broadcast timeout is then compounded by:
 *
 *               -(amount_guess * 933333) = Transfer time; It represents how much time is needed to transfer _amount_guess_ bytes through a 
 *                       bus working at 1Mbps. In addition, if it is working at 1 Kbps, for example, transfer time will be 10 times higher.
@@ -258,25 +325,36 @@ void Modbus_CAN_BroadcastTimeoutHandler(void);
 *       @note The broadcast timeout is multiplied by two to be sure that data is able to stay in the bus enough time to be listened by
 *       all slaves, and also, to wait slaves to process the request.
 *       @param amount_guess A guess of the amount data that will pass through the bus in this transfer.
-*       @sa TimerLoadSet, TimerEnable, Modbus_SetBitRate
+*       @sa Modbus_Timer_Arm, Modbus_SetBitRate
 */
 void Modbus_CAN_BroadcastTimeout(uint16_t amount_guess);
 
 /**
 *       @brief Function to disable the unicast timeout.
 *
-*       This function is called to disable the unicast timeout when a complete answer was received.
-*       @sa TimerDisable
+*       This function is called to disable the unicast timeout of a transaction when a complete answer was received.
+*       @param transaction The transaction which received the answer.
+*/
+void Modbus_CAN_RemoveTimeout(unsigned char transaction);
+
+/**
+*       @brief Function to process the received information.
+*
+*       This function is called when the master receives data in the chain of receive message objects of a transaction. Every message
+*       object of the chain with new data is drained in FIFO order (from the object after the last one read up to the end of the chain,
+*       then from its beginning) until no new data is left, so the segments that arrived while the interruption was pending are not
+*       lost and keep their order. For every segment it is checked if data is according to one of the
+*       possible header frames. Depending on the received header, it is processed in one way or other. The origin is always the expected one because the
+*       receive message object was configured to receive from the slave of the transaction when Modbus_CAN_ReceptionConfiguration() was
+*       called. Frames arriving when the transaction is not waiting an answer are thrown away.
+*       @param transaction The transaction which owns the message object with new data.
+*       @sa CANMessageGet, CANStatusGet, Modbus_CAN_ReceptionConfiguration
 */
-void Modbus_CAN_RemoveTimeout(void);
+void Modbus_CAN_CallBack(unsigned char transaction);
 
 //DEPRECATED:
-unsigned char Debug_Timeout(void);
 unsigned char getIndex(void);
-unsigned char getbu(void);
-uint16_t getboo(void);
 unsigned char getAttempts(void);
-void setbu(void);
 /** @} */
 #elif MODBUS_SLAVE
 #undef MODBUS_MASTER
@@ -305,6 +383,12 @@ void setbu(void);
 //*****************************************************************************
 /** @{ */
 
+//! First receive message object of the unicast receive FIFO.
+#define MODBUS_CAN_RX_OBJECT 17
+//! Receive message objects chained as the unicast receive FIFO.
+#define MODBUS_CAN_RX_UNICAST_OBJECTS 12
+//! Receive message objects chained as the broadcast receive FIFO, placed after the unicast ones.
+#define MODBUS_CAN_RX_BROADCAST_OBJECTS 4
 
 //! Possible Slave states
 enum Modbus_MainState
@@ -324,7 +408,8 @@ enum Modbus_MainState
 *
 *       This is the function to initialise the CAN module. The system and some CAN variables are also initialised.
 *       The message object 1 would be set up in the function to send data.
-*       The message objects 17 and 18 will be configured as receive message object for unicast and broadcast requests respectively.
+*       The message objects 17 to 32 will be configured as two chains of receive message objects (hardware FIFOs) for unicast and
+*       broadcast requests respectively.
 *       CAN message IDs(11-bits) in Modbus will be compounded by a header(3 bits) and a slave number (8 bits).
 *       Modbus header frames in CAN will be built up by three bits, as was previously mentioned:
 *
@@ -344,7 +429,8 @@ void Modbus_CAN_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char slave);
 *       @brief Function to send information.
 *
 *       This function is called when the slave wants to send data. The messages in CAN are built up as 8 bytes as maximum, so, this function
-*       will process all data sending chunks of 8 bytes. That makes to have some kind of control to know which chunk is expected, therefore,
+*       will process all data putting chunks of 8 bytes in the TX queue, from where they are sent by the CAN interrupt; it does not wait
+*       for them to leave. That makes to have some kind of control to know which chunk is expected, therefore,
 *       there are 4 types of messages with the following different headers in the message ID, in this way it can be known when the big messages
 *       start and when they finish.
 *
@@ -357,19 +443,20 @@ void Modbus_CAN_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char slave);
 *       There is no timeout in the slave, if the data does not arrive, the master will send the request again.
 *       @param mb_req_pdu The information to be sent.
 *       @param pdu_length The amount of data to be sent.
-*       @sa CANMessageSet, Modbus_CAN_Delay, Modbus_SetMainState
+*       @sa Modbus_SetMainState
 */
 void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char pdu_length);
 
 /**
 *       @brief Function to configure receive message objects.
 *
-*       This function is called to configure the receive message objects. One is set up as unicast receive message object
-*       with the ID equal to the number of the slave (message object 17). The other one is set up as a broadcast receive message object 
-*       with the ID equal to 0, which represent a broadcast request (message object 18) according to the Modbus specification.
+*       This function is called to configure the receive message objects. One chain is set up as unicast receive FIFO
+*       with the ID equal to the number of the slave (MODBUS_CAN_RX_UNICAST_OBJECTS from message object 17). The other one is set up as a
+*       broadcast receive FIFO with the ID equal to 0, which represent a broadcast request (MODBUS_CAN_RX_BROADCAST_OBJECTS after the
+*       unicast ones) according to the Modbus specification. All the message objects of a chain but the last one have the FIFO bit.
 *       The mask is set to accept all matched messages taking into account the request/answer bit and the 8-bits that represent the slave
 *       number.
-*       @sa CANMessageSet, Modbus_CAN_ReceptionConfiguration, Modbus_CAN_Delay, Modbus_SetMainState
+*       @sa CANMessageSet, Modbus_CAN_ReceptionConfiguration, Modbus_SetMainState
 */
 void Modbus_CAN_ReceptionConfiguration();
 
@@ -382,6 +469,19 @@ void Modbus_CAN_ReceptionConfiguration();
 */
 unsigned char Modbus_CAN_BroadCast_Get(void);
 
+/**
+*       @brief Function to process the received information.
+*
+*       This function is called when the slave receives data. Every message object with new data of the unicast and broadcast chains
+*       is drained in FIFO order (from the object after the last one read up to the end of the chain, then from its beginning) and, for each one, it is checked if data is according to one of the possible header frames.
+*       Depending on the received header, it is processed in one way or other. The origin is always the master because of the receive
+*       message objects configuration. If the reception is a broadcast request it is raised a flag to notify such a request.
+*       The draining stops once a request is complete; the following segments stay in the hardware FIFO until the controller is
+*       idle again and calls this function once more.
+*       @sa CANMessageGet, CANStatusGet, Modbus_CAN_ReceptionConfiguration, Modbus_SetMainState
+*/
+void Modbus_CAN_CallBack(void);
+
 /** @} */
 #endif
 
@@ -401,10 +501,11 @@ unsigned char Modbus_CAN_BroadCast_Get(void);
 *       This is the CAN interrupt handler. First, it checks the CAN status, if something went wrong in the communication as acks, etc.
 *       the timeout and resending method will fix that, so they are not taken into account. If the proper CAN node enters into a Bus Off 
 *       state, error passive level or warning level, then, it is stopped for security, although in a Bus Off state CAN is disabled automatically.
-*       Secondly, it checks if there was a complete transmission. In such a case, it is notified activating the proper flag. It should be 
-*       only one notification regarding the transmission. Such an interruption should be configured when the last output chunk is sent.
-*       Last thing to check is the reception data, if there was an unicast reception then the incoming data is placed by message object 17. 
-*       In the broadcast case, data will be handled by message object 18 in the slave and it will not be handled by the master as this one 
+*       Secondly, it checks if a batch of chunks was sent (only the last transmit message object of a batch raises the interruption). In
+*       such a case, the next batch waiting in the TX queue is loaded or, if the queue is empty, it is notified activating the proper flag.
+*       Last thing to check is the reception data, if there was an unicast reception then the incoming data is placed in the unicast
+*       receive FIFO (in the master, in the chain of message objects of the transaction, inside 17 to 32). 
+*       In the broadcast case, data will be handled by the broadcast receive FIFO in the slave and it will not be handled by the master as this one 
 *       does not receive broadcast messages. The incoming data is processed in Modbus_CAN_CallBack().
 *       @sa CANIntStatus, CANStatusGet, CANIntClear, Modbus_CAN_CallBack
 */
@@ -415,8 +516,6 @@ void Modbus_CAN_IntHandler(void);
 *       @ingroup CAN
 *
 *       This function initialise the bit timing parameters depending on the bit time range chosen. 
-*       Also, depending on the former, it is configure the delay used between transmission. The value of that delay was chosen in the same
-*       way than the timeouts.
 *       
 *       The bit rate of the bus depends on the values stored in the struct _tCANBitClkParms_, the maximum in CAN is 1MBPS. It is only 
 *       implemented 1 KBPS and 1 MBPS. If it is desired others ranges, the proper values from the former struct has to be calculated.
@@ -430,7 +529,8 @@ void Modbus_CAN_SetBitRate(enum Modbus_CAN_BitRate bit_rate);
 *       @ingroup CAN
 *
 *       This function is used to get known the status of the master/slave according with
-*       the diagrams of the Modbus specification.
+*       the diagrams of the Modbus specification. In the master, while the controller handles a transaction, it is the status of
+*       such a transaction.
 *       @return Modbus_MainState The status of the master.
 *       @sa Modbus_MainState, Modbus_SetMainState
 */
@@ -441,28 +541,13 @@ enum Modbus_MainState Modbus_GetMainState(void);
 *       @ingroup CAN
 *
 *       This function is used to set the status of the master/slave according with
-*       the diagrams of the Modbus specification.
+*       the diagrams of the Modbus specification. In the master, while the controller handles a transaction, it is the status of
+*       such a transaction.
 *       @param state The new status of the master/slave.
 *       @sa Modbus_MainState, Modbus_GetMainState
 */
 void Modbus_SetMainState(enum Modbus_MainState state);
 
-/**
-*       @brief Function to process the received information.
-*       @ingroup CAN
-*
-*       This function is called when the master/slave receives data. If there is new data in the specific message object(it should be 
-*       if we are in this function), it is checked if data is according to one of the possible header frames.
-*       Depending on the received header, it is processed in one way or other. The destinations are always the expected ones
-*       because the receive message objects were configured either to receive a concrete slave when the function Modbus_CAN_ReceptionConfiguration()
-*       was called in the master, or to receive from the master always in the case of the slave.
-*       In the slave, if the reception is a broadcast request it is looked in the message object num.18 instead of the num.17 and it is 
-*       raised a flag to notify such a request.
-*       @result <b>1</b> If there was a successful complete reception, or <b>0</b> if there was some error.
-*       @sa CANMessageGet, CANStatusGet, Modbus_CAN_ReceptionConfiguration, Modbus_SetMainState
-*/
-void Modbus_CAN_CallBack();
-
 /**
 *       @brief Function to manage the master/slave behaviour.
 *       @ingroup CAN
@@ -470,6 +555,9 @@ void Modbus_CAN_CallBack();
 *       This function is used to handle the behaviour of the master/slave following the diagrams of the Modbus
 *       specification. Depending on the status of the master/slave, an action or other will be taken.
 *
+*       In the master, every transaction in flight is handled and then the FIFO requests are sent while their slaves have free
+*       transactions.
+*
 *       @return <b>Master</b>: <b>0</b> if there are no more communications, or <b>1</b> if there are still pending communications.
 *       @return <b>Slave</b>: <b>1</b> if a message was sent to APP layer, or <b>0</b> if not.
 *       
@@ -478,16 +566,6 @@ void Modbus_CAN_CallBack();
 */
 unsigned char Modbus_CAN_Controller(void);
 
-/**
-*       @brief Function to make a delay.
-*       @ingroup CAN
-*
-*       This function is called between transfers to make a delay between them. In this way,
-*       the data will arrive at the destination more slowly and not all at once, avoiding lost data.
-*       @sa SysCtlDelay
-*/
-void Modbus_CAN_Delay(void);
-
 /**
 *       @brief Function to transfer receive data from CAN Layer to APP Layer
 *       @ingroup CAN
@@ -7,18 +7,94 @@
 
 #include "stdint.h"
 #include "Modbus_FIFO.h"
+#include "Modbus_Timer.h"
+
+//! 1 to merge the queued register reads (FC3/FC4) to the same slave into one request
+#define MODBUS_APP_MERGE 1
+#if MODBUS_APP_MERGE
+//! Registers not requested which can be read between two merged reads; they must exist in the slave
+#define MODBUS_APP_MERGE_GAP 0
+//! Maximum number of reads merged into one request
+#define MODBUS_APP_MERGE_ITEMS 8
+#endif
+
+//! Consecutive requests without answer which put a slave down
+#define MODBUS_APP_DOWN_AFTER 2
+//! Milliseconds between two probes to a slave which is down
+#define MODBUS_APP_PROBE_PERIOD 1000
+//! \brief Longest deadline of a request in milliseconds, about 29.8 hours in OSL and 24.8 days in CAN; the
+//! deadlines are compared by their signed difference, so they must stay within 2^31 ticks
+#define MODBUS_APP_DEADLINE_MAX (0x7FFFFFFFUL / (MODBUS_TIMER_TICK_HZ / 1000))
+
+//! 32 bits words of a packed bitmap of _Bits_ coils or discrete inputs
+#define MODBUS_BITMAP_WORDS(Bits)      (((Bits) + 31) / 32)
+//! Value (0/1) of the bit _n_ of a packed bitmap
+#define MODBUS_BIT_GET(Map, n)         (((Map)[(n) >> 5] >> ((n) & 31)) & 1)
+//! Set the bit _n_ of a packed bitmap to _Value_ (0/1)
+#define MODBUS_BIT_SET(Map, n, Value)  ((Map)[(n) >> 5] = ((Map)[(n) >> 5] & ~(1UL << ((n) & 31))) | \
+                                        ((uint32_t)((Value) & 1) << ((n) & 31)))
 
 #if OSL_Mode
 	#include "Modbus_OSL.h"        
 	#undef CAN_Mode
+        //! Merged requests which can be in flight at the same time
+        #define MODBUS_APP_MERGE_GROUPS 1
         void Modbus_Master_Init(enum Modbus_Comm_Modes Com_Mode, enum Baud Baudrate,
                     unsigned char Attempts, enum Modbus_OSL_Modes Mode);
 #elif CAN_Mode
 	#include "Modbus_CAN.h"       
 	#undef OSL_Mode
+        //! Merged requests which can be in flight at the same time
+        #define MODBUS_APP_MERGE_GROUPS MODBUS_CAN_MAX_TRANSACTIONS
         unsigned char Modbus_Master_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char attempts);
 #endif
 
+//! Priority of a request, each priority has its own Request FIFO
+enum Modbus_Priority
+{
+    MODBUS_PRIORITY_HIGH,   //!< Urgent requests, e.g. operator commands
+    MODBUS_PRIORITY_NORMAL, //!< Default priority
+    MODBUS_PRIORITY_LOW     //!< Background polls
+};
+//! Number of priorities
+#define MODBUS_APP_PRIORITIES 3
+
+//! Retry policy of a request
+struct Modbus_Retry_Policy
+{
+    unsigned char Attempts; //!< Sendings before giving up, 1 for no retry, 0 for the attempts given to Modbus_Master_Init
+    uint16_t Backoff;       //!< Milliseconds before the first resend, 0 to resend at once
+    uint16_t Backoff_Max;   //!< Limit of the backoff in milliseconds, which doubles on every resend; 0 for no limit
+    unsigned char Jitter;   //!< Random part of the backoff, in percent (0-100)
+};
+
+//! Options of one request, given in the call of an _Ex_ user function
+struct Modbus_Request_Options
+{
+    void (*CallBack)(uint16_t Handle, enum Modbus_Status Status,
+                     unsigned char Exception); //!< Completion callback, 0 for none
+    enum Modbus_Priority Priority;             //!< Priority of the request
+    uint32_t Deadline;                         //!< Milliseconds from the call to send it, 0 for none; longer than MODBUS_APP_DEADLINE_MAX is cut down to it
+    const struct Modbus_Retry_Policy *Retry;   //!< Retry policy, 0 for the one of its function; it must exist until the request finishes
+};
+
+//! Health of a slave
+enum Modbus_Health
+{
+    MODBUS_SLAVE_UP,      //!< The last request was answered
+    MODBUS_SLAVE_SUSPECT, //!< The last request was not answered, or with a wrong CRC
+    MODBUS_SLAVE_DOWN     //!< MODBUS_APP_DOWN_AFTER requests were not answered; it is only probed
+};
+
+//! Queue statistics of one slave, the times are in microseconds
+struct Modbus_Queue_Stats
+{
+    uint16_t Depth;     //!< Requests to the slave waiting in the Request FIFOs
+    uint32_t Sent;      //!< Requests to the slave sent since the last reset
+    uint32_t Wait_Avg;  //!< Average time from the request call to its sending
+    uint32_t Wait_Max;  //!< Longest time from the request call to its sending
+};
+
 //! Modbus implemented communication modes.
 enum Modbus_Comm_Modes
 {
@@ -30,12 +106,27 @@ enum Modbus_Comm_Modes
               
 unsigned char Modbus_Master_Communication (void);//inside is different, header the same
 void Modbus_App_Manage_CallBack (void);//inside different, same header
-unsigned char Modbus_App_Enqueue_Or_Send(void);//inside different, same header
+uint16_t Modbus_App_Enqueue_Or_Send(struct Modbus_FIFO_Item *Request,
+                                    const struct Modbus_Request_Options *Options);//inside different, same header
 void Modbus_App_Send(void);//inside different, same header
 void Modbus_App_Receive_Char (unsigned char Msg,unsigned char i);
 void Modbus_App_L_Msg_Set(unsigned char Index);
-void Modbus_App_No_Response(void);
+void Modbus_App_Actual_Req_Get(struct Modbus_FIFO_Item *Item);
+void Modbus_App_Actual_Req_Set(struct Modbus_FIFO_Item *Item);
+uint16_t Modbus_App_Actual_Handle(void);
+void Modbus_App_No_Response(enum Modbus_Status Status);
 unsigned char Modbus_Get_Error (struct Modbus_FIFO_E_Item *Error);
+void Modbus_Next_CallBack (void (*CallBack)(uint16_t Handle, enum Modbus_Status Status,
+                                            unsigned char Exception));
+uint16_t Modbus_Last_Handle (void);
+void Modbus_Next_Priority (enum Modbus_Priority Priority, uint32_t Deadline);
+unsigned char Modbus_Get_Queue_Stats (unsigned char Slave, struct Modbus_Queue_Stats *Stats);
+void Modbus_Reset_Queue_Stats (void);
+enum Modbus_Health Modbus_Slave_Health (unsigned char Slave);
+void Modbus_Set_Retry_Policy (unsigned char Function, const struct Modbus_Retry_Policy *Policy);
+void Modbus_Next_Retry_Policy (const struct Modbus_Retry_Policy *Policy);
+unsigned char Modbus_App_Max_Attempts (unsigned char Default);
+uint32_t Modbus_App_Backoff (unsigned char Attempt);
 unsigned char Modbus_App_FIFOSend(void);
 
 unsigned char Modbus_Read_Coils (unsigned char Slave, uint16_t Adress, 
@@ -50,6 +141,12 @@ unsigned char Modbus_Write_Coil (unsigned char Slave, uint16_t Adress,unsigned c
 unsigned char Modbus_Write_Register (unsigned char Slave, uint16_t Adress, uint16_t Register);
 unsigned char Modbus_Write_M_Coils (unsigned char Slave, uint16_t Adress,
                                     uint16_t Coils, unsigned char *Value);
+unsigned char Modbus_Read_Coils_Packed (unsigned char Slave, uint16_t Adress, uint16_t Coils,
+                                        uint32_t *Response, uint16_t Offset);
+unsigned char Modbus_Read_D_Inputs_Packed (unsigned char Slave, uint16_t Adress, uint16_t Inputs,
+                                           uint32_t *Response, uint16_t Offset);
+unsigned char Modbus_Write_M_Coils_Packed (unsigned char Slave, uint16_t Adress, uint16_t Coils,
+                                           uint32_t *Value, uint16_t Offset);
 unsigned char Modbus_Write_M_Registers (unsigned char Slave, uint16_t Adress,
                                         uint16_t Registers, uint16_t *Value);
 unsigned char Modbus_Mask_Write_Register (unsigned char Slave, uint16_t Adress,
@@ -58,4 +155,44 @@ unsigned char Modbus_Read_Write_M_Registers (unsigned char Slave, uint16_t R_Adr
                                              uint16_t R_Registers, uint16_t *Response,
                                              uint16_t W_Adress, uint16_t W_Registers,
                                              uint16_t *Value);
+
+uint16_t Modbus_Read_Coils_Ex (const struct Modbus_Request_Options *Options,
+                               unsigned char Slave, uint16_t Adress, 
+                               uint16_t Coils, unsigned char *Response);
+uint16_t Modbus_Read_D_Inputs_Ex (const struct Modbus_Request_Options *Options,
+                                  unsigned char Slave, uint16_t Adress, 
+                                  uint16_t Inputs, unsigned char *Response);
+uint16_t Modbus_Read_H_Registers_Ex (const struct Modbus_Request_Options *Options,
+                                     unsigned char Slave, uint16_t Adress,
+                                     uint16_t Registers, uint16_t *Response);
+uint16_t Modbus_Read_I_Registers_Ex (const struct Modbus_Request_Options *Options,
+                                     unsigned char Slave, uint16_t Adress,
+                                     uint16_t Registers, uint16_t *Response);
+uint16_t Modbus_Write_Coil_Ex (const struct Modbus_Request_Options *Options,
+                               unsigned char Slave, uint16_t Adress,unsigned char Coil);
+uint16_t Modbus_Write_Register_Ex (const struct Modbus_Request_Options *Options,
+                                   unsigned char Slave, uint16_t Adress, uint16_t Register);
+uint16_t Modbus_Write_M_Coils_Ex (const struct Modbus_Request_Options *Options,
+                                  unsigned char Slave, uint16_t Adress,
+                                  uint16_t Coils, unsigned char *Value);
+uint16_t Modbus_Read_Coils_Packed_Ex (const struct Modbus_Request_Options *Options,
+                                      unsigned char Slave, uint16_t Adress, uint16_t Coils,
+                                      uint32_t *Response, uint16_t Offset);
+uint16_t Modbus_Read_D_Inputs_Packed_Ex (const struct Modbus_Request_Options *Options,
+                                         unsigned char Slave, uint16_t Adress, uint16_t Inputs,
+                                         uint32_t *Response, uint16_t Offset);
+uint16_t Modbus_Write_M_Coils_Packed_Ex (const struct Modbus_Request_Options *Options,
+                                         unsigned char Slave, uint16_t Adress, uint16_t Coils,
+                                         uint32_t *Value, uint16_t Offset);
+uint16_t Modbus_Write_M_Registers_Ex (const struct Modbus_Request_Options *Options,
+                                      unsigned char Slave, uint16_t Adress,
+                                      uint16_t Registers, uint16_t *Value);
+uint16_t Modbus_Mask_Write_Register_Ex (const struct Modbus_Request_Options *Options,
+                                        unsigned char Slave, uint16_t Adress,
+                                        uint16_t AND_Mask, uint16_t OR_Mask);
+uint16_t Modbus_Read_Write_M_Registers_Ex (const struct Modbus_Request_Options *Options,
+                                           unsigned char Slave, uint16_t R_Adress,
+                                           uint16_t R_Registers, uint16_t *Response,
+                                           uint16_t W_Adress, uint16_t W_Registers,
+                                           uint16_t *Value);
 #endif // __Modbus_App_H__
\ No newline at end of file
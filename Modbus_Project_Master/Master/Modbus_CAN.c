@@ -15,45 +15,90 @@
 #include "driverlib/interrupt.h"
 #include "Modbus_App.h"
 #include "Modbus_CAN.h"
+#include "Modbus_Timer.h"
+#include "Modbus_Trace.h"
+#include "Modbus_Stats.h"
 
 //GLOBAL VARIABLES:
 //-SYSTEM
-//! Variable used to represent the status of the Master
+//! Pending request to one slave. The master keeps one of these for each slave being served at the same time.
+struct Modbus_CAN_Transaction
+{
+        enum Modbus_MainState state;                    //!< Transaction state, _MODBUS_IDLE_ when the slot is free
+        unsigned char slave;                            //!< Slave which is being served
+        unsigned char attempts;                         //!< How many attempts are already done
+        unsigned char forward_flag;                     //!< If data needs to be resent
+        volatile unsigned char complete_reception;      //!< If a complete reception was done
+        struct Modbus_Timer timer;                      //!< Unicast timeout, armed while an answer is awaited
+        unsigned long sent;                             //!< Tick when the last segment of the request was loaded to be sent, to measure the round-trip time
+#if MODBUS_STATS
+        uint32_t stamp;                                 //!< Microseconds when the request was sent, for the statistics
+#endif
+        unsigned char index;                            //!< Index of the incoming data
+        unsigned char input_length;                     //!< Input data length
+        unsigned char input_pdu[MAX_PDU];               //!< Input data
+#if MODBUS_CAN_SEQUENCE
+        uint16_t expected_length;                       //!< Total length announced by the long answer, 0 if no beginning was received
+#endif
+        struct Modbus_FIFO_Item request;                //!< Request sent, kept to resend it and to manage its answer
+};
+//! Variable used to represent the status of the Master (_MODBUS_IDLE_ or _MODBUS_TURNAROUND_ while a broadcast is on the bus)
 static  enum Modbus_MainState modbus_master_state;
+//! Transaction table; the transaction i receives through the message object MODBUS_CAN_RX_OBJECT + i
+static  struct Modbus_CAN_Transaction modbus_transactions[MODBUS_CAN_MAX_TRANSACTIONS];
+//! Transaction handled by the controller right now, or MODBUS_CAN_NO_TRANSACTION
+static  unsigned char modbus_current;
+//! Last transaction used to send a request
+static  unsigned char modbus_last;
 //! Variable used to store the maximum attempts to send data
 static  unsigned char modbus_max_attempts;
-//! Variable used to store how many attempts are already done
-static  unsigned char modbus_attempts;
-//! Variable used to store if data needs to be resent
-static  unsigned char modbus_forward_flag;
 //! Variable used to store if a complete transmission was done
 static  unsigned char modbus_complete_transmission;
-//! Variable used to store if a complete reception was done
-static  unsigned char modbus_complete_reception;
-//!Variable used to store the timeout for broadcast
+//!Variable used to store the timeout for broadcast, in ticks
 static  unsigned long modbus_broadcast_timeout;
-//!Variable used to store the timeout for unicast requests
-static  unsigned long modbus_unicast_timeout;
-//!Variable to index the incoming data
-static unsigned char modbus_index;
-//! Input data
-static unsigned char input_pdu[MAX_PDU];
-//! Input data buffer
-static  unsigned char input_pdu_buffer[MAX_FRAME];
-//! Input data length
-static unsigned char input_length;
-//! Waiting time in cycles*3 between sendings
-static unsigned long modbus_delay;
+//! Broadcast timeout
+static  struct Modbus_Timer modbus_broadcast_timer;
+//! Cycles between two ticks of the timer wheel
+static  unsigned long modbus_tick;
+//! Round-trip time estimator of one slave, in ticks
+struct Modbus_CAN_RTT
+{
+        unsigned long srtt;                     //!< Smoothed round-trip time * 8, 0 if there are no samples yet
+        unsigned long rttvar;                   //!< Round-trip time mean deviation * 4
+};
+//! Round-trip time estimators, one per slave
+static  struct Modbus_CAN_RTT modbus_rtt[MODBUS_CAN_MAX_SLAVE + 1];
 
 //-CAN
 //!Variable used to store the bit rate range of the communications
 static enum  Modbus_CAN_BitRate modbus_bit_rate;
 //! Variable used to store both bit time and rate information
 static tCANBitClkParms modbus_canbit;
-//! Receive Message Object
-static  tCANMsgObject RxObject;
-//! Transmit Message Object
-static  tCANMsgObject TxObject;
+//! One segment (CAN frame) waiting in the TX queue
+struct Modbus_CAN_Segment
+{
+        unsigned long id;                       //!< Message ID, header + slave
+        unsigned char length;                   //!< Data length
+        unsigned char data[MAX_FRAME];          //!< Data
+        unsigned char transaction;              //!< Transaction of the request, MODBUS_CAN_NO_TRANSACTION for a broadcast
+#if MODBUS_TRACE
+        uint16_t handle;                        //!< Handle of the request, for the trace
+        unsigned char function;                 //!< Function code of the request, for the trace
+        unsigned char attempt;                  //!< Attempt of the request, for the trace
+#endif
+};
+//! TX queue; segments waiting for a transmit message object
+static  struct Modbus_CAN_Segment modbus_tx_queue[MODBUS_CAN_TX_QUEUE];
+//! TX queue head, only written by Modbus_CAN_FixOutput()
+static  volatile unsigned char modbus_tx_head;
+//! TX queue tail, only written when a batch was sent
+static  volatile unsigned char modbus_tx_tail;
+//! Segments loaded in the transmit message objects, 0 if they are free
+static  volatile unsigned char modbus_tx_batch;
+#if MODBUS_TRACE
+//! Request whose segments are being added to the TX queue, to tag them for the trace
+static  struct Modbus_CAN_Segment modbus_tx_trace;
+#endif
 //! @}
 
 //FOR DEBUGGING:
@@ -61,10 +106,11 @@ static  tCANMsgObject TxObject;
 //static  unsigned char output_length;
 // Output data; NOT NEEDED
 //static  unsigned char output_pdu[MAX_PDU];
-static unsigned char modbus_timeout;
 
-static unsigned char buu = 0;
-static uint16_t boo = 0;
+static unsigned char Modbus_CAN_Transaction_Open(unsigned char slave);
+static void Modbus_CAN_TX_Start(void);
+static void Modbus_CAN_RTT_Update(unsigned char transaction);
+static void Modbus_CAN_Timer_Expired(void *arg);
 
 void Modbus_CAN_IntHandler(void)
 {
@@ -100,28 +146,45 @@ void Modbus_CAN_IntHandler(void)
         }            
         CANIntClear(MODBUS_CAN, can_status);
     }
-    else if(can_status >= 1 && can_status <= 16)
+    else if(can_status >= 1 && can_status <= MODBUS_CAN_TX_OBJECTS)
     {
-        //LAST SENDING message object should have the interruption pending, so last data was sent             
+        //LAST SENDING message object of the batch should have the interruption pending, so the whole batch was sent             
         CANIntClear(MODBUS_CAN, can_status);//clear interruption        
-        // I should notify in some way that I sent the data correctly       
-        modbus_complete_transmission = 1;                
+        if(can_status == modbus_tx_batch)
+        {
+#if MODBUS_TRACE
+            unsigned char obj;
+            struct Modbus_CAN_Segment *segment;
+            for(obj = 0; obj < modbus_tx_batch; obj++)
+            {
+                segment = &modbus_tx_queue[(unsigned char)(modbus_tx_tail + obj) & (MODBUS_CAN_TX_QUEUE - 1)];
+                //Individual Frame or End Long Frame: the request has left
+                if((segment->id & 0x700) == 0x100 || (segment->id & 0x700) == 0x700)
+                    MODBUS_TRACE_EVENT(MODBUS_TRACE_TX_LAST, segment->id & 0xFF, segment->function,
+                                       segment->handle, segment->attempt, 0, 0);
+            }
+#endif
+            modbus_tx_tail += modbus_tx_batch;
+            modbus_tx_batch = 0;
+            if(modbus_tx_head == modbus_tx_tail)
+            {
+                // I should notify in some way that I sent the data correctly       
+                modbus_complete_transmission = 1;                
+            }
+            else
+            {
+                //Next segments waiting in the TX queue
+                Modbus_CAN_TX_Start();
+            }
+        }
     }
-    else if(can_status == 17) // Message 17 should be the first one to have an interruption
+    else if(can_status >= MODBUS_CAN_RX_OBJECT && can_status < MODBUS_CAN_RX_OBJECT + MODBUS_CAN_MAX_TRANSACTIONS * MODBUS_CAN_RX_FIFO_DEPTH)
     {        
-        //I process the received data:                                      
-         buu = 1;     //DEBUGGGGGGGGGGGGGGGGG
-         if(!modbus_complete_reception)
-         {     
-             ledOn();
-             Modbus_CAN_CallBack();                                                    
-             ledOff();             
-         }                         
-    }
-    else if(can_status == 18)
-    {
-        //NO BROADCAST RESPONSE SHOULD BE RECEIVED in the master!        
-        //Modbus_CAN_CallBack();
+        //I process the received data of the transaction which owns the chain of the message object
+        //NO BROADCAST RESPONSE SHOULD BE RECEIVED in the master, so there is no broadcast message object
+         ledOn();
+         Modbus_CAN_CallBack((can_status - MODBUS_CAN_RX_OBJECT) / MODBUS_CAN_RX_FIFO_DEPTH);
+         ledOff();             
     }
     else
     {
@@ -132,32 +195,40 @@ void Modbus_CAN_IntHandler(void)
 
 void Modbus_CAN_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char attempts)
 {                
+        unsigned char i;
+        modbus_current = MODBUS_CAN_NO_TRANSACTION;
         Modbus_SetMainState(MODBUS_INITIAL);
         /////////////////Variables///////////
 	modbus_max_attempts = attempts;
         modbus_bit_rate = bit_rate;
         Modbus_CAN_SetBitRate(bit_rate);         
-        modbus_forward_flag = 0;                
-        modbus_attempts = 1;  
-        modbus_index = 0;
+        for(i = 0; i < MODBUS_CAN_MAX_TRANSACTIONS; i++)
+        {
+                modbus_transactions[i].state = MODBUS_IDLE;
+                modbus_transactions[i].forward_flag = 0;
+                modbus_transactions[i].attempts = 1;
+                modbus_transactions[i].index = 0;
+                modbus_transactions[i].complete_reception = 0;
+                Modbus_Timer_Setup(&modbus_transactions[i].timer, Modbus_CAN_Timer_Expired, &modbus_transactions[i]);
+        }
+        for(i = 0; i <= MODBUS_CAN_MAX_SLAVE; i++)
+        {
+                modbus_rtt[i].srtt = 0;
+                modbus_rtt[i].rttvar = 0;
+        }
+        Modbus_Timer_Setup(&modbus_broadcast_timer, Modbus_CAN_Timer_Expired, 0);
+        modbus_last = 0;
         modbus_complete_transmission = 0;
-        modbus_complete_reception = 0;
-        modbus_timeout = 0; // DEBUGGGGGGGGGGGGGGGGGGGGG
+        modbus_tx_head = modbus_tx_tail = modbus_tx_batch = 0;
 	//CAN ENABLING	
         SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOD);      
         //I enable the pins to be used as CAN pins
         GPIOPinTypeCAN(GPIO_PORTD_BASE, GPIO_PIN_0 | GPIO_PIN_1);  
         SysCtlPeripheralEnable(SYSCTL_PERIPH_CAN0);       
-        //Timers Initialisation
-        SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER1);
-        SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER2);
         IntMasterEnable();
-        TimerConfigure(TIMER1_BASE, TIMER_CFG_ONE_SHOT);                
-        TimerConfigure(TIMER2_BASE, TIMER_CFG_ONE_SHOT);                        
-        IntEnable(INT_TIMER1A);
-        IntEnable(INT_TIMER2A);
-        TimerIntEnable(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
-        TimerIntEnable(TIMER2_BASE, TIMER_TIMA_TIMEOUT);        
+        //Timer wheel, it keeps the unicast timeouts of all transactions and the broadcast timeout
+        modbus_tick = SysCtlClockGet() / MODBUS_TIMER_TICK_HZ;
+        Modbus_Timer_Init();
         //Init CAN Module
         CANInit(MODBUS_CAN);
         //Set bit timing
@@ -177,12 +248,67 @@ void Modbus_CAN_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char attempts)
 
 enum Modbus_MainState Modbus_GetMainState(void)
 {
+        if(modbus_current != MODBUS_CAN_NO_TRANSACTION)
+                return modbus_transactions[modbus_current].state;
 	return modbus_master_state;
 }
 
 void Modbus_SetMainState(enum Modbus_MainState state)
 {
-	modbus_master_state = state;
+        if(modbus_current != MODBUS_CAN_NO_TRANSACTION)
+                modbus_transactions[modbus_current].state = state;
+        else
+	        modbus_master_state = state;
+}
+
+unsigned char Modbus_CAN_Transaction_Available(unsigned char slave)
+{
+        unsigned char i, free_slot;
+        //Nothing can be sent while a broadcast is on the bus
+        if(modbus_master_state != MODBUS_IDLE)
+                return 0;
+        free_slot = 0;
+        for(i = 0; i < MODBUS_CAN_MAX_TRANSACTIONS; i++)
+        {
+                if(modbus_transactions[i].state == MODBUS_IDLE)
+                        free_slot = 1;
+                //A broadcast needs all the slaves, an unicast only its own one
+                else if(!slave || modbus_transactions[i].slave == slave)
+                        return 0;
+        }
+        return free_slot;
+}
+
+/**
+*     @brief Function to get the transaction of a slave.
+*
+*     If the slave already has a transaction (the request is being resent) that one is returned, otherwise a free one is taken.
+*     @param slave The number of the slave.
+*     @return The transaction number, or MODBUS_CAN_NO_TRANSACTION if all of them are busy.
+*/
+static unsigned char Modbus_CAN_Transaction_Open(unsigned char slave)
+{
+        unsigned char i, free_slot;
+        free_slot = MODBUS_CAN_NO_TRANSACTION;
+        for(i = 0; i < MODBUS_CAN_MAX_TRANSACTIONS; i++)
+        {
+                if(modbus_transactions[i].state == MODBUS_IDLE)
+                {
+                        if(free_slot == MODBUS_CAN_NO_TRANSACTION)
+                                free_slot = i;
+                }
+                else if(modbus_transactions[i].slave == slave)
+                {
+                        return i;
+                }
+        }
+        if(free_slot != MODBUS_CAN_NO_TRANSACTION)
+        {
+                modbus_transactions[free_slot].slave = slave;
+                modbus_transactions[free_slot].attempts = 1;
+                modbus_transactions[free_slot].forward_flag = 0;
+        }
+        return free_slot;
 }
 
 void Modbus_CAN_SetBitRate(enum Modbus_CAN_BitRate bit_rate)
@@ -194,52 +320,147 @@ void Modbus_CAN_SetBitRate(enum Modbus_CAN_BitRate bit_rate)
                           modbus_canbit.ulPhase2Seg = 4;
                           modbus_canbit.ulSJW = 4;
                           modbus_canbit.ulQuantumPrescaler = 8;
-                          /*(4000000/3) * 0.07 *10 = 9333333 ("TRANSFER TIME"); 
-                             900000 * 4 = process time
-                          */
-                          modbus_delay = 9333333 + 900000*4; // 10 times slower THAN 1MBPS
                           break;
             case MODBUS_1MBPS:
                           modbus_canbit.ulSyncPropPhase1Seg = 5;      //3 *tq; following the example from the microcontroller's pdf
                           modbus_canbit.ulPhase2Seg = 2;
                           modbus_canbit.ulSJW = 2;
                           modbus_canbit.ulQuantumPrescaler = 1;
-                          /*(4000000/3) * 0.07 = 933333 ("TRANSFER TIME"); 
-                            900000*4 = process time
-                          */
-                          modbus_delay = 933333 + 900000*4;
                           break;
             default : Modbus_CAN_Error_Management(110); break;
       }
 }
 
+/**
+*     @brief Function to load the next segments into the transmit message objects.
+*
+*     If the transmit message objects are free, up to MODBUS_CAN_TX_OBJECTS segments are loaded from the TX queue into the message
+*     objects 1, 2, 3... As the CAN controller sends first the lowest message object, they leave in order and only the last one
+*     needs the TX interruption: when it arrives, the whole batch was sent. When the last segment of an unicast request is loaded,
+*     the round-trip time of its transaction starts, so the time it waited in the TX queue behind other segments is not counted.
+*     @note It is called from the CAN interrupt or with the CAN interrupt disabled.
+*/
+static void Modbus_CAN_TX_Start(void)
+{
+        unsigned char pending, obj;
+        struct Modbus_CAN_Segment *segment;
+        tCANMsgObject tx_object;
+        if(modbus_tx_batch)
+                return; //The message objects are still busy
+        pending = (unsigned char)(modbus_tx_head - modbus_tx_tail);
+        if(pending > MODBUS_CAN_TX_OBJECTS)
+                pending = MODBUS_CAN_TX_OBJECTS;
+        modbus_tx_batch = pending;
+        tx_object.ulMsgIDMask = 0x000;//It's not used mask, I send all messages without filtering
+        for(obj = 1; obj <= pending; obj++)
+        {
+                segment = &modbus_tx_queue[(unsigned char)(modbus_tx_tail + obj - 1) & (MODBUS_CAN_TX_QUEUE - 1)];
+                tx_object.ulMsgID = segment->id;
+                tx_object.ulMsgLen = segment->length;
+                tx_object.pucMsgData = segment->data;
+                // Only the last one of the batch uses INTERRUPTIONS
+                tx_object.ulFlags = (obj == pending) ? MSG_OBJ_TX_INT_ENABLE : MSG_OBJ_NO_FLAGS;
+#if MODBUS_CAN_SEQUENCE
+                tx_object.ulFlags |= MSG_OBJ_EXTENDED_ID;
+#endif
+                CANMessageSet(MODBUS_CAN, obj, &tx_object, MSG_OBJ_TYPE_TX);
+                //Individual Frame or End Long Frame: the request goes on the bus now
+                if(segment->transaction != MODBUS_CAN_NO_TRANSACTION &&
+                   ((segment->id & 0x700) == 0x100 || (segment->id & 0x700) == 0x700))
+                        modbus_transactions[segment->transaction].sent = Modbus_Timer_Now();
+#if MODBUS_TRACE
+                //Individual Frame or Beginning Long Frame: the request starts
+                if(!(segment->id & 0x400))
+                        MODBUS_TRACE_EVENT(MODBUS_TRACE_TX_FIRST, segment->id & 0xFF, segment->function,
+                                           segment->handle, segment->attempt, 0, 0);
+#endif
+        }
+}
+
+/**
+*     @brief Function to add a segment to the TX queue.
+*
+*     If the TX queue is full, it waits until the CAN interrupt makes room for it.
+*     @param id Message ID (header + slave).
+*     @param data Segment data.
+*     @param length Segment length (up to MAX_FRAME).
+*     @param transaction Transaction of the request, MODBUS_CAN_NO_TRANSACTION for a broadcast.
+*/
+static void Modbus_CAN_TX_Enqueue(unsigned long id, unsigned char *data, unsigned char length, unsigned char transaction)
+{
+        int i;
+        struct Modbus_CAN_Segment *segment;
+        while((unsigned char)(modbus_tx_head - modbus_tx_tail) >= MODBUS_CAN_TX_QUEUE)
+        {
+                //Full; the queue is being emptied by the CAN interrupt
+                IntDisable(INT_CAN0);
+                Modbus_CAN_TX_Start();
+                IntEnable(INT_CAN0);
+        }
+        segment = &modbus_tx_queue[modbus_tx_head & (MODBUS_CAN_TX_QUEUE - 1)];
+        segment->id = id;
+        segment->length = length;
+        segment->transaction = transaction;
+#if MODBUS_TRACE
+        segment->handle = modbus_tx_trace.handle;
+        segment->function = modbus_tx_trace.function;
+        segment->attempt = modbus_tx_trace.attempt;
+#endif
+        for(i=0; i < length; i++)
+        {
+                segment->data[i] = data[i];
+        }
+        modbus_tx_head++;
+}
+
 void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char slave, unsigned char pdu_length, uint16_t amount_guess)
 {
-        unsigned char aux_length;
-        unsigned char local_output[8];        
-        int i, iterations, objNumber;// index;// OUTPUT_PDU IS NOT NEEDED, ONLY IN DEBUG
+        unsigned char aux_length, frame_length, transaction;
+        int iterations;
         uint16_t registerr;               
+        unsigned long id;
             //init variables            
-            objNumber = 1;    
             iterations = 0;  
             aux_length = pdu_length;
             registerr = 0x000;
-            //index = 0;            
-            //storing in global variables
-            //output_length = pdu_length;
+            transaction = MODBUS_CAN_NO_TRANSACTION;
             modbus_complete_transmission = 0;                 
             //TURN ON LED
             ledOn();
             if(slave)
-                Modbus_CAN_ReceptionConfiguration(slave);
-            else
-                modbus_complete_reception = 0;            
+            {
+                //The slave keeps its transaction while the request is resent
+                transaction = Modbus_CAN_Transaction_Open(slave);
+                if(transaction == MODBUS_CAN_NO_TRANSACTION)
+                {
+                    //APP layer only sends when Modbus_CAN_Transaction_Available() allows it
+                    Modbus_CAN_Error_Management(110);
+                    return;
+                }
+                Modbus_App_Actual_Req_Get(&modbus_transactions[transaction].request);
+                //Until the last segment is loaded to be sent, see Modbus_CAN_TX_Start()
+                modbus_transactions[transaction].sent = Modbus_Timer_Now();
+                //The CAN interrupt also sets message objects up
+                IntDisable(INT_CAN0);
+                Modbus_CAN_ReceptionConfiguration(transaction, slave);
+                IntEnable(INT_CAN0);
+                modbus_last = transaction;
+            }
+#if MODBUS_TRACE
+            modbus_tx_trace.handle = Modbus_App_Actual_Handle();
+            modbus_tx_trace.function = mb_req_pdu[0];
+            modbus_tx_trace.attempt = slave ? modbus_transactions[transaction].attempts : 1;
+#endif
+#if MODBUS_STATS
+            Modbus_Stats_Sent(slave, mb_req_pdu[0], pdu_length, slave ? modbus_transactions[transaction].attempts : 1);
+            if(slave)
+                modbus_transactions[transaction].stamp = Modbus_Timer_Stamp();
+#endif
             //body:
             // 001 + 00000000(slave)= Individual Frame (1)
             // 011 + slave = Beginning Long Frame (3)
             // 101 + slave = Continuation Long Frame (5)
             // 111 + slave = End Long Frame (7)
-            TxObject.ulMsgIDMask = 0x000;//It's not used mask, I send all messages without filtering                                                             
             while(aux_length) // != 0 true
             {                
                 if(aux_length <= MAX_FRAME) //ONE FRAME OR THE LAST LONG ONE
@@ -249,31 +470,7 @@ void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char slave, unsign
                     {              
                           registerr = 0x1;                               
                     }                    
-                    TxObject.ulFlags = MSG_OBJ_TX_INT_ENABLE;
-                    TxObject.ulMsgID = ((registerr << 8) | slave);                    
-                    TxObject.ulMsgLen = aux_length;      
-                    /* It's the last frame so:
-                       Maximum size to send - remainder + i
-                    */                      
-                    for(i=0; i < aux_length; i++)
-                    {
-                        local_output[i] = mb_req_pdu[i + (iterations * MAX_FRAME)]; 
-                        //output_pdu[index++] = local_output[i];                        
-                    }                                              
-                    aux_length -= aux_length;// it should be 0 now                        
-                    //It is checked if is an unicast or a broadcast, and it is put the timers
-                    if(slave) //unicast
-                    {
-                          Modbus_SetMainState(MODBUS_WAITREPLY);
-                          Modbus_CAN_UnicastTimeout(amount_guess);
-                    }
-                    else//slave == 0
-                    {
-                          Modbus_SetMainState(MODBUS_TURNAROUND);
-                          Modbus_CAN_BroadcastTimeout(amount_guess);
-                    }
-                    //TURN OFF LED
-                    ledOff();
+                    frame_length = aux_length;
                 }
                 else //division needed because it's > 8
                 {
@@ -284,264 +481,521 @@ void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char slave, unsign
                     {
                         registerr = 0x3;
                     }
-                    TxObject.ulMsgID = ((registerr << 8) | slave);
-                    // not the last frame, so I do NOT use INTERRUPTIONS
-                    TxObject.ulFlags = MSG_OBJ_NO_FLAGS;
-                    TxObject.ulMsgLen = MAX_FRAME;
-                    for(i=0; i < MAX_FRAME; i++)
-                    {
-                        local_output[i] = mb_req_pdu[i + (iterations * MAX_FRAME)];
-                        //output_pdu[index++] = local_output[i];                        
-                    }
-                    aux_length -= MAX_FRAME;
-                    iterations++;
+                    frame_length = MAX_FRAME;
                 }
-                TxObject.pucMsgData = local_output;
-                CANMessageSet(MODBUS_CAN, objNumber, &TxObject, MSG_OBJ_TYPE_TX);                    
-                // If is not the last frame
-                if(aux_length)               
-                    Modbus_CAN_Delay();                
+                id = (registerr << 8) | slave;
+#if MODBUS_CAN_SEQUENCE
+                //Chunk number and total length in the 29-bits message ID
+                id |= ((unsigned long)iterations << MODBUS_CAN_SEQ_SHIFT) | ((unsigned long)pdu_length << MODBUS_CAN_LENGTH_SHIFT);
+#endif
+                Modbus_CAN_TX_Enqueue(id, &mb_req_pdu[iterations * MAX_FRAME], frame_length, transaction);
+                aux_length -= frame_length;
+                iterations++;
             }                       
+            //It is checked if is an unicast or a broadcast, and it is put the timers
+            if(slave) //unicast
+            {
+                  modbus_transactions[transaction].state = MODBUS_WAITREPLY;
+                  Modbus_CAN_UnicastTimeout(transaction, amount_guess);
+            }
+            else//slave == 0
+            {
+                  modbus_master_state = MODBUS_TURNAROUND;
+                  Modbus_CAN_BroadcastTimeout(amount_guess);
+            }
+            //The segments leave from the CAN interrupt; I do not wait for them
+            IntDisable(INT_CAN0);
+            Modbus_CAN_TX_Start();
+            IntEnable(INT_CAN0);
+            //TURN OFF LED
+            ledOff();
 }
 
-void Modbus_CAN_ReceptionConfiguration(unsigned char slave)
+void Modbus_CAN_ReceptionConfiguration(unsigned char transaction, unsigned char slave)
 {
-        int objNumber = 17;        
-        modbus_complete_reception = 0;
-       //RECEPTION MESSAGE OBJECT num.17          
+        int i, numObj;
+        tCANMsgObject rx_object;
+        modbus_transactions[transaction].complete_reception = 0;
+        modbus_transactions[transaction].index = 0;
+#if MODBUS_CAN_SEQUENCE
+        modbus_transactions[transaction].expected_length = 0;
+#endif
+       //RECEPTION FIFO of the transaction (a chain of message objects inside 17..32)
         //I will receive all types of answer from the concrete slave
-        RxObject.ulMsgID = slave; //xx0+ 0000+ 0000
-        RxObject.ulMsgIDMask = 0x1FF;        
-        RxObject.ulFlags = MSG_OBJ_USE_ID_FILTER | MSG_OBJ_RX_INT_ENABLE;
-        RxObject.pucMsgData = &input_pdu_buffer[0];
-        CANMessageSet(MODBUS_CAN, objNumber, &RxObject, MSG_OBJ_TYPE_RX);    
+        rx_object.ulMsgID = slave; //xx0+ 0000+ 0000
+        rx_object.ulMsgIDMask = 0x1FF;        
+        rx_object.ulMsgLen = MAX_FRAME;
+        rx_object.pucMsgData = modbus_transactions[transaction].input_pdu;
+        numObj = MODBUS_CAN_RX_OBJECT + transaction * MODBUS_CAN_RX_FIFO_DEPTH;
+        for(i = 0; i < MODBUS_CAN_RX_FIFO_DEPTH; i++)
+        {
+                //Every message object but the last one of the chain goes on to the next one when it is full
+                rx_object.ulFlags = MSG_OBJ_USE_ID_FILTER | MSG_OBJ_RX_INT_ENABLE;
+#if MODBUS_CAN_SEQUENCE
+                //Only 29-bits message IDs; the mask still looks at the 9 lower bits
+                rx_object.ulFlags |= MSG_OBJ_EXTENDED_ID | MSG_OBJ_USE_EXT_FILTER;
+#endif
+                if(i < MODBUS_CAN_RX_FIFO_DEPTH - 1)
+                        rx_object.ulFlags |= MSG_OBJ_FIFO;
+                CANMessageSet(MODBUS_CAN, numObj + i, &rx_object, MSG_OBJ_TYPE_RX);    
+        }
         //No broadcast receive message object is needed
 }
 
-void Modbus_CAN_CallBack(void)
+#if MODBUS_CAN_SEQUENCE
+/**
+*    @brief Function to check the chunk number and total length of a received segment.
+*
+*    The chunk number has to be the next one of the answer and the total length the one announced by the beginning. If a chunk is
+*    missing, the answer is given up at once and the transaction goes to _MODBUS_ERROR_, so the request is resent without waiting
+*    for the unicast timeout. Chunks of a long answer whose beginning was not received are thrown away.
+*    @param transaction The transaction which received the segment.
+*    @param rx_object The segment read from the message object.
+*    @return <b>0</b> if the segment has to be processed, <b>1</b> if it has to be thrown away.
+*/
+static unsigned char Modbus_CAN_Sequence_Check(unsigned char transaction, tCANMsgObject *rx_object)
 {
-    // I am expecting for xx0 | slave because the mask of the message object was 1FF;    
-    int i, numObj;
-    uint32_t new_data, mask;
-    numObj = 17;
-    mask = 0x10000;
-    new_data = CANStatusGet(MODBUS_CAN, CAN_STS_NEWDAT);      
-    if(( (new_data & mask) >> (numObj-1) ) == 1)
-    {                                             
-        CANMessageGet(MODBUS_CAN, numObj, &RxObject, true); // I DO CLEAN THE INTERRUPTION                
+        unsigned long header, sequence;
+        uint16_t length;
+        struct Modbus_CAN_Transaction *t;
+        t = &modbus_transactions[transaction];
+        header = rx_object->ulMsgID & 0x700;
+        sequence = (rx_object->ulMsgID >> MODBUS_CAN_SEQ_SHIFT) & MODBUS_CAN_SEQ_MASK;
+        length = (rx_object->ulMsgID >> MODBUS_CAN_LENGTH_SHIFT) & MODBUS_CAN_LENGTH_MASK;
+        if(header == 0x000 || header == 0x200) //Individual or Beginning Long Frame
+        {
+                if(sequence != 0 || (header == 0x000 && length != rx_object->ulMsgLen))
+                {
+                        t->state = MODBUS_ERROR;
+                        Modbus_CAN_RemoveTimeout(transaction);
+                        return 1;
+                }
+                t->expected_length = (header == 0x200) ? length : 0;
+                return 0;
+        }
+        if(!t->expected_length)
+                return 1; //Rest of an answer already given up, or its beginning was lost (the unicast timeout handles it)
+        if(sequence != (t->index / MAX_FRAME) || length != t->expected_length
+           || (header == 0x600 && t->index + rx_object->ulMsgLen != t->expected_length))
+        {
+                //A chunk is missing: I give up the answer and it is resent
+                t->expected_length = 0;
+                t->state = MODBUS_ERROR;
+                Modbus_CAN_RemoveTimeout(transaction);
+                return 1;
+        }
+        if(header == 0x600)
+                t->expected_length = 0;
+        return 0;
+}
+#endif
+
+/**
+*    @brief Function to process one received segment of an answer.
+*
+*    @param transaction The transaction which owns the message object where the segment was received.
+*    @param rx_object The segment read from the message object.
+*/
+static void Modbus_CAN_Segment_Process(unsigned char transaction, tCANMsgObject *rx_object)
+{
+        int i;
+        struct Modbus_CAN_Transaction *t;
+        t = &modbus_transactions[transaction];
+        // A late frame of an answer already received or given up is thrown away
+        if(t->state != MODBUS_WAITREPLY || t->complete_reception)
+            return;
+#if MODBUS_CAN_SEQUENCE
+        if(Modbus_CAN_Sequence_Check(transaction, rx_object))
+            return;
+#endif
         //header should be 000
-        if( (RxObject.ulMsgID & 0x700) == 0x000) //Individual Frame
+#if MODBUS_TRACE
+        //Individual Frame or Beginning Long Frame: the answer starts
+        if(!(rx_object->ulMsgID & 0x400))
+              MODBUS_TRACE_EVENT(MODBUS_TRACE_RX_FIRST, t->request.Slave, t->request.Function,
+                                 t->request.Handle, t->attempts, 0, 0);
+#endif
+        if( (rx_object->ulMsgID & 0x700) == 0x000) //Individual Frame
         {
-              modbus_complete_reception = 1;
-              Modbus_CAN_RemoveTimeout();
-              input_length = RxObject.ulMsgLen;
-              modbus_index = input_length;                          
-              for(i=0; i < RxObject.ulMsgLen; i++)
+              t->complete_reception = 1;
+              MODBUS_TRACE_EVENT(MODBUS_TRACE_RX_COMPLETE, t->request.Slave, t->request.Function,
+                                 t->request.Handle, t->attempts, 0, 0);
+              Modbus_CAN_RemoveTimeout(transaction);
+              Modbus_CAN_RTT_Update(transaction);
+              t->input_length = rx_object->ulMsgLen;
+              t->index = t->input_length;                          
+#if MODBUS_STATS
+              Modbus_Stats_Answer(t->request.Slave, t->request.Function, t->input_length,
+                                  Modbus_Timer_Stamp() - t->stamp, 1);
+#endif
+              for(i=0; i < rx_object->ulMsgLen; i++)
               {
-                    input_pdu[i] = RxObject.pucMsgData[i];
+                    t->input_pdu[i] = rx_object->pucMsgData[i];
               }                              
-              boo = 1;
         }
         //header should be 010
-        else if( (RxObject.ulMsgID & 0x700) == 0x200) // Beginning Long Frame
+        else if( (rx_object->ulMsgID & 0x700) == 0x200) // Beginning Long Frame
         {              
-              for(i=0; i < RxObject.ulMsgLen; i++)
+              for(i=0; i < rx_object->ulMsgLen; i++)
               {
-                    input_pdu[i] = RxObject.pucMsgData[i];
+                    t->input_pdu[i] = rx_object->pucMsgData[i];
               }              
-              modbus_index = RxObject.ulMsgLen;                 
-              boo = 1;
+              t->index = rx_object->ulMsgLen;                 
         }        
         // I CATCH OUT THE CONTINUATION LONG FRAMES and the END ONES                
-        else if( ( (RxObject.ulMsgID & 0x700) == 0x400) || ( (RxObject.ulMsgID & 0x700) == 0x600) )
+        else if( ( (rx_object->ulMsgID & 0x700) == 0x400) || ( (rx_object->ulMsgID & 0x700) == 0x600) )
         {
-            for(i=0; i < RxObject.ulMsgLen; i++)
+            if(t->index + rx_object->ulMsgLen >= MAX_PDU)
             {
-                input_pdu[modbus_index + i] = RxObject.pucMsgData[i];
+                // More data than a PDU (253 bytes) or than index and input_length can hold; the answer is wrong
+                t->state = MODBUS_ERROR;
+                return;
+            }
+            for(i=0; i < rx_object->ulMsgLen; i++)
+            {
+                t->input_pdu[t->index + i] = rx_object->pucMsgData[i];
             }            
-            modbus_index += RxObject.ulMsgLen;                    
+            t->index += rx_object->ulMsgLen;                    
             //END LONG FRAME
-            if( (RxObject.ulMsgID & 0x700) == 0x600)
+            if( (rx_object->ulMsgID & 0x700) == 0x600)
             {                  
-                  modbus_complete_reception = 1;                     
-                  Modbus_CAN_RemoveTimeout();                  
-                  input_length = modbus_index;                        
+                  t->complete_reception = 1;                     
+                  MODBUS_TRACE_EVENT(MODBUS_TRACE_RX_COMPLETE, t->request.Slave, t->request.Function,
+                                     t->request.Handle, t->attempts, 0, 0);
+                  Modbus_CAN_RemoveTimeout(transaction);                  
+                  Modbus_CAN_RTT_Update(transaction);
+                  t->input_length = t->index;                        
+#if MODBUS_STATS
+                  Modbus_Stats_Answer(t->request.Slave, t->request.Function, t->input_length,
+                                      Modbus_Timer_Stamp() - t->stamp, 1);
+#endif
             }
-            boo = 0;
          }
          else
          {
              // IT WAS EXPECTED A CONTINUATION OR AN END;IT SHOULD NOT ENTER HERE
-             Modbus_SetMainState(MODBUS_ERROR);
+             t->state = MODBUS_ERROR;
          }                          
-      }         
-      else
-      {     // IT WAS EXPECTED NEW DATA; IT SHOULD NOT ENTER HERE
-            Modbus_SetMainState(MODBUS_ERROR);
-      }                
+}
+
+void Modbus_CAN_CallBack(unsigned char transaction)
+{
+    // I am expecting for xx0 | slave because the mask of the message objects was 1FF;    
+    int i, numObj, next;
+    uint32_t pending;
+    tCANMsgObject rx_object;
+    unsigned char input_pdu_buffer[MAX_FRAME];
+    numObj = MODBUS_CAN_RX_OBJECT + transaction * MODBUS_CAN_RX_FIFO_DEPTH;
+    rx_object.pucMsgData = input_pdu_buffer;
+    // The controller fills the lowest object of the chain without new data, so an object already read can be filled again
+    // while a higher one is waiting: the chain is read in FIFO order, from the object after the last one read up to the end
+    // and only then from the beginning, until it is empty. The controller starts again from the first object then, so does this.
+    next = 0;
+    while(1)
+    {
+        pending = (CANStatusGet(MODBUS_CAN, CAN_STS_NEWDAT) >> (numObj - 1)) & ((1UL << MODBUS_CAN_RX_FIFO_DEPTH) - 1);
+        if(!pending)
+            break;
+        for(i = next; i < MODBUS_CAN_RX_FIFO_DEPTH && !(pending & (1UL << i)); i++);
+        if(i == MODBUS_CAN_RX_FIFO_DEPTH)
+            for(i = 0; !(pending & (1UL << i)); i++);
+        next = (i + 1 < MODBUS_CAN_RX_FIFO_DEPTH) ? i + 1 : 0;
+        CANMessageGet(MODBUS_CAN, numObj + i, &rx_object, true); // I DO CLEAN THE INTERRUPTION                
+        Modbus_CAN_Segment_Process(transaction, &rx_object);
+    }
 }
 
 unsigned char Modbus_CAN_Controller(void)
 {
-	 switch(Modbus_GetMainState())
-	 {
-	 	 case MODBUS_IDLE:
-                                 // Is it needed to resend?
-                                 if(Modbus_CAN_GetForwardFlag())
-                                 {
-                                        Modbus_App_Send(); //From APP layer I send again the Output data
-                                 }
-                                 else
-                                 {
-                                   //If forward is not needed and there are messages left in the FIFO, the next one is sent.
-                                   // If there are no messages left in the FIFO, it's returned 0.
-                                   if(Modbus_App_FIFOSend())
-                                     return 0;
-                                 }
-                                 break;
-	 	 case MODBUS_WAITREPLY:
+        unsigned char i, result;
+        struct Modbus_CAN_Transaction *t;
+        //Every transaction in flight is handled on its own
+        for(i = 0; i < MODBUS_CAN_MAX_TRANSACTIONS; i++)
+        {
+                t = &modbus_transactions[i];
+                modbus_current = i;
+	        switch(t->state)
+	        {
+	 	        case MODBUS_WAITREPLY:
                                    //I am waiting an answer, if there is already one, it's processed
-                                   if(modbus_complete_reception)
+                                   if(t->complete_reception)
                                    {
-                                          modbus_complete_reception = 0;
-                                          Modbus_SetMainState(MODBUS_PROCESSING);
+                                          t->complete_reception = 0;
+                                          t->state = MODBUS_PROCESSING;
+                                          Modbus_App_Actual_Req_Set(&t->request);
                                           Modbus_CAN_to_App();
                                           Modbus_App_Manage_CallBack();                                         
                                    }                                                                   
                                     break;
-                 case MODBUS_TURNAROUND: /* NOTHING, I JUST WAIT FOR BROADCAST TIMEOUT*/
-                                    break;
-	 	 case MODBUS_ERROR:	 		 	
+	 	        case MODBUS_ERROR:	 		 	
 	 		          // Wrong answer, forward flag activated
-	 		          // If max. attempts is achieved, we forget & pass to IDLE
+	 		          // If max. attempts is achieved, we forget & the transaction is released
+                                    Modbus_App_Actual_Req_Set(&t->request);
                                     Modbus_CAN_Repeat_Request();                                    
-                                    Modbus_SetMainState(MODBUS_IDLE);	 		        
+                                    if(Modbus_CAN_GetForwardFlag())
+                                          Modbus_App_Send(); //From APP layer I send again the Output data
+                                    else if(t->state != MODBUS_BACKOFF)
+                                          t->state = MODBUS_IDLE;
                                     break;
-	 }
-         return 1;
-}
-
-void Modbus_CAN_Delay(void)
-{
-    SysCtlDelay(modbus_delay);
+                        case MODBUS_BACKOFF:
+                                    //The request is resent once its backoff is over
+                                    if(!Modbus_Timer_Armed(&t->timer))
+                                    {
+                                          Modbus_App_Actual_Req_Set(&t->request);
+                                          Modbus_App_Send();
+                                    }
+                                    break;
+                        default:    /* MODBUS_IDLE: free transaction */
+                                    break;
+	        }
+        }
+        modbus_current = MODBUS_CAN_NO_TRANSACTION;
+        //While there are free transactions, the next requests of the FIFO are sent.
+        do
+        {
+                result = Modbus_App_FIFOSend();
+        }while(result == 0);
+        //Still requests waiting for their slave, a broadcast on the bus or transactions in flight
+        if(result == 2 || modbus_master_state != MODBUS_IDLE)
+                return 1;
+        for(i = 0; i < MODBUS_CAN_MAX_TRANSACTIONS; i++)
+        {
+                if(modbus_transactions[i].state != MODBUS_IDLE)
+                        return 1;
+        }
+        return 0;
 }
 
 unsigned char Modbus_CAN_GetForwardFlag(void)
 {
 	unsigned char result;
-	result = modbus_forward_flag;
-	modbus_forward_flag = 0;
+	result = modbus_transactions[modbus_current].forward_flag;
+	modbus_transactions[modbus_current].forward_flag = 0;
 	return result;
 }
 
 void Modbus_CAN_Reset_Attempt(void)
 {
-	modbus_attempts = 1;
+	modbus_transactions[modbus_current].attempts = 1;
 }
 
 
 void Modbus_CAN_Repeat_Request(void)
 {
-  if(modbus_attempts < modbus_max_attempts)
+  struct Modbus_CAN_Transaction *t;
+  unsigned long backoff;
+  t = &modbus_transactions[modbus_current];
+  if(t->attempts < Modbus_App_Max_Attempts(modbus_max_attempts))
   {
-      //I resend, so I activate the flag
-      modbus_attempts++;
-      modbus_forward_flag = 1;
+      t->attempts++;
+      backoff = Modbus_App_Backoff(t->attempts);
+      if(backoff)
+      {
+          //I wait before resending, the timer is free since the answer is not awaited
+          t->state = MODBUS_BACKOFF;
+          Modbus_Timer_Arm(&t->timer, backoff);
+      }
+      else
+      {
+          //I resend, so I activate the flag
+          t->forward_flag = 1;
+      }
   }
   else
   {     
       // I cannot resend, so I forget
-      Modbus_App_No_Response();
-      modbus_attempts = 1;
+      Modbus_App_No_Response(MODBUS_STATUS_TIMEOUT);
+      t->attempts = 1;
   }
 }
 
-void Modbus_CAN_Timeouts(void)
+void Modbus_CAN_Timeouts(unsigned char transaction)
 {
-  switch(Modbus_GetMainState())
+  if(transaction == MODBUS_CAN_NO_TRANSACTION)
+  {
+      //Broadcast timeout
+      if(modbus_master_state == MODBUS_TURNAROUND)
+          modbus_master_state = MODBUS_IDLE;
+      else
+          Modbus_CAN_Error_Management(110);
+      return;
+  }
+  switch(modbus_transactions[transaction].state)
   {
     case MODBUS_WAITREPLY:          
-          Modbus_SetMainState(MODBUS_ERROR);
-          break;
-    case MODBUS_TURNAROUND:
-          Modbus_SetMainState(MODBUS_IDLE);
+          modbus_transactions[transaction].state = MODBUS_ERROR;
           break;
     default:
-          Modbus_CAN_Error_Management(110);
+          //The answer arrived at the same time than the timeout
+          break;
   }
 }
 
-void Modbus_CAN_UnicastTimeoutHandler(void)
-{            
-    if(!modbus_complete_reception)
-    {        
-        Modbus_CAN_Timeouts();
-        modbus_timeout = 1; //DEBUGGGGGGGGGGGGGGGGGGGGGGGGG
-    }    
-    TimerIntClear(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
+/**
+*     @brief Function called by the timer wheel when a unicast or the broadcast timeout expires.
+*
+*     @param arg The transaction whose unicast timeout expired, or 0 for the broadcast timeout.
+*/
+static void Modbus_CAN_Timer_Expired(void *arg)
+{
+    struct Modbus_CAN_Transaction *t = arg;
+    if(!t)
+    {
+        Modbus_CAN_Timeouts(MODBUS_CAN_NO_TRANSACTION);
+        return;
+    }
+    if(!t->complete_reception)
+    {
+        Modbus_CAN_Timeouts(t - modbus_transactions);
+    }
+}
+
+/**
+*     @brief Function to give the timeout learnt for a slave.
+*
+*     @param slave The number of the slave.
+*     @return Smoothed round-trip time plus four times its mean deviation, in ticks and between the floor and the ceiling, or 0
+*     if there are no samples of the slave yet.
+*/
+static unsigned long Modbus_CAN_RTT_Timeout(unsigned char slave)
+{
+        unsigned long rto;
+        if(slave > MODBUS_CAN_MAX_SLAVE || !modbus_rtt[slave].srtt)
+                return 0;
+        rto = (modbus_rtt[slave].srtt >> 3) + modbus_rtt[slave].rttvar;
+        if(rto < MODBUS_CAN_RTO_MIN_MS * MODBUS_TIMER_TICK_HZ / 1000)
+                rto = MODBUS_CAN_RTO_MIN_MS * MODBUS_TIMER_TICK_HZ / 1000;
+        if(rto > MODBUS_CAN_RTO_MAX_MS * MODBUS_TIMER_TICK_HZ / 1000)
+                rto = MODBUS_CAN_RTO_MAX_MS * MODBUS_TIMER_TICK_HZ / 1000;
+        return rto;
+}
+
+/**
+*     @brief Function to add a round-trip time sample to the estimator of the slave of a transaction.
+*
+*     It is called when the answer is complete. Answers to resent requests are not taken into account (Karn's rule), as it is not
+*     known which attempt they answer.
+*     @param transaction The transaction which received the answer.
+*/
+static void Modbus_CAN_RTT_Update(unsigned char transaction)
+{
+        long delta;
+        unsigned long sample;
+        struct Modbus_CAN_RTT *rtt;
+        if(modbus_transactions[transaction].attempts != 1 || modbus_transactions[transaction].slave > MODBUS_CAN_MAX_SLAVE)
+                return;
+        rtt = &modbus_rtt[modbus_transactions[transaction].slave];
+        sample = Modbus_Timer_Now() - modbus_transactions[transaction].sent;
+        //At least one tick, as 0 means no samples; no more than the ceiling
+        if(sample < 1)
+                sample = 1;
+        if(sample > MODBUS_CAN_RTO_MAX_MS * MODBUS_TIMER_TICK_HZ / 1000)
+                sample = MODBUS_CAN_RTO_MAX_MS * MODBUS_TIMER_TICK_HZ / 1000;
+        if(!rtt->srtt)
+        {
+                //First sample: srtt = sample, rttvar = sample / 2
+                rtt->srtt = sample << 3;
+                rtt->rttvar = sample << 1;
+                return;
+        }
+        //srtt += (sample - srtt) / 8; rttvar += (|sample - srtt| - rttvar) / 4
+        delta = (long)sample - (long)(rtt->srtt >> 3);
+        rtt->srtt += delta;
+        if(delta < 0)
+                delta = -delta;
+        delta -= (long)(rtt->rttvar >> 2);
+        rtt->rttvar += delta;
 }
 
-void Modbus_CAN_UnicastTimeout(uint16_t amount_guess)
+void Modbus_CAN_UnicastTimeout(unsigned char transaction, uint16_t amount_guess)
 {
+   unsigned long modbus_unicast_timeout;
+   unsigned char attempts;
+   attempts = modbus_transactions[transaction].attempts;
+   modbus_unicast_timeout = Modbus_CAN_RTT_Timeout(modbus_transactions[transaction].slave);
+   if(modbus_unicast_timeout)
+   {
+         //Learnt timeout, doubled on every new attempt; it saturates at the ceiling before the shift can overflow
+         if(attempts - 1 >= 32 ||
+            modbus_unicast_timeout > ((unsigned long)(MODBUS_CAN_RTO_MAX_MS * MODBUS_TIMER_TICK_HZ / 1000) >> (attempts - 1)))
+                modbus_unicast_timeout = MODBUS_CAN_RTO_MAX_MS * MODBUS_TIMER_TICK_HZ / 1000;
+         else
+                modbus_unicast_timeout <<= (attempts - 1);
+         Modbus_Timer_Arm(&modbus_transactions[transaction].timer, modbus_unicast_timeout);
+         return;
+   }
+   //No samples of the slave yet
    switch(modbus_bit_rate)
    {
          case MODBUS_100KBPS:    
                           /*
                              (amount_guess * 9333333) = TRANSFER TIME
                              (900000 * amount_guess * 4) = PROCESS TIME
-                             ((modbus_attempts-1) * 8000) = CONGESTION AVOIDANCE
+                             ((attempts-1) * 8000) = CONGESTION AVOIDANCE
                           */  
-                          modbus_unicast_timeout = (amount_guess * 9333333) + (900000 * amount_guess * 4) + ((modbus_attempts-1) * 8000);                                                    
+                          modbus_unicast_timeout = (amount_guess * 9333333) + (900000 * amount_guess * 4) + ((attempts-1) * 8000);                                                    
                           break;
                           
          case MODBUS_1MBPS: /*
                              (amount_guess * 933333) = TRANSFER TIME
                              (900000 * amount_guess * 4) = PROCESS TIME
-                             ((modbus_attempts-1) * 8000) = CONGESTION AVOIDANCE
+                             ((attempts-1) * 8000) = CONGESTION AVOIDANCE
                             */                         
-                          modbus_unicast_timeout = (amount_guess * 933333) + (900000 * amount_guess * 4) + ((modbus_attempts-1) * 8000);
+                          modbus_unicast_timeout = (amount_guess * 933333) + (900000 * amount_guess * 4) + ((attempts-1) * 8000);
                           break;     
    }
-   TimerLoadSet(TIMER1_BASE, TIMER_A, modbus_unicast_timeout);      
-   TimerEnable(TIMER1_BASE, TIMER_A);
-}
-
-void Modbus_CAN_BroadcastTimeoutHandler(void)
-{    
-        Modbus_CAN_Timeouts();
-        TimerIntClear(TIMER2_BASE, TIMER_TIMA_TIMEOUT);
+   //From cycles to ticks, rounded up
+   Modbus_Timer_Arm(&modbus_transactions[transaction].timer, (modbus_unicast_timeout / modbus_tick) + 1);
 }
 
 void Modbus_CAN_BroadcastTimeout(uint16_t amount_guess)
 {
-   switch(modbus_bit_rate)
+   unsigned long rto, turnaround;
+   int i;
+   //The slowest slave known gives the turnaround
+   turnaround = 0;
+   for(i = 1; i <= MODBUS_CAN_MAX_SLAVE; i++)
    {
-         case MODBUS_100KBPS:                          
-                          modbus_broadcast_timeout = ((amount_guess * 9333333) + (900000 * amount_guess * 4)) * 2;
-                          break;
-         case MODBUS_1MBPS:                          
-                          modbus_broadcast_timeout = ((amount_guess * 933333) + (900000 * amount_guess * 4)) * 2;
-                          break;    
+         rto = Modbus_CAN_RTT_Timeout(i);
+         if(rto > turnaround)
+               turnaround = rto;
    }
-   TimerLoadSet(TIMER2_BASE, TIMER_A, modbus_broadcast_timeout);      
-   TimerEnable(TIMER2_BASE, TIMER_A);      
+   if(turnaround)
+   {
+         modbus_broadcast_timeout = turnaround;
+   }
+   else
+   {
+         //No samples of any slave yet
+         switch(modbus_bit_rate)
+         {
+               case MODBUS_100KBPS:                          
+                                modbus_broadcast_timeout = (((amount_guess * 9333333) + (900000 * amount_guess * 4)) * 2) / modbus_tick + 1;
+                                break;
+               case MODBUS_1MBPS:                          
+                                modbus_broadcast_timeout = (((amount_guess * 933333) + (900000 * amount_guess * 4)) * 2) / modbus_tick + 1;
+                                break;    
+         }
+   }
+   Modbus_Timer_Arm(&modbus_broadcast_timer, modbus_broadcast_timeout);
 }
 
-void Modbus_CAN_RemoveTimeout(void)
+void Modbus_CAN_RemoveTimeout(unsigned char transaction)
 {
-   //Disable Unicast Timer
-   modbus_timeout = 0;//DEBUGGGGGGGGGGGGGGGGGGGGGGGGGGGGG
-   TimerDisable(TIMER1_BASE, TIMER_A); 
+   //Disable Unicast Timeout of the transaction
+   Modbus_Timer_Cancel(&modbus_transactions[transaction].timer);
 }
 
 void Modbus_CAN_to_App(void)
 {        
 	//This is used to store the message length and the data
 	int index;                
-        Modbus_App_L_Msg_Set(input_length);        
-        for(index = 0; index < input_length; index++)
+        struct Modbus_CAN_Transaction *t;
+        t = &modbus_transactions[modbus_current];
+        Modbus_App_L_Msg_Set(t->input_length);        
+        for(index = 0; index < t->input_length; index++)
         {
-                Modbus_App_Receive_Char(input_pdu[index], index);
+                Modbus_App_Receive_Char(t->input_pdu[index], index);
         }         
 }
 
@@ -574,12 +1028,12 @@ unsigned char Debug_Transmission(void)
 
 unsigned char Debug_Reception(void)
 {
-  return modbus_complete_reception;
+  return modbus_transactions[modbus_last].complete_reception;
 }
 
 unsigned char * getInput()
 {
-    return input_pdu;
+    return modbus_transactions[modbus_last].input_pdu;
 }
 
 /*unsigned char * getOutput()
@@ -587,31 +1041,12 @@ unsigned char * getInput()
     return output_pdu;
 }*/
 
-unsigned char Debug_Timeout(void)
-{
-    return modbus_timeout;
-}
-
-unsigned char getbu(void)
-{
-    return buu;
-}
-
-void setbu(void)
-{
-      buu = 0;
-}
-
 unsigned char getIndex(void)
 {
-    return modbus_index;
+    return modbus_transactions[modbus_last].index;
 }
 unsigned char getAttempts(void)
 {
-    return modbus_attempts;
-}
-uint16_t getboo(void)
-{
-    return boo;
+    return modbus_transactions[modbus_last].attempts;
 }
 #endif
\ No newline at end of file
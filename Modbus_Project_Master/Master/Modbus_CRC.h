@@ -0,0 +1,34 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+#ifndef __Modbus_CRC_h
+#define __Modbus_CRC_h
+
+//! \addtogroup CRC
+//! @{
+
+#include "stdint.h"
+
+//! Bit by bit, no table
+#define MODBUS_CRC_BITWISE      0
+//! Half a byte at a time, table of 16 entries (32 bytes of flash)
+#define MODBUS_CRC_NIBBLE       1
+//! One byte at a time, table of 256 entries (512 bytes of flash)
+#define MODBUS_CRC_TABLE        2
+//! Four bytes at a time, 4 tables of 256 entries (2 KB of flash)
+#define MODBUS_CRC_SLICE4       3
+//! Eight bytes at a time, 8 tables of 256 entries (4 KB of flash)
+#define MODBUS_CRC_SLICE8       4
+
+//! Variant of the CRC kernel; it can be set from the compiler command line
+#ifndef MODBUS_CRC_VARIANT
+#define MODBUS_CRC_VARIANT      MODBUS_CRC_SLICE4
+#endif
+
+//! Value of the CRC before the first byte
+#define MODBUS_CRC_INIT         0xFFFF
+
+uint16_t Modbus_CRC_Update (uint16_t CRC, const unsigned char *Data, uint16_t Length);
+uint16_t Modbus_CRC (const unsigned char *Data, uint16_t Length);
+uint16_t Modbus_CRC_Byte (uint16_t CRC, unsigned char Byte);
+
+//! @}
+#endif
@@ -9,11 +9,29 @@
 //!
 //! Furthermore, it is included the functions to manipulate such FIFOs: initialization, add item,
 //! remove item, empty/full checking functions and so on.
+//!
+//! Both FIFOs are lock-free rings with one producer and one consumer, so a request
+//! can be added from an interrupt while the main loop removes them, without disabling
+//! interrupts: the item is copied before the head is moved and read before the tail
+//! is moved, with a memory barrier in between.
 //******************************************************************************
 //! @{
 
 #include "Modbus_FIFO.h"
 
+//! Memory barrier, the item has to be written/read before the index is moved
+#if defined(__ICCARM__)
+#include <intrinsics.h>
+#define MODBUS_FIFO_BARRIER()   __DMB()
+#elif defined(__CC_ARM)
+#define MODBUS_FIFO_BARRIER()   __dmb(0xF)
+#elif defined(__arm__)
+#define MODBUS_FIFO_BARRIER()   __asm volatile ("dmb" : : : "memory")
+#else
+// Host build (tools/Modbus_FIFO_Bench.c)
+#define MODBUS_FIFO_BARRIER()   __atomic_thread_fence(__ATOMIC_ACQ_REL)
+#endif
+
 //*****************************************************************************
 //
 // FIFO Module functions
@@ -22,14 +40,13 @@
 
 //! \brief Request FIFO Setup
 //!
-//! Number of Items is set to 0 and the head and tail are set at the beginning
-//!because there are no petitions.
+//! The head and tail are set at the beginning because there are no petitions.
 //!
 //! \param *Modbus_FIFO_Ptr Request FIFO pointer
 //! \sa struct Modbus_FIFO_s
 void Modbus_FIFO_Init (struct Modbus_FIFO_s *Modbus_FIFO_Ptr)
 {
-  Modbus_FIFO_Ptr->Items = Modbus_FIFO_Ptr->Head = Modbus_FIFO_Ptr->Tail = 0;
+  Modbus_FIFO_Ptr->Head = Modbus_FIFO_Ptr->Tail = 0;
 }
 
 //! \brief Check whether the Request FIFO is empty or not
@@ -42,7 +59,7 @@ unsigned char Modbus_FIFO_Empty (struct Modbus_FIFO_s *Modbus_FIFO_Ptr)
 {
   unsigned char Res;
 
-  Res = (Modbus_FIFO_Ptr->Items == 0);
+  Res = (Modbus_FIFO_Ptr->Head == Modbus_FIFO_Ptr->Tail);
   return Res;
 }
 
@@ -56,7 +73,7 @@ static unsigned char Modbus_FIFO_Full (struct Modbus_FIFO_s *Modbus_FIFO_Ptr)
 {
   unsigned char Res;
 
-  Res = (Modbus_FIFO_Ptr->Items >= MAX_ITEMS);
+  Res = ((uint16_t)(Modbus_FIFO_Ptr->Head - Modbus_FIFO_Ptr->Tail) >= MAX_ITEMS);
   return Res;
 }
 
@@ -74,9 +91,9 @@ unsigned char Modbus_FIFO_Enqueue (struct Modbus_FIFO_s *Modbus_FIFO_Ptr, struct
   if (Modbus_FIFO_Full(Modbus_FIFO_Ptr))
     return 1;
 
-  Modbus_FIFO_Ptr->Items++;
-  Modbus_FIFO_Ptr->Buffer[Modbus_FIFO_Ptr->Head] = *Item;
-  Modbus_FIFO_Ptr->Head = (Modbus_FIFO_Ptr->Head + 1) % MAX_ITEMS;
+  Modbus_FIFO_Ptr->Buffer[Modbus_FIFO_Ptr->Head & (MAX_ITEMS - 1)] = *Item;
+  MODBUS_FIFO_BARRIER();
+  Modbus_FIFO_Ptr->Head++;
   return 0;
 }
 
@@ -94,35 +111,88 @@ unsigned char Modbus_FIFO_Dequeue (struct Modbus_FIFO_s *Modbus_FIFO_Ptr, struct
   if (Modbus_FIFO_Empty(Modbus_FIFO_Ptr))
     return 0;  
 	
-  Modbus_FIFO_Ptr->Items--;
-
-  *Item = Modbus_FIFO_Ptr->Buffer[Modbus_FIFO_Ptr->Tail];
-  Modbus_FIFO_Ptr->Tail = (Modbus_FIFO_Ptr->Tail + 1) % MAX_ITEMS;
+  MODBUS_FIFO_BARRIER();
+  *Item = Modbus_FIFO_Ptr->Buffer[Modbus_FIFO_Ptr->Tail & (MAX_ITEMS - 1)];
+  MODBUS_FIFO_BARRIER();
+  Modbus_FIFO_Ptr->Tail++;
   return 1;
 }
 
+//! \brief Look at the first item of the Request FIFO without removing it
+//!
+//! \param *Modbus_FIFO_Ptr Request FIFO pointer
+//! \return Pointer to the next item to be removed, or 0 if the FIFO is empty
+//! \sa struct Modbus_FIFO_s, struct Modbus_FIFO_Item, Modbus_FIFO_Dequeue
+struct Modbus_FIFO_Item *Modbus_FIFO_Peek (struct Modbus_FIFO_s *Modbus_FIFO_Ptr)
+{
+  if (Modbus_FIFO_Empty(Modbus_FIFO_Ptr))
+    return 0;
+
+  MODBUS_FIFO_BARRIER();
+  return &Modbus_FIFO_Ptr->Buffer[Modbus_FIFO_Ptr->Tail & (MAX_ITEMS - 1)];
+}
+
+//! \brief Look at any item of the Request FIFO without removing it
+//!
+//! \param *Modbus_FIFO_Ptr Request FIFO pointer
+//! \param Index Position of the item, 0 is the next item to be removed
+//! \return Pointer to the item, or 0 if the FIFO has not so many items
+//! \sa Modbus_FIFO_Peek, Modbus_FIFO_Move_First
+struct Modbus_FIFO_Item *Modbus_FIFO_Peek_At (struct Modbus_FIFO_s *Modbus_FIFO_Ptr,
+                                              uint16_t Index)
+{
+  if ((uint16_t)(Modbus_FIFO_Ptr->Head - Modbus_FIFO_Ptr->Tail) <= Index)
+    return 0;
+
+  MODBUS_FIFO_BARRIER();
+  return &Modbus_FIFO_Ptr->Buffer[(uint16_t)(Modbus_FIFO_Ptr->Tail + Index) & (MAX_ITEMS - 1)];
+}
+
+//! \brief Move an item to the head of the Request FIFO
+//!
+//! The items before it are moved one place back, so they keep their order.
+//! Only the consumer can call it: the producer never writes the items already
+//! added.
+//! \param *Modbus_FIFO_Ptr Request FIFO pointer
+//! \param Index Position of the item, it must be in the FIFO
+//! \sa Modbus_FIFO_Peek_At
+void Modbus_FIFO_Move_First (struct Modbus_FIFO_s *Modbus_FIFO_Ptr, uint16_t Index)
+{
+  struct Modbus_FIFO_Item Item;
+  uint16_t Slot = Modbus_FIFO_Ptr->Tail + Index;
+
+  MODBUS_FIFO_BARRIER();
+  Item = Modbus_FIFO_Ptr->Buffer[Slot & (MAX_ITEMS - 1)];
+  while (Slot != Modbus_FIFO_Ptr->Tail)
+  {
+    Modbus_FIFO_Ptr->Buffer[Slot & (MAX_ITEMS - 1)] =
+      Modbus_FIFO_Ptr->Buffer[(uint16_t)(Slot - 1) & (MAX_ITEMS - 1)];
+    Slot--;
+  }
+  Modbus_FIFO_Ptr->Buffer[Slot & (MAX_ITEMS - 1)] = Item;
+}
+
 //! \brief Error FIFO Setup
 //!
-//! Number of items is set to 0 and the head and tail are set at the beginning
-//! because there are not errors.
+//! The head and tail are set at the beginning because there are not errors.
 //! \param *Modbus_FIFO_Ptr Error FIFO pointer
 //! \sa struct Modbus_FIFO_Errors
 void Modbus_FIFO_E_Init (struct Modbus_FIFO_Errors *Modbus_FIFO_Ptr)
 {
-  Modbus_FIFO_Ptr->Items = Modbus_FIFO_Ptr->Head = Modbus_FIFO_Ptr->Tail = 0;
+  Modbus_FIFO_Ptr->Head = Modbus_FIFO_Ptr->Tail = 0;
 }
 
 //! \brief Check whether the Error FIFO is empty or not.
 //!
 //! \param *Modbus_FIFO_Ptr Error FIFO pointer
-//! \return 0 The FIFO is not emptyLa Cola no está vacía
+//! \return 0 The FIFO is not empty
 //! \return 1 The FIFO is empty
 //! \sa struct Modbus_FIFO_Errors
 static unsigned char Modbus_FIFO_E_Empty (struct Modbus_FIFO_Errors *Modbus_FIFO_Ptr)
 {
   unsigned char Res;
   
-  Res = (Modbus_FIFO_Ptr->Items == 0);
+  Res = (Modbus_FIFO_Ptr->Head == Modbus_FIFO_Ptr->Tail);
   return Res;
 }
 
@@ -136,7 +206,7 @@ static unsigned char Modbus_FIFO_E_Full (struct Modbus_FIFO_Errors *Modbus_FIFO_
 {
   unsigned char Res;
 
-  Res = (Modbus_FIFO_Ptr->Items >= MAX_ITEMS);
+  Res = ((uint16_t)(Modbus_FIFO_Ptr->Head - Modbus_FIFO_Ptr->Tail) >= MAX_E_ITEMS);
   return Res;
 }
 
@@ -155,9 +225,9 @@ unsigned char Modbus_FIFO_E_Enqueue (struct Modbus_FIFO_Errors *Modbus_FIFO_Ptr,
   if (Modbus_FIFO_E_Full(Modbus_FIFO_Ptr))
     return 1;
 
-  Modbus_FIFO_Ptr->Items++;
-  Modbus_FIFO_Ptr->Buffer[Modbus_FIFO_Ptr->Head] = *Error;
-  Modbus_FIFO_Ptr->Head = (Modbus_FIFO_Ptr->Head + 1) % MAX_ITEMS;
+  Modbus_FIFO_Ptr->Buffer[Modbus_FIFO_Ptr->Head & (MAX_E_ITEMS - 1)] = *Error;
+  MODBUS_FIFO_BARRIER();
+  Modbus_FIFO_Ptr->Head++;
   return 0;
 }
 
@@ -177,10 +247,10 @@ unsigned char Modbus_FIFO_E_Dequeue (struct Modbus_FIFO_Errors *Modbus_FIFO_Ptr,
   if (Modbus_FIFO_E_Empty(Modbus_FIFO_Ptr))
     return 0;  
 	
-  Modbus_FIFO_Ptr->Items--;
-
-  *Error = Modbus_FIFO_Ptr->Buffer[Modbus_FIFO_Ptr->Tail];
-  Modbus_FIFO_Ptr->Tail = (Modbus_FIFO_Ptr->Tail + 1) % MAX_ITEMS;
+  MODBUS_FIFO_BARRIER();
+  *Error = Modbus_FIFO_Ptr->Buffer[Modbus_FIFO_Ptr->Tail & (MAX_E_ITEMS - 1)];
+  MODBUS_FIFO_BARRIER();
+  Modbus_FIFO_Ptr->Tail++;
   return 1;
 }
 //! @}
\ No newline at end of file
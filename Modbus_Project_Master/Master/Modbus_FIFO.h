@@ -7,10 +7,10 @@
 
 #include "stdint.h"
 
-//! Maximum number of items at the Request FIFO
-#define MAX_ITEMS       255
-//! Maximum number of items at the Error FIFO
-#define MAX_E_ITEMS     25
+//! Maximum number of items at each Request FIFO (one per priority), it must be a power of two
+#define MAX_ITEMS       64
+//! Maximum number of items at the Error FIFO, it must be a power of two
+#define MAX_E_ITEMS     32
 //! A request can be the next different types
 union Modbus_FIFO_Par
 {
@@ -18,15 +18,36 @@ union Modbus_FIFO_Par
   uint16_t UI2;        //!< 2 unsigned bytes
   unsigned char *PC;   //!< Pointer to link 1 unsigned byte elements
   uint16_t *PUI2;      //!< Pointer to link 2 unsigned bytes elements
+  uint32_t *PUI4;      //!< Pointer to link 4 unsigned bytes elements, the packed bitmaps
    
 };
 
+//! How a request finished, given to its completion callback
+enum Modbus_Status
+{
+  MODBUS_STATUS_OK,         //!< Correct answer, read data is already in the Response vector
+  MODBUS_STATUS_EXCEPTION,  //!< Exception answer, its code is given too
+  MODBUS_STATUS_TIMEOUT,    //!< No answer after the maximum number of attempts
+  MODBUS_STATUS_CRC,        //!< The answer to the last attempt had a wrong CRC
+  MODBUS_STATUS_EXPIRED,    //!< Its deadline expired before it could be sent, it was dropped
+  MODBUS_STATUS_DOWN        //!< Its slave is down, it was dropped without being sent
+};
+
+struct Modbus_Retry_Policy;
+
 //! Request FIFO item struct
 struct Modbus_FIFO_Item
 {
   unsigned char Slave;              //!< The slave which will receive the request
   unsigned char Function;           //!< Modbus public function code
   union Modbus_FIFO_Par Data[6];    //!< Request data
+  uint16_t Handle;                  //!< Request identification given to the user, never 0
+  unsigned char Priority;           //!< Request FIFO where it waits, 0 is the highest priority
+  uint32_t Deadline;                //!< Tick of the Timer Wheel when it expires, 0 if it never expires
+  uint32_t Queued;                  //!< Tick of the Timer Wheel when it was requested
+  const struct Modbus_Retry_Policy *Retry; //!< Its retry policy, 0 to use the one of its function
+  //! Completion callback (0 if none): handle, status and exception code (0 if it is not an exception)
+  void (*CallBack)(uint16_t Handle, enum Modbus_Status Status, unsigned char Exception);
 };
 
 //! Communication Error FIFO item struct
@@ -36,21 +57,24 @@ struct Modbus_FIFO_E_Item
   unsigned char Response[2];       //!< Exception message (0 means no answer)
 };
 
-//! Request FIFO
+//! \brief Request FIFO
+//!
+//! Single producer/single consumer ring: only the producer writes _Head_ and
+//! only the consumer writes _Tail_. Both run freely and wrap around at 2^16;
+//! the number of items is their difference and the slot is the index masked
+//! with MAX_ITEMS - 1.
 struct Modbus_FIFO_s
 {
-  unsigned char Items;                        //!< Number of items in the FIFO
-  unsigned char Head;                         //!< Head index
-  unsigned char  Tail;                        //!< Tail index
+  volatile uint16_t Head;                     //!< Items added since the setup
+  volatile uint16_t Tail;                     //!< Items removed since the setup
   struct Modbus_FIFO_Item Buffer[MAX_ITEMS];  //!< Request petitions list
 };
 
-//! Error FIFO
+//! Error FIFO, a single producer/single consumer ring as the Request FIFO
 struct Modbus_FIFO_Errors
 {
-  unsigned char Items;                           //!< Number of items in the FIFO
-  unsigned char Head;                            //!< Head index
-  unsigned char  Tail;                           //!< Tail index
+  volatile uint16_t Head;                        //!< Items added since the setup
+  volatile uint16_t Tail;                        //!< Items removed since the setup
   struct Modbus_FIFO_E_Item Buffer[MAX_E_ITEMS]; //!< Error messages list
 };
 //! @}
@@ -62,6 +86,10 @@ unsigned char Modbus_FIFO_Enqueue (struct Modbus_FIFO_s *Modbus_FIFO_Ptr,
                                    struct Modbus_FIFO_Item *Item);
 unsigned char Modbus_FIFO_Dequeue (struct Modbus_FIFO_s *Modbus_FIFO_Ptr, 
                                    struct Modbus_FIFO_Item *Item);
+struct Modbus_FIFO_Item *Modbus_FIFO_Peek (struct Modbus_FIFO_s *Modbus_FIFO_Ptr);
+struct Modbus_FIFO_Item *Modbus_FIFO_Peek_At (struct Modbus_FIFO_s *Modbus_FIFO_Ptr,
+                                              uint16_t Index);
+void Modbus_FIFO_Move_First (struct Modbus_FIFO_s *Modbus_FIFO_Ptr, uint16_t Index);
 
 void Modbus_FIFO_E_Init (struct Modbus_FIFO_Errors *Modbus_FIFO_Ptr);
 unsigned char Modbus_FIFO_E_Enqueue (struct Modbus_FIFO_Errors *Modbus_FIFO_Ptr, 
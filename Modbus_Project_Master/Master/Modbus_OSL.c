@@ -32,10 +32,12 @@
 #include "driverlib/gpio.h"
 #include "driverlib/interrupt.h"
 #include "driverlib/uart.h"
-#include "driverlib/timer.h"
 #include "Modbus_App.h"
 #include "Modbus_OSL.h"                   
 #include "Modbus_OSL_RTU.h"
+#include "Modbus_Timer.h"
+#include "Modbus_Trace.h"
+#include "Modbus_Stats.h"
 
 //*****************************************************************************
 //
@@ -58,11 +60,37 @@
 //! \brief Baudrate de las comunicaciones Serie. Su valor debe corresponder con 
 //! uno de los contenidos en _enum_ _Baud_. Por defecto es 19200 bps.
 static uint32_t Modbus_OSL_Baudrate;
-//! \brief Nº de cuentas para establecer un timer que desborde en un tiempo   
-//! suficiente como para que se procese la petición y se reciba la respuesta.
+//! \brief Nº de ticks de la rueda de timers de un tiempo suficiente como
+//! para que se procese la petición y se reciba la respuesta.
+//! Se usa mientras no se conoce el tiempo de respuesta del Slave y como máximo
+//! del Timeout de Respuesta calculado.
 static uint32_t Modbus_OSL_Timeout_R;
-//! \brief Nº de cuentas para establecer un timer que desborde en un tiempo   
-//! suficiente como para que se procese la petición. Para Mensajes BroadCast.
+//! Tick de la rueda de timers en que se armó el Timeout de Respuesta.
+static uint32_t Modbus_OSL_Sent;
+//! \brief Nº de ticks desde el fin del envío de la petición hasta la llegada
+//! del primer carácter de la respuesta; 0 si aún no ha llegado.
+static volatile uint32_t Modbus_OSL_First_Char;
+//! Flag de respuesta al envío actual descartada por CRC.
+static unsigned char Modbus_OSL_CRC_Failed;
+#if MODBUS_STATS
+//! Instante (us) en que empezó el envío actual, para las estadísticas.
+static uint32_t Modbus_OSL_Stamp;
+//! Microsegundos desde el inicio del envío hasta la respuesta completa.
+static volatile uint32_t Modbus_OSL_RTT;
+#endif
+//! Timer de la rueda para los Timeouts de Respuesta y de BroadCast.
+static struct Modbus_Timer Modbus_OSL_Timer;
+//! \brief Estimación del tiempo de respuesta de un Slave, en ticks, como en
+//! TCP (Jacobson/Karels): media suavizada y desviación media.
+struct Modbus_OSL_Turnaround
+{
+  uint32_t SRTT;    //!< Media suavizada * 8; 0 si aún no hay muestras
+  uint32_t RTTVAR;  //!< Desviación media * 4
+};
+//! Tiempo de respuesta aprendido de cada Slave.
+static struct Modbus_OSL_Turnaround Modbus_OSL_Turnaround[MODBUS_OSL_MAX_SLAVE+1];
+//! \brief Nº de ticks de la rueda de timers de un tiempo suficiente como
+//! para que se procese la petición. Para Mensajes BroadCast.
 static uint32_t Modbus_OSL_Timeout_B;
 //! Modo de las comunicaciones Serie, RTU o ASCII. Por defecto RTU. 
 static enum Modbus_OSL_Modes Modbus_OSL_Mode;
@@ -80,12 +108,29 @@ static unsigned char Modbus_OSL_Attempt;
 //! \brief Nº Máximo de envíos para un mensaje, si se alcanza y se sigue sin 
 //! recibir una respuesta, se descarta el mensaje y se pasa a los siguientes.
 static unsigned char Modbus_OSL_Max_Attempts;
+//! Petición que espera su reenvío mientras se atienden otros Slaves.
+struct Modbus_OSL_Backoff
+{
+  unsigned char Used;                 //!< 1 si la petición espera su reenvío
+  volatile unsigned char Ready;       //!< 1 cuando ha vencido la espera
+  unsigned char Attempt;              //!< Nº del envío que se hará
+  struct Modbus_Timer Timer;          //!< Timer de la espera
+  struct Modbus_FIFO_Item Request;    //!< Petición
+};
+//! Peticiones en espera de reenvío.
+static struct Modbus_OSL_Backoff Modbus_OSL_Backoffs[MODBUS_OSL_BACKOFF_SLOTS];
 //! Variable que almacena el Nº de Slave del que se espera la respuesta.
 static unsigned char Modbus_OSL_Expected_Slave;
 //! Vector para almacenar los mensajes de Salida del Master.
 static unsigned char Modbus_OSL_Req_ADU[256];
 //! Longitud del mensaje de Salida del Master.
 static unsigned char Modbus_OSL_L_Req_ADU;
+//! Índice del siguiente carácter del mensaje de Salida a entregar a la UART.
+static volatile unsigned char Modbus_OSL_Tx_Index;
+//! Longitud del PDU de la respuesta esperada, para armar el Timeout al acabar el envío.
+static uint16_t Modbus_OSL_Tx_L_Rsp;
+//! Timer de la rueda que espera a que la UART acabe de sacar el último carácter.
+static struct Modbus_Timer Modbus_OSL_Tx_Timer;
 
 // Para los distintos estados de los diagramas de Master y RTU.
 
@@ -103,13 +148,20 @@ static volatile enum Modbus_OSL_States Modbus_OSL_State;
 
 static void Modbus_OSL_Set_Timeout_B (uint32_t Baudrate);
 static void Modbus_OSL_Set_Timeout_R (uint32_t Baudrate);
-static void Modbus_OSL_Response_Timeout(void);
+static void Modbus_OSL_Response_Timeout(uint16_t L_rsp_pdu);
+static void Modbus_OSL_Turnaround_Update(void);
 static void Modbus_OSL_BroadCast_Timeout(void);
+static void Modbus_OSL_Timer_Expired(void *Arg);
+static void Modbus_OSL_Backoff_Expired(void *Arg);
+static unsigned char Modbus_OSL_Backoff_Resend(void);
 void Modbus_OSL_Repeat_Request (void);
 unsigned char Modbus_OSL_Resend(void);
 static unsigned char Modbus_OSL_Processing_Msg(void);
 static void Modbus_OSL_RTU_to_App (void);
 static void Modbus_OSL_Send (unsigned char *mb_req_pdu, unsigned char L_pdu);
+static void Modbus_OSL_Tx_Next (void);
+static void Modbus_OSL_Tx_Check (void *Arg);
+static void Modbus_OSL_Tx_Done (void);
 
 //*****************************************************************************
 //! \defgroup OSL_Var Gestión de Variables 
@@ -217,11 +269,11 @@ void Modbus_OSL_MainState_Set (enum Modbus_OSL_MainStates State)
 //*****************************************************************************
 //! @{
 
-//! \brief Establece el Nº de cuentas para el Timeout de Respuesta.
+//! \brief Establece el Nº de ticks para el Timeout de Respuesta.
 //!
 //! En función del Baudrate de las comunicaciones Serie almacena en 
-//! _Modbus_OSL_Timeout_R_ el Nº de cuentas necesario para establecer un tiempo
-//! de desborde en un timer considerado suficiente para que un Slave reciba y
+//! _Modbus_OSL_Timeout_R_ el Nº de ticks de la rueda de timers de un tiempo
+//! considerado suficiente para que un Slave reciba y
 //! procese una petición y se reciba la respuesta. Por ejemplo: 1s a 9600bps.
 //! \param Baudrate Baudrate de las comunicaciones Serie
 //! \sa Modbus_OSL_Timeout_R, Modbus_OSL_Response_Timeout, Modbus_OSL_Timeouts
@@ -231,32 +283,32 @@ void Modbus_OSL_Set_Timeout_R (uint32_t Baudrate)
   { 
     // 4 segundos. 
     case (1200):
-      Modbus_OSL_Timeout_R=SysCtlClockGet()*4;
+      Modbus_OSL_Timeout_R=MODBUS_TIMER_TICK_HZ*4;
       break;
     // 3 segundos.
     case (2400):
-      Modbus_OSL_Timeout_R=SysCtlClockGet()*3;
+      Modbus_OSL_Timeout_R=MODBUS_TIMER_TICK_HZ*3;
       break;
     // 2 segundos.
     case (4800):
-      Modbus_OSL_Timeout_R=SysCtlClockGet()*2;
+      Modbus_OSL_Timeout_R=MODBUS_TIMER_TICK_HZ*2;
       break;
     // 1 segundo.
     case (9600):
-      Modbus_OSL_Timeout_R=SysCtlClockGet();
+      Modbus_OSL_Timeout_R=MODBUS_TIMER_TICK_HZ;
       break;
     // 0,5 segundos.  
     default:
-      Modbus_OSL_Timeout_R=SysCtlClockGet()/2;
+      Modbus_OSL_Timeout_R=MODBUS_TIMER_TICK_HZ/2;
       break;    
   }
 }
 
-//! \brief Establece el Nº de cuentas para el Timeout de BroadCast.
+//! \brief Establece el Nº de ticks para el Timeout de BroadCast.
 //!
 //! En función del Baudrate de las comunicaciones Serie almacena en 
-//! _Modbus_OSL_Timeout_B_ el Nº de cuentas necesario para establecer un tiempo
-//! de desborde en un timer considerado suficiente para que los Slaves reciban 
+//! _Modbus_OSL_Timeout_B_ el Nº de ticks de la rueda de timers de un tiempo
+//! considerado suficiente para que los Slaves reciban 
 //! y procesen una petición BroadCast. Por ejemplo: 400ms a 9600bps.
 //! \param Baudrate Baudrate de las comunicaciones Serie
 //! \sa Modbus_OSL_Timeout_B, Modbus_OSL_BroadCast_Timeout, Modbus_OSL_Timeouts
@@ -266,56 +318,122 @@ void Modbus_OSL_Set_Timeout_B(uint32_t Baudrate)
   {
     // 2,5 segundos.
     case (1200):
-      Modbus_OSL_Timeout_B=SysCtlClockGet()*5/2;
+      Modbus_OSL_Timeout_B=MODBUS_TIMER_TICK_HZ*5/2;
       break;
     // 1,5 segundos.
     case (2400):
-      Modbus_OSL_Timeout_B=SysCtlClockGet()*3/2;
+      Modbus_OSL_Timeout_B=MODBUS_TIMER_TICK_HZ*3/2;
       break;
     // 800 ms.  
     case (4800):
-      Modbus_OSL_Timeout_B=SysCtlClockGet()*4/5;
+      Modbus_OSL_Timeout_B=MODBUS_TIMER_TICK_HZ*4/5;
       break;
     // 400 ms.
     case (9600):
-      Modbus_OSL_Timeout_B=SysCtlClockGet()*2/5;
+      Modbus_OSL_Timeout_B=MODBUS_TIMER_TICK_HZ*2/5;
       break;
     // 200 ms.  
     default:
-      Modbus_OSL_Timeout_B=SysCtlClockGet()/5;
+      Modbus_OSL_Timeout_B=MODBUS_TIMER_TICK_HZ/5;
       break;    
   }
 }
 
-//! \brief Carga el Timer 2 para el Timeout de BroadCast y lo arranca.
+//! \brief Arma el timer para el Timeout de BroadCast.
 //! 
-//! Carga _Modbus_OSL_Timeout_B_ en el numero de cuentas del timer 2 y lo 
-//! arranca, pasando al estado DELAY, de este modo, el sistema espera hasta
+//! Arma el timer de la rueda con _Modbus_OSL_Timeout_B_, pasando al estado DELAY, de este modo, el sistema espera hasta
 //! que salte el Timeout de Broadcast antes de volver a IDLE y seguir mandando
 //! peticiones. Esta función se activa al enviar una petición en modo BroadCast.
 //! \sa Modbus_OSL_Timeout_B, Modbus_OSL_Timeouts, Modbus_OSL_Output
 void Modbus_OSL_BroadCast_Timeout(void)
 {
-   TimerLoadSet(TIMER2_BASE, TIMER_A, Modbus_OSL_Timeout_B);      
-   TimerEnable(TIMER2_BASE, TIMER_A);
+   Modbus_Timer_Arm(&Modbus_OSL_Timer, Modbus_OSL_Timeout_B);
    Modbus_OSL_MainState=MODBUS_OSL_DELAY;
 }
 
-//! \brief Carga el Timer 2 para el Timeout de Respuesta y lo arranca.
+//! \brief Arma el timer para el Timeout de Respuesta.
 //! 
-//! Carga _Modbus_OSL_Timeout_R_ en el numero de cuentas del timer 2 y lo 
-//! arranca, pasando al estado WAITREPLY, de este modo, el sistema no espera 
-//! indefinidamente una respuesta y si no la recibe y salta el Timeout de 
-//! Respuesta, reenvía la petición hasta el Nº Máximo de envíos. Esta función 
-//! se activa al enviar una petición en modo Unicast.
+//! Calcula el numero de ticks del Timeout de Respuesta para la petición
+//! actual y arma con él el timer de la rueda, pasando al estado WAITREPLY,
+//! de este modo, el sistema no espera indefinidamente una respuesta y si no la
+//! recibe y salta el Timeout de Respuesta, reenvía la petición hasta el Nº
+//! Máximo de envíos. Esta función se activa al enviar una petición en modo
+//! Unicast.
+//!
+//! Si ya se conoce el tiempo de respuesta del Slave, el Timeout es dicho
+//! tiempo (media suavizada más cuatro veces la desviación media) más el tiempo
+//! de transmisión del resto de la respuesta esperada y 3,5T, doblado en cada
+//! reenvío y limitado entre _MODBUS_OSL_TIMEOUT_MIN_MS_ y _Modbus_OSL_Timeout_R_.
+//! Si no, se usa _Modbus_OSL_Timeout_R_.
+//! \param L_rsp_pdu Longitud del PDU de la respuesta esperada
 //! \sa Modbus_OSL_Timeout_R, Modbus_OSL_Timeouts, Modbus_OSL_Output
-void Modbus_OSL_Response_Timeout(void)
+//! \sa Modbus_OSL_Turnaround_Update
+void Modbus_OSL_Response_Timeout(uint16_t L_rsp_pdu)
 {
-   TimerLoadSet(TIMER2_BASE, TIMER_A, Modbus_OSL_Timeout_R);      
-   TimerEnable(TIMER2_BASE, TIMER_A);
+   uint32_t Timeout, Minimum;
+   struct Modbus_OSL_Turnaround *Turnaround;
+   unsigned char i;
+
+   Timeout=Modbus_OSL_Timeout_R;
+   if(Modbus_OSL_Expected_Slave<=MODBUS_OSL_MAX_SLAVE &&
+      Modbus_OSL_Turnaround[Modbus_OSL_Expected_Slave].SRTT)
+   {
+     Turnaround=&Modbus_OSL_Turnaround[Modbus_OSL_Expected_Slave];
+     // Hasta el primer carácter, más el resto del ADU (Slave + PDU + CRC) y 3,5T.
+     Timeout=(Turnaround->SRTT>>3) + Turnaround->RTTVAR
+             + ((L_rsp_pdu+2)*MODBUS_OSL_RTU_BITS_CHAR*MODBUS_TIMER_TICK_HZ)/Modbus_OSL_Baudrate + 1
+             + Modbus_OSL_RTU_Get_Timeout_35();
+     // Se dobla en cada reenvío mientras no pase del máximo, así no desborda
+     // aunque la política de reintentos permita muchos envíos.
+     for(i=1; i<Modbus_OSL_Attempt && Timeout<Modbus_OSL_Timeout_R; i++)
+       Timeout<<=1;
+     Minimum=MODBUS_TIMER_TICK_HZ/1000*MODBUS_OSL_TIMEOUT_MIN_MS;
+     if(Timeout<Minimum)
+       Timeout=Minimum;
+     if(Timeout>Modbus_OSL_Timeout_R)
+       Timeout=Modbus_OSL_Timeout_R;
+   }
+   Modbus_OSL_Sent=Modbus_Timer_Now();
+   Modbus_OSL_First_Char=0;
+   Modbus_OSL_CRC_Failed=0;
+   Modbus_Timer_Arm(&Modbus_OSL_Timer, Timeout);
    Modbus_OSL_MainState=MODBUS_OSL_WAITREPLY;
 }
 
+//! \brief Añade una muestra del tiempo de respuesta del Slave esperado.
+//! 
+//! Se llama al aceptar una respuesta correcta. La muestra es el tiempo desde
+//! el fin del envío de la petición hasta el primer carácter de la respuesta y
+//! actualiza la media suavizada y la desviación media del Slave. Las respuestas
+//! a reenvíos no se tienen en cuenta (regla de Karn), puesto que no se sabe a
+//! qué envío responden.
+//! \sa Modbus_OSL_Turnaround, Modbus_OSL_Response_Timeout
+static void Modbus_OSL_Turnaround_Update(void)
+{
+   int32_t Delta;
+   uint32_t Sample;
+   struct Modbus_OSL_Turnaround *Turnaround;
+
+   Sample=Modbus_OSL_First_Char;
+   if(Modbus_OSL_Attempt!=1 || !Sample || Modbus_OSL_Expected_Slave>MODBUS_OSL_MAX_SLAVE)
+     return;
+   Turnaround=&Modbus_OSL_Turnaround[Modbus_OSL_Expected_Slave];
+   if(!Turnaround->SRTT)
+   {
+     // Primera muestra: media = muestra, desviación = muestra/2.
+     Turnaround->SRTT=Sample<<3;
+     Turnaround->RTTVAR=Sample<<1;
+     return;
+   }
+   // media += (muestra-media)/8; desviación += (|muestra-media|-desviación)/4
+   Delta=(int32_t)Sample-(int32_t)(Turnaround->SRTT>>3);
+   Turnaround->SRTT+=Delta;
+   if(Delta<0)
+     Delta=-Delta;
+   Delta-=(int32_t)(Turnaround->RTTVAR>>2);
+   Turnaround->RTTVAR+=Delta;
+}
+
 //! \brief Función para la interrupción de Timeout de BroadCast/Respuesta.
 //! 
 //! En función del Estado del Master realiza las acciones del Timeout adecuado. 
@@ -340,6 +458,20 @@ void Modbus_OSL_Timeouts(void)
   }
 }
 
+//! \brief Adapta la llamada de la rueda de timers a _Modbus_OSL_Timeouts_.
+//! \param *Arg No se usa
+static void Modbus_OSL_Timer_Expired(void *Arg)
+{
+  Modbus_OSL_Timeouts();
+}
+
+//! \brief Marca como lista para reenviar una petición en espera.
+//! \param *Arg Petición en espera, struct Modbus_OSL_Backoff
+static void Modbus_OSL_Backoff_Expired(void *Arg)
+{
+  ((struct Modbus_OSL_Backoff *)Arg)->Ready=1;
+}
+
 //! \brief Configura las comunicaciones Serie.
 //!
 //! Establece el Nº de Envíos de un Mensaje que no reciba una respuesta
@@ -348,11 +480,11 @@ void Modbus_OSL_Timeouts(void)
 //! los flags de Reenvío, Sin Respuesta, Mensaje entrante y corrección de trama  
 //! a sus valores iniciales. Configura la UART1 según modo RTU/ASCII para cumplir   
 //! sus especificaciones y configura el LED1 para encenderlo al transmitir y
-//! recibir datos. Configura el _Timer_ _2_ para crear una interrupción que se
-//! usa como Timeout para Reenviar un Mensaje o para esperar que se procesen
-//! las peticiones Broadcast antes de enviar nuevos mensajes (puesto que sólo se
-//! puede enviar un mensaje por vez se usa el mismo Timer para ambos casos pero 
-//! con distinto numero de cuentas), que además depende del Baudrate. Finalmente 
+//! recibir datos. Arranca la rueda de timers y prepara un timer que se usa
+//! como Timeout para Reenviar un Mensaje o para esperar que se procesen las
+//! peticiones Broadcast antes de enviar nuevos mensajes (puesto que sólo se
+//! puede enviar un mensaje por vez se usa el mismo timer para ambos casos pero 
+//! con distinto numero de ticks), que además depende del Baudrate. Finalmente 
 //! llama a la función de configuración e inicio del modo de comunicación RTU/ASCII.
 //! \param Baudrate Baudrate con que iniciar las comunicaciones
 //! \param Mode Modo de comunicación en Serie, RTU (por defecto) o ASCII
@@ -360,6 +492,8 @@ void Modbus_OSL_Timeouts(void)
 //! \sa enum Baud, enum Modbus_OSL_Modes, Modbus_OSL_RTU_Init
 void Modbus_OSL_Init (enum Baud Baudrate, enum Modbus_OSL_Modes Mode,unsigned char Attempts)
 {
+    uint16_t i;
+
     Modbus_OSL_Processing_Flag=0;
     Modbus_OSL_Forward_Flag=0;
     Modbus_OSL_Max_Attempts=Attempts;
@@ -388,9 +522,6 @@ void Modbus_OSL_Init (enum Baud Baudrate, enum Modbus_OSL_Modes Mode,unsigned ch
     SysCtlPeripheralEnable(SYSCTL_PERIPH_UART1);
     SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOD);
     
-    // Habilita el Timer 2
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER2);
-    
     // Habilita las interrupciones del sistema.
     IntMasterEnable();
     
@@ -425,20 +556,30 @@ void Modbus_OSL_Init (enum Baud Baudrate, enum Modbus_OSL_Modes Mode,unsigned ch
     GPIO_PORTF_DIR_R = 0x01;
     GPIO_PORTF_DEN_R = 0x01;
     
-    // Configura el Timer 2 como de 32-bits y Establece las cuentas de los
-    // Timeouts de Respuesta y de BroadCast.
-    TimerConfigure(TIMER2_BASE, TIMER_CFG_ONE_SHOT);
+    // Arranca la rueda de timers y Establece los ticks de los Timeouts de
+    // Respuesta y de BroadCast.
+    Modbus_Timer_Init();
+    Modbus_Timer_Setup(&Modbus_OSL_Timer, Modbus_OSL_Timer_Expired, 0);
+    Modbus_Timer_Setup(&Modbus_OSL_Tx_Timer, Modbus_OSL_Tx_Check, 0);
+    for(i=0;i<MODBUS_OSL_BACKOFF_SLOTS;i++)
+    {
+      Modbus_OSL_Backoffs[i].Used=0;
+      Modbus_Timer_Setup(&Modbus_OSL_Backoffs[i].Timer, Modbus_OSL_Backoff_Expired,
+                         &Modbus_OSL_Backoffs[i]);
+    }
     Modbus_OSL_Set_Timeout_B (Modbus_OSL_Baudrate);
     Modbus_OSL_Set_Timeout_R (Modbus_OSL_Baudrate);
+    for(i=0;i<=MODBUS_OSL_MAX_SLAVE;i++)
+    {
+      Modbus_OSL_Turnaround[i].SRTT=0;
+      Modbus_OSL_Turnaround[i].RTTVAR=0;
+    }
     
     // Habilita la interrupción de la UART, para Recepción y error de paridad.
+    // La de Transmisión se habilita sólo mientras se envía un mensaje.
     UARTIntEnable(UART1_BASE, UART_INT_RX | UART_INT_PE);
     IntEnable(INT_UART1);
     
-    // Activa la Interrupción por desborde del Timer 2.
-    IntEnable(INT_TIMER2A);
-    TimerIntEnable(TIMER2_BASE, TIMER_TIMA_TIMEOUT);
-    
     switch(Modbus_OSL_Mode)
     {
       case MODBUS_OSL_MODE_RTU:
@@ -451,9 +592,11 @@ void Modbus_OSL_Init (enum Baud Baudrate, enum Modbus_OSL_Modes Mode,unsigned ch
 
 //! \brief Interrupción por Recepción de Carácter.
 //! 
-//! Esta función se activa con la interrupción de la UART1. Enciende el LED1 
-//! para indicar que se esta produciendo la comunicación, limpia el status de
-//! la interrupción y se asegura de que se esté en estado de esperar respuesta. 
+//! Esta función se activa con la interrupción de la UART1. Limpia el status
+//! de la interrupción y, si la UART puede aceptar otro carácter del mensaje
+//! de salida, se lo entrega mediante _Modbus_OSL_Tx_Next_. Para la recepción
+//! enciende el LED1 para indicar que se esta produciendo la comunicación
+//! y se asegura de que se esté en estado de esperar respuesta. 
 //! Si es así comprueba si es de error de paridad para marcar la trama como NOK;
 //! en caso contrario llama a la función de interrupción RTU/ASCII que 
 //! corresponda según el modo de comunicación Serie.
@@ -462,16 +605,26 @@ void Modbus_OSL_Init (enum Baud Baudrate, enum Modbus_OSL_Modes Mode,unsigned ch
 //! interrupción de Respuesta mientras se está recibiendo un mensaje para acabar
 //! de recibirlo. Como el estado es ERROR el mensaje será descartado igualmente.
 //! \sa Modbus_OSL_Frame_Set, Modbus_OSL_Mode, Modbus_OSL_RTU_UART
+//! \sa Modbus_OSL_Tx_Next
 void UART1IntHandler(void)
 {
     unsigned long ulStatus;
     
-    // Enciende el Led1.
-    GPIO_PORTF_DATA_R |= 0x01;        
-    
     // Obtiene el estado de la interrupción y lo borra.
     ulStatus = UARTIntStatus(UART1_BASE, true);
     UARTIntClear(UART1_BASE, ulStatus);
+    
+    // Hueco en la UART para el siguiente carácter del mensaje de salida.
+    if(ulStatus & UART_INT_TX)
+    {
+      Modbus_OSL_Tx_Next();
+      ulStatus &= ~UART_INT_TX;
+      if(!ulStatus)
+        return;
+    }
+    
+    // Enciende el Led1.
+    GPIO_PORTF_DATA_R |= 0x01;        
    
     // Si el estado no es WAITREPLY o ERROR descarta el caracter.
     if(Modbus_OSL_MainState_Get()==MODBUS_OSL_WAITREPLY 
@@ -486,6 +639,16 @@ void UART1IntHandler(void)
       else
       {
         //Debug_OSL_IncChar++;
+        // Primer carácter de la respuesta: se guarda el tiempo de respuesta.
+        if(Modbus_OSL_MainState_Get()==MODBUS_OSL_WAITREPLY && !Modbus_OSL_First_Char)
+        {
+          // Al menos un tick, puesto que 0 indica que aún no ha llegado.
+          Modbus_OSL_First_Char=Modbus_Timer_Now()-Modbus_OSL_Sent;
+          if(!Modbus_OSL_First_Char)
+            Modbus_OSL_First_Char=1;
+          MODBUS_TRACE_EVENT(MODBUS_TRACE_RX_FIRST,Modbus_OSL_Expected_Slave,Modbus_OSL_Req_ADU[1],
+                             Modbus_App_Actual_Handle(),Modbus_OSL_Attempt,0,0);
+        }
         switch (Modbus_OSL_Mode)
         {
           case MODBUS_OSL_MODE_RTU:
@@ -523,6 +686,8 @@ void UART1IntHandler(void)
 //! >     activar el flag de Reenvío. Si la respuesta es correcta vuelve a IDLE.
 //! > - __MODBUS_OSL_ERROR__: Activa el Flag de reenvío si el numero de envíos
 //! >     no excede el máximo
+//! > - __MODBUS_OSL_EMISSION__: No hace nada; la petición sale por la
+//! >     interrupción de la UART y al acabar se pasa a WAITREPLY o DELAY.
 //! Cabe destacar que si el timeout de respuesta salta antes de recibirla se 
 //! pasa directamente al estado de ERROR, lo que activará el flag de reenvío. 
 //! Por otro lado si la petición es de Broadcast no se espera respuesta, luego 
@@ -543,11 +708,14 @@ unsigned char Modbus_OSL_Serial_Comm (void)
           //Debug_OSL_Rsp_Resend++;
           Modbus_App_Send();
         }
-        else
+        // Si no, se reenvía una petición cuya espera (backoff) ha vencido.
+        else if(!Modbus_OSL_Backoff_Resend())
         {
           // Si no hay reenvío y quedan mensajes en la cola FIFO se desencola
-          // y envía la siguiente petición. Si no hay mensajes devuelve 0.
-          if(Modbus_App_FIFOSend())
+          // y envía la siguiente petición. Sólo si las colas están vacías (1)
+          // y no hay peticiones en espera devuelve 0; si quedan peticiones
+          // esperando a su Slave o Slaves caídos (2) sigue devolviendo 1.
+          if(Modbus_App_FIFOSend()==1 && Modbus_OSL_Slave_Available(0))
               return 0;
         }
          break;
@@ -572,7 +740,7 @@ unsigned char Modbus_OSL_Serial_Comm (void)
         break;        
         
     default:
-        // En otro estado, como MODBUS_OSL_DELAY, no hacer nada.
+        // En otro estado, como MODBUS_OSL_DELAY o MODBUS_OSL_EMISSION, no hacer nada.
         break;
   }
   return 1;
@@ -595,26 +763,99 @@ unsigned char Modbus_OSL_Resend(void)
 
 //! \brief Activar el flag de Reenvío.
 //! 
-//! Si el Nº de Envíos no supera el Máximo, activa el Flag de Reenvío y aumenta
-//! la cuenta de intentos de envío de un mensaje _Modbus_OSL_Attempt_ en uno.
+//! Si el Nº de Envíos no supera el Máximo de la política de reintentos de la
+//! petición, aumenta la cuenta de intentos de envío de un mensaje
+//! _Modbus_OSL_Attempt_ en uno y, si la política no pide esperar, activa el
+//! Flag de Reenvío. Si pide esperar (backoff), la petición se guarda con su
+//! cuenta y un timer de la rueda, de modo que mientras tanto se atienden las
+//! peticiones a otros Slaves; si no queda sitio se reenvía sin esperar.
 //! Si se ha superado el numero de intentos resetea la cuenta a uno y llama a
 //! _Modbus_App_No_Response_ para que encole en la cola de excepciones que se
-//! ha ignorado un mensaje por no recibir respuesta.
-//! \sa Modbus_OSL_Serial_Comm, Modbus_App_No_Response
+//! ha ignorado un mensaje por no recibir respuesta; indicando si la respuesta
+//! al último envío se descartó por CRC.
+//! \sa Modbus_OSL_Serial_Comm, Modbus_App_No_Response, Modbus_App_Max_Attempts
+//! \sa Modbus_App_Backoff, Modbus_OSL_Backoff_Resend
 void Modbus_OSL_Repeat_Request (void)
 {
-  if(Modbus_OSL_Attempt<Modbus_OSL_Max_Attempts)
+  uint32_t Backoff;
+  unsigned char i;
+
+  if(Modbus_OSL_Attempt<Modbus_App_Max_Attempts(Modbus_OSL_Max_Attempts))
   {
     Modbus_OSL_Attempt++;
+    Backoff=Modbus_App_Backoff(Modbus_OSL_Attempt);
+    if(Backoff)
+    {
+      for(i=0;i<MODBUS_OSL_BACKOFF_SLOTS;i++)
+      {
+        if(!Modbus_OSL_Backoffs[i].Used)
+        {
+          Modbus_App_Actual_Req_Get(&Modbus_OSL_Backoffs[i].Request);
+          Modbus_OSL_Backoffs[i].Attempt=Modbus_OSL_Attempt;
+          Modbus_OSL_Backoffs[i].Ready=0;
+          Modbus_OSL_Backoffs[i].Used=1;
+          Modbus_Timer_Arm(&Modbus_OSL_Backoffs[i].Timer, Backoff);
+          Modbus_OSL_Attempt=1;
+          return;
+        }
+      }
+    }
     Modbus_OSL_Forward_Flag=1;
   }
   else
   {
-    Modbus_App_No_Response();
+    if(Modbus_OSL_CRC_Failed)
+      Modbus_App_No_Response(MODBUS_STATUS_CRC);
+    else
+      Modbus_App_No_Response(MODBUS_STATUS_TIMEOUT);
     Modbus_OSL_Attempt=1;               
   }
 }
 
+//! \brief Reenvía una petición cuya espera (backoff) ha vencido.
+//!
+//! Se recupera la petición como petición actual con su cuenta de intentos.
+//! \return 1 Se ha reenviado una petición
+//! \return 0 No hay ninguna petición lista para reenviar
+//! \sa Modbus_OSL_Repeat_Request, Modbus_OSL_Serial_Comm
+static unsigned char Modbus_OSL_Backoff_Resend(void)
+{
+  unsigned char i;
+
+  for(i=0;i<MODBUS_OSL_BACKOFF_SLOTS;i++)
+  {
+    if(Modbus_OSL_Backoffs[i].Used && Modbus_OSL_Backoffs[i].Ready)
+    {
+      Modbus_OSL_Backoffs[i].Used=0;
+      Modbus_App_Actual_Req_Set(&Modbus_OSL_Backoffs[i].Request);
+      Modbus_OSL_Attempt=Modbus_OSL_Backoffs[i].Attempt;
+      Modbus_App_Send();
+      return 1;
+    }
+  }
+  return 0;
+}
+
+//! \brief Indica si se puede enviar una nueva petición a un Slave.
+//!
+//! No se puede mientras una petición a dicho Slave espera su reenvío, para
+//! que sus peticiones no cambien de orden; una petición BroadCast (Slave 0)
+//! espera a que no quede ninguna.
+//! \param Slave Nº de Slave
+//! \return 1 Se puede enviar
+//! \return 0 Hay que esperar
+//! \sa Modbus_OSL_Repeat_Request, Modbus_App_FIFOSend
+unsigned char Modbus_OSL_Slave_Available(unsigned char Slave)
+{
+  unsigned char i;
+
+  for(i=0;i<MODBUS_OSL_BACKOFF_SLOTS;i++)
+    if(Modbus_OSL_Backoffs[i].Used &&
+       (Slave==0 || Modbus_OSL_Backoffs[i].Request.Slave==Slave))
+      return 0;
+  return 1;
+}
+
 //! \brief Resetea la cuenta de Intentos de envío de un Mensaje.
 //! 
 //! \sa Modbus_OSL_Attempt, Modbus_App_Manage_CallBack
@@ -644,7 +885,7 @@ void Modbus_OSL__Attempt (void)
 //! > - _Error_ = 100: Se llega a la interrupción de la UART sin determinar el 
 //! >    modo de la conexión Serie.
 //! > - _Error_ = 110: Se llega a _Modbus_OSL_Timeouts_ en la interrupción del 
-//! >    Timer2 sin estar en _MODBUS_OSL_WAITREPLY_ o _MODBUS_OSL_DELAY_.
+//! >    timer de Respuesta/BroadCast sin estar en _MODBUS_OSL_WAITREPLY_ o _MODBUS_OSL_DELAY_.
 //! > - _Error_ = 200: Interrupción 1,5T en un estado donde no deberia poder 
 //! >    activarse.
 //! > - _Error_ = 210: Interrupción 3,5T en un estado donde no debería poder
@@ -680,12 +921,20 @@ void Modbus_Fatal_Error(unsigned char Error)
 //! de los punteros en _Modbus_OSL_RTU_35T_ en el caso CONTROLANDWAITING del
 //! switch; puesto que el mensaje no ha sido aun procesado se descarta y se
 //! reenviará la petición; por robustez de la programación.
+//! Se guarda además el tiempo de ida y vuelta para las estadísticas.
 //! \sa Modbus_OSL_Processing_Flag,Modbus_OSL_RTU_35T
 //! \sa Modbus_OSL_Processing_Msg, Modbus_OSL_Timeouts
 void Modbus_OSL_Reception_Complete(void)
 {
   if(Modbus_OSL_MainState_Get()==MODBUS_OSL_WAITREPLY)
+  {
+#if MODBUS_STATS
+      Modbus_OSL_RTT = Modbus_Timer_Stamp() - Modbus_OSL_Stamp;
+#endif
+      MODBUS_TRACE_EVENT(MODBUS_TRACE_RX_COMPLETE,Modbus_OSL_Expected_Slave,Modbus_OSL_Req_ADU[1],
+                         Modbus_App_Actual_Handle(),Modbus_OSL_Attempt,0,0);
       Modbus_OSL_Processing_Flag = 1;
+  }
 }
 
 //! \brief Leer y borrar el Flag de Mensaje Completo Recibido.
@@ -760,9 +1009,9 @@ unsigned char Modbus_OSL_Receive_CallBack(void)
       if(Modbus_OSL_Slave==Modbus_OSL_Expected_Slave)
       {
         //Debug_OSL_IncMsg++;
-        // Se acepta el mensaje, así que se para el Timer 2 para evitar el
+        // Se acepta el mensaje, así que se desarma el timer para evitar el
         // Timeout de Respuesta.
-        TimerDisable(TIMER2_BASE, TIMER_A);
+        Modbus_Timer_Cancel(&Modbus_OSL_Timer);
         // Se pasa al estado PROCESSING
         Modbus_OSL_MainState_Set(MODBUS_OSL_PROCESSING);
         // Comprobar CRC/LRC y enviar información a App si es correcto.
@@ -773,6 +1022,11 @@ unsigned char Modbus_OSL_Receive_CallBack(void)
                 if(Modbus_OSL_RTU_Control_CRC())
                 {  
                   //Debug_OSL_CRC_OK++;
+#if MODBUS_STATS
+                  Modbus_Stats_Answer(Modbus_OSL_Slave,Modbus_OSL_Req_ADU[1],
+                                      Modbus_OSL_RTU_L_Msg_Get(),Modbus_OSL_RTT,1);
+#endif
+                  Modbus_OSL_Turnaround_Update();
                   Modbus_OSL_RTU_to_App();
                   return 1;
                 }
@@ -780,8 +1034,13 @@ unsigned char Modbus_OSL_Receive_CallBack(void)
                 {
                   /* Si se descarta el mensaje por CRC volver la comprobación de
                   trama a OK para no descartar siguientes mensajes y volver a IDLE.*/
+#if MODBUS_STATS
+                  Modbus_Stats_Answer(Modbus_OSL_Slave,Modbus_OSL_Req_ADU[1],
+                                      Modbus_OSL_RTU_L_Msg_Get(),0,0);
+#endif
                   Modbus_OSL_Frame_Set(MODBUS_OSL_Frame_OK);
                   Modbus_OSL_MainState_Set(MODBUS_OSL_ERROR);
+                  Modbus_OSL_CRC_Failed=1;
                 }
                 break;
 
@@ -815,15 +1074,21 @@ unsigned char Modbus_OSL_Receive_CallBack(void)
 //! de Modbus, bien sea de petición o de respuesta. Se le añaden el Nº de Slave
 //! y el CRC mediante _Modbus_OSL_RTU_Mount_ADU_ (en caso de Modo ASCII se 
 //! deberá implementar la adición del LRC y la traducción del formato) y se 
-//! envia el mensaje mediante _Modbus_OSL_Send_. Se configura y se activa el 
-//! Timer 2 en función de si es una petición a un Slave (Unicast) o una petición
-//! BroadCast para activar el Timeout pertinente.
+//! empieza el envío del mensaje mediante _Modbus_OSL_Send_, pasando al estado
+//! _MODBUS_OSL_EMISSION_. La función vuelve sin esperar: el resto de
+//! caracteres los entrega la interrupción de la UART y, cuando ésta acaba de
+//! sacar el último, _Modbus_OSL_Tx_Done_ arma el timer de Respuesta/BroadCast
+//! en función de si es una petición a un Slave (Unicast) o una petición
+//! BroadCast para activar el Timeout pertinente. El envío se anota en las
+//! estadísticas del Slave y de la función.
 //! \param *mb_req_pdu Puntero al vector con el Mensaje de Salida de App (PDU)
 //! \param Slave Nº de Slave de la petición.
 //! \param L_pdu Longitud del Mensaje de Salida de App
+//! \param L_rsp_pdu Longitud del PDU de la respuesta esperada, para el Timeout
 //! \sa Modbus_App_Send, Modbus_OSL_RTU_Mount_ADU, Modbus_OSL_L_Req_ADU
-//! \sa Modbus_OSL_Send, Modbus_OSL_BroadCast_Timeout, Modbus_OSL_Response_Timeout 
-void Modbus_OSL_Output (unsigned char *mb_req_pdu, unsigned char Slave, unsigned char L_pdu)
+//! \sa Modbus_OSL_Send, Modbus_OSL_Tx_Done
+void Modbus_OSL_Output (unsigned char *mb_req_pdu, unsigned char Slave, unsigned char L_pdu,
+                        uint16_t L_rsp_pdu)
 { 
   switch (Modbus_OSL_Mode) 
   {
@@ -842,52 +1107,112 @@ void Modbus_OSL_Output (unsigned char *mb_req_pdu, unsigned char Slave, unsigned
   // Guardar el Nº de Slave al que se realiza la petición para sólo comprobar
   // las respuestas que vengan de dicho Slave y enviar.
   Modbus_OSL_Expected_Slave=Slave;
+  MODBUS_TRACE_EVENT(MODBUS_TRACE_TX_FIRST,Slave,mb_req_pdu[0],Modbus_App_Actual_Handle(),
+                     Modbus_OSL_Attempt,0,0);
+#if MODBUS_STATS
+  Modbus_OSL_Stamp=Modbus_Timer_Stamp();
+  Modbus_Stats_Sent(Slave,mb_req_pdu[0],Modbus_OSL_L_Req_ADU,Modbus_OSL_Attempt);
+#endif
+  // Los Timeouts se arman al acabar el envío.
+  Modbus_OSL_Tx_L_Rsp=L_rsp_pdu;
+  Modbus_Timer_Cancel(&Modbus_OSL_Timer);
+  Modbus_OSL_MainState=MODBUS_OSL_EMISSION;
   Modbus_OSL_Send(Modbus_OSL_Req_ADU, Modbus_OSL_L_Req_ADU);
-  
-  if (Modbus_OSL_Mode==MODBUS_OSL_MODE_RTU)
-  {
-    // En RTU se activa el Timer 0 para volver a IDLE cuando desborde.
-    TimerLoadSet(TIMER0_BASE, TIMER_A, Modbus_OSL_RTU_Get_Timeout_35());
-    TimerEnable(TIMER0_BASE, TIMER_A); 
-  }
- 
-  // Si la petición es de BroadCast
-  if(Modbus_OSL_Expected_Slave==0)
-  {
-    // Iniciar Timer 2 para Timeout de BroadCast.
-    Modbus_OSL_BroadCast_Timeout();
-  }
-  else
-  {
-    // Iniciar Timer 2 para Timeout de Respuesta.
-    Modbus_OSL_Response_Timeout();
-  }
 }
 
 //! \brief Función de Envío de Mensaje.
 //!
-//! Enciende el LED1 de comunicaciones y envía secuencialmente el número de 
-//! caracteres indicado del vector señalado en los parámetros. Al terminar 
-//! apaga el LED de comunicaciones.
+//! Enciende el LED1 de comunicaciones, entrega a la UART el primer carácter
+//! del mensaje y habilita la interrupción de Transmisión, que entregará el
+//! resto mediante _Modbus_OSL_Tx_Next_ sin detener el programa. El mensaje
+//! se envía directamente desde su vector, que no cambia hasta el siguiente
+//! envío. El LED se apaga en _Modbus_OSL_Tx_Done_.
 //! \param *mb_req_adu Puntero al vector con el Mensaje de Salida completo(ADU)
 //! \param L_adu Longitud del Mensaje de Salida Completo.
-//! \sa Modbus_OSL_Output
+//! \sa Modbus_OSL_Output, Modbus_OSL_Req_ADU, Modbus_OSL_Tx_Index
 static void Modbus_OSL_Send (unsigned char *mb_req_adu, unsigned char L_adu)
 {
-  char i;
-
   // Enciende el LED1.
   GPIO_PORTF_DATA_R |= 0x01;
   
-  for (i=0;i<L_adu;i++)
-  { 
-    UARTCharPut(UART1_BASE,mb_req_adu[i]);
+  IntDisable(INT_UART1);
+  UARTCharPutNonBlocking(UART1_BASE,mb_req_adu[0]);
+  Modbus_OSL_Tx_Index=1;
+  UARTIntEnable(UART1_BASE, UART_INT_TX);
+  IntEnable(INT_UART1);
+}
+
+//! \brief Entrega a la UART el siguiente carácter del mensaje de salida.
+//!
+//! Se llama desde la interrupción de Transmisión de la UART1. Con la FIFO
+//! desactivada cabe un carácter cada vez. Tras entregar el último se
+//! deshabilita la interrupción de Transmisión y se arma _Modbus_OSL_Tx_Timer_
+//! para el tiempo de dos caracteres, el que tarda la UART en sacarlos.
+//! \sa UART1IntHandler, Modbus_OSL_Send, Modbus_OSL_Tx_Check
+static void Modbus_OSL_Tx_Next (void)
+{
+  while(Modbus_OSL_Tx_Index<Modbus_OSL_L_Req_ADU && UARTSpaceAvail(UART1_BASE))
+  {
+    UARTCharPutNonBlocking(UART1_BASE,Modbus_OSL_Req_ADU[Modbus_OSL_Tx_Index]);
+    Modbus_OSL_Tx_Index++;
     //Debug_OSL_OutChar++;
-  } 
+  }
+  if(Modbus_OSL_Tx_Index>=Modbus_OSL_L_Req_ADU)
+  {
+    UARTIntDisable(UART1_BASE, UART_INT_TX);
+    Modbus_Timer_Arm(&Modbus_OSL_Tx_Timer,
+                     (2*MODBUS_OSL_RTU_BITS_CHAR*MODBUS_TIMER_TICK_HZ)/Modbus_OSL_Baudrate + 1);
+  }
+}
+
+//! \brief Comprueba si la UART ha acabado de sacar el mensaje.
+//!
+//! Los microcontroladores usados no tienen interrupción de fin de
+//! transmisión, así que se consulta la UART desde la rueda de timers cada tick
+//! hasta que deja de estar ocupada.
+//! \param *Arg No se usa
+//! \sa Modbus_OSL_Tx_Next, Modbus_OSL_Tx_Done
+static void Modbus_OSL_Tx_Check (void *Arg)
+{
+  if(UARTBusy(UART1_BASE))
+    Modbus_Timer_Arm(&Modbus_OSL_Tx_Timer, 1);
+  else
+    Modbus_OSL_Tx_Done();
+}
+
+//! \brief Fin del envío del mensaje.
+//!
+//! El último carácter ha salido de la UART: se apaga el LED1, en RTU se arma
+//! el timer de 3,5T para volver a IDLE cuando expire y se arma el Timeout de
+//! BroadCast o de Respuesta, que así cuentan desde el final real del envío.
+//! \sa Modbus_OSL_Tx_Check, Modbus_OSL_RTU_Start_35T
+//! \sa Modbus_OSL_BroadCast_Timeout, Modbus_OSL_Response_Timeout
+static void Modbus_OSL_Tx_Done (void)
+{
+  MODBUS_TRACE_EVENT(MODBUS_TRACE_TX_LAST,Modbus_OSL_Expected_Slave,Modbus_OSL_Req_ADU[1],
+                     Modbus_App_Actual_Handle(),Modbus_OSL_Attempt,0,0);
   //Debug_OSL_OutMsg++;
   
   // Apaga el LED1.
   GPIO_PORTF_DATA_R &= ~(0x01);
+  
+  if (Modbus_OSL_Mode==MODBUS_OSL_MODE_RTU)
+  {
+    // En RTU se arma el timer de 3,5T para volver a IDLE cuando expire.
+    Modbus_OSL_RTU_Start_35T();
+  }
+ 
+  // Si la petición es de BroadCast
+  if(Modbus_OSL_Expected_Slave==0)
+  {
+    // Armar el timer para Timeout de BroadCast.
+    Modbus_OSL_BroadCast_Timeout();
+  }
+  else
+  {
+    // Armar el timer para Timeout de Respuesta.
+    Modbus_OSL_Response_Timeout(Modbus_OSL_Tx_L_Rsp);
+  }
 }
 //! @}
 #endif
\ No newline at end of file
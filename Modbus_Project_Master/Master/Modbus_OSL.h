@@ -11,6 +11,13 @@
 //! Maximum PDU DATA OSL
 //#define MAX_PDU 253
 
+//! Nº de Slave más alto del que se aprende el tiempo de respuesta.
+#define MODBUS_OSL_MAX_SLAVE 247
+//! Mínimo del Timeout de Respuesta calculado, en ms.
+#define MODBUS_OSL_TIMEOUT_MIN_MS 10
+//! Nº de peticiones que pueden esperar a la vez su reenvío (backoff).
+#define MODBUS_OSL_BACKOFF_SLOTS 4
+
 //! Baudrates implementados para las comunicaciones.
 enum Baud
 {
@@ -22,6 +29,9 @@ enum Baud
     B38400  = 38400,  //!< 38400 Bps
     B57600  = 57600,  //!< 57600 Bps
     B115200 = 115200, //!< 115200 Bps
+    B230400 = 230400, //!< 230400 Bps
+    B460800 = 460800, //!< 460800 Bps
+    B921600 = 921600, //!< 921600 Bps
     BDEFAULT          //!< 19200 Bps
 };
 
@@ -41,7 +51,8 @@ enum Modbus_OSL_MainStates
     MODBUS_OSL_WAITREPLY,      //!< Estado Waiting for Reply
     MODBUS_OSL_DELAY,          //!< Estado Waiting Turnaround Delay
     MODBUS_OSL_PROCESSING,     //!< Estado Processing Reply
-    MODBUS_OSL_ERROR           //!< Estado Processing Error
+    MODBUS_OSL_ERROR,          //!< Estado Processing Error
+    MODBUS_OSL_EMISSION        //!< Estado Emisión: la petición sale por la interrupción de la UART
 };
 	
 //! Estados del diagrama de modo de Transmisión RTU/ASCII.
@@ -84,12 +95,14 @@ void Modbus_OSL_Timeouts(void);
 void Modbus_OSL_Init (enum Baud Baudrate,enum Modbus_OSL_Modes Mode, unsigned char Attempts);
 unsigned char Modbus_OSL_Serial_Comm (void);
 void Modbus_OSL_Reset_Attempt (void);
+unsigned char Modbus_OSL_Slave_Available (unsigned char Slave);
 void Modbus_Fatal_Error(unsigned char Error);
 
 void Modbus_OSL_Reception_Complete (void);
 unsigned char Modbus_OSL_Receive_CallBack(void);
 
-void Modbus_OSL_Output (unsigned char *mb_req_pdu, unsigned char Slave, unsigned char L_pdu);
+void Modbus_OSL_Output (unsigned char *mb_req_pdu, unsigned char Slave, unsigned char L_pdu,
+                        uint16_t L_rsp_pdu);
 
 #endif // __Modbus_OSL_H__
 #endif
\ No newline at end of file
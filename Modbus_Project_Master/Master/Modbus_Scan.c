@@ -0,0 +1,298 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+//******************************************************************************
+//! \defgroup Scan Modbus Scan List
+//! \brief Modbus Scan List Module
+//!
+//! In this Module the master polls the slaves cyclically, like the scan cycle of
+//! a PLC. The application adds scan entries (slave, read function, range, buffer,
+//! period and phase) once and calls Modbus_Scan_Process from its main loop next
+//! to Modbus_Master_Communication; the reads are released into the Request FIFO
+//! when they are due.
+//!
+//! Only MODBUS_SCAN_IN_FLIGHT reads are queued or waiting for the answer at the
+//! same time, so the Request FIFO does not fill and, among the due entries, the
+//! one whose deadline (release + period) is the earliest goes first. The achieved
+//! period, its jitter and the latency of every entry are recorded, so it can be
+//! known when the bus is oversubscribed.
+//!
+//! The times are measured with the tick of the Timer Wheel.
+//******************************************************************************
+//! @{
+
+#include "Modbus_Scan.h"
+#include "Modbus_Timer.h"
+
+//! Microseconds per tick of the Timer Wheel
+#define MODBUS_SCAN_US_PER_TICK (1000000UL / MODBUS_TIMER_TICK_HZ)
+
+//! Scan entry
+struct Modbus_Scan_Entry
+{
+  unsigned char Used;                 //!< 1 if the entry is in the scan list
+  unsigned char Pending;              //!< 1 while its read is queued or waiting for the answer
+  unsigned char Answered;             //!< 1 once it has been answered, _Last_ is valid
+  unsigned char Slave;                //!< Slave to read
+  unsigned char Function;             //!< Read function: 1, 2, 3 or 4
+  uint16_t Adress;                    //!< Initial address of the read
+  uint16_t Quantity;                  //!< Coils, inputs or registers to read
+  uint16_t Handle;                    //!< Handle of the pending read
+  void *Buffer;                       //!< Where the read is stored
+  uint32_t Period;                    //!< Period in ticks
+  uint32_t Release;                   //!< Tick of the next release
+  uint32_t Released;                  //!< Tick when the pending read was released
+  uint32_t Last;                      //!< Tick of the last answer
+  struct Modbus_Scan_Stats Stats;     //!< Statistics, in ticks
+};
+
+//! Scan list
+static struct Modbus_Scan_Entry Modbus_Scan_List[MODBUS_SCAN_ENTRIES];
+//! Reads released which have not finished yet
+static unsigned char Modbus_Scan_In_Flight;
+
+//*****************************************************************************
+//
+// Scan List Module functions
+//
+//*****************************************************************************
+
+//! \brief Clear the statistics of one entry
+//!
+//! \param *Entry Entry to clear
+static void Modbus_Scan_Clear (struct Modbus_Scan_Entry *Entry)
+{
+  Entry->Answered = 0;
+  Entry->Stats.Cycles = 0;
+  Entry->Stats.Errors = 0;
+  Entry->Stats.Overruns = 0;
+  Entry->Stats.Period_Min = 0xFFFFFFFF;
+  Entry->Stats.Period_Max = 0;
+  Entry->Stats.Jitter_Max = 0;
+  Entry->Stats.Latency_Max = 0;
+}
+
+//! \brief Completion callback of the scan reads
+//!
+//! The read is matched with its entry by the handle and the statistics are
+//! updated; only the answered reads count for the period and the latency.
+//! \param Handle    Handle of the read
+//! \param Status    How the read finished
+//! \param Exception Exception code, not used
+static void Modbus_Scan_Done (uint16_t Handle, enum Modbus_Status Status,
+                              unsigned char Exception)
+{
+  uint32_t Now = Modbus_Timer_Now();
+  struct Modbus_Scan_Entry *Entry;
+  uint32_t Time, Jitter;
+  unsigned char i;
+
+  for (i = 0; i < MODBUS_SCAN_ENTRIES; i++)
+    if (Modbus_Scan_List[i].Pending && Modbus_Scan_List[i].Handle == Handle)
+      break;
+  if (i == MODBUS_SCAN_ENTRIES)
+    return;
+  Entry = &Modbus_Scan_List[i];
+  Entry->Pending = 0;
+  Modbus_Scan_In_Flight--;
+
+  // The entry was removed while its read was pending
+  if (!Entry->Used)
+    return;
+
+  if (Status != MODBUS_STATUS_OK)
+  {
+    Entry->Stats.Errors++;
+    return;
+  }
+
+  Time = Now - Entry->Released;
+  if (Time > Entry->Stats.Latency_Max)
+    Entry->Stats.Latency_Max = Time;
+
+  if (Entry->Answered)
+  {
+    Time = Now - Entry->Last;
+    if (Time < Entry->Stats.Period_Min)
+      Entry->Stats.Period_Min = Time;
+    if (Time > Entry->Stats.Period_Max)
+      Entry->Stats.Period_Max = Time;
+    Jitter = (Time > Entry->Period) ? Time - Entry->Period : Entry->Period - Time;
+    if (Jitter > Entry->Stats.Jitter_Max)
+      Entry->Stats.Jitter_Max = Jitter;
+  }
+  Entry->Last = Now;
+  Entry->Answered = 1;
+  Entry->Stats.Cycles++;
+}
+
+//! \brief Release the read of one entry
+//!
+//! \param *Entry Entry to read
+//! \return Handle of the read, queued or sent
+//! \return 0 The Request FIFO is full
+static uint16_t Modbus_Scan_Read (struct Modbus_Scan_Entry *Entry)
+{
+  static const struct Modbus_Request_Options Options = {Modbus_Scan_Done, MODBUS_PRIORITY_NORMAL, 0, 0};
+
+  switch (Entry->Function)
+  {
+    case 1:
+      return Modbus_Read_Coils_Ex(&Options, Entry->Slave, Entry->Adress, Entry->Quantity,
+                                  (unsigned char *)Entry->Buffer);
+    case 2:
+      return Modbus_Read_D_Inputs_Ex(&Options, Entry->Slave, Entry->Adress, Entry->Quantity,
+                                     (unsigned char *)Entry->Buffer);
+    case 3:
+      return Modbus_Read_H_Registers_Ex(&Options, Entry->Slave, Entry->Adress, Entry->Quantity,
+                                        (uint16_t *)Entry->Buffer);
+    default:
+      return Modbus_Read_I_Registers_Ex(&Options, Entry->Slave, Entry->Adress, Entry->Quantity,
+                                        (uint16_t *)Entry->Buffer);
+  }
+}
+
+//! \brief Add an entry to the scan list
+//!
+//! The entry is read for the first time _Phase_ milliseconds later and then
+//! every _Period_ milliseconds. The phases let the entries with the same period
+//! be spread along it.
+//! \param Slave    Slave number, 1-247
+//! \param Function Read function: 1 (coils), 2 (discrete inputs), 3 (holding
+//!                 registers) or 4 (input registers)
+//! \param Adress   Initial address of the read
+//! \param Quantity Amount to read, up to 2000 bits or 125 registers
+//! \param *Buffer  Where every read is stored, unsigned char for bits and
+//!                 uint16_t for registers
+//! \param Period   Period in milliseconds, 1 to MODBUS_SCAN_MAX_MS (about 14.9
+//!                 hours in OSL, 12.4 days in CAN)
+//! \param Phase    Delay of the first read in milliseconds, up to
+//!                 MODBUS_SCAN_MAX_MS
+//! \return Entry number
+//! \return MODBUS_SCAN_NONE Wrong parameters or the scan list is full
+//! \sa Modbus_Scan_Remove, Modbus_Scan_Process
+unsigned char Modbus_Scan_Add (unsigned char Slave, unsigned char Function, uint16_t Adress,
+                               uint16_t Quantity, void *Buffer, uint32_t Period,
+                               uint32_t Phase)
+{
+  struct Modbus_Scan_Entry *Entry;
+  unsigned char i;
+
+  if (Slave > 247 || Slave == 0 || Function == 0 || Function > 4 || Quantity == 0 ||
+      (Function <= 2 && Quantity > 2000) || (Function >= 3 && Quantity > 125) ||
+      ((long)Adress + (long)Quantity) > 65535 || Buffer == 0 || Period == 0 ||
+      Period > MODBUS_SCAN_MAX_MS || Phase > MODBUS_SCAN_MAX_MS)
+    return MODBUS_SCAN_NONE;
+
+  // An entry removed with its read pending is not free until the read finishes
+  for (i = 0; i < MODBUS_SCAN_ENTRIES; i++)
+    if (!Modbus_Scan_List[i].Used && !Modbus_Scan_List[i].Pending)
+      break;
+  if (i == MODBUS_SCAN_ENTRIES)
+    return MODBUS_SCAN_NONE;
+
+  Entry = &Modbus_Scan_List[i];
+  Entry->Slave = Slave;
+  Entry->Function = Function;
+  Entry->Adress = Adress;
+  Entry->Quantity = Quantity;
+  Entry->Buffer = Buffer;
+  Entry->Period = Period * (MODBUS_TIMER_TICK_HZ / 1000);
+  Entry->Release = Modbus_Timer_Now() + Phase * (MODBUS_TIMER_TICK_HZ / 1000);
+  Modbus_Scan_Clear(Entry);
+  Entry->Used = 1;
+  return i;
+}
+
+//! \brief Remove an entry from the scan list
+//!
+//! If its read is pending, it finishes but it is not recorded.
+//! \param Entry Entry number given by Modbus_Scan_Add
+void Modbus_Scan_Remove (unsigned char Entry)
+{
+  if (Entry < MODBUS_SCAN_ENTRIES)
+    Modbus_Scan_List[Entry].Used = 0;
+}
+
+//! \brief Release the due entries
+//!
+//! It has to be called from the main loop as often as possible. While there
+//! are less than MODBUS_SCAN_IN_FLIGHT reads pending, the due entry with the
+//! earliest deadline is released. An entry more than one period late loses
+//! the releases it missed (overrun), so it is not read several times in a row.
+//! \sa Modbus_Scan_Add, Modbus_Master_Communication
+void Modbus_Scan_Process (void)
+{
+  uint32_t Now = Modbus_Timer_Now();
+  struct Modbus_Scan_Entry *Entry;
+  uint32_t Lost;
+  unsigned char i, Best;
+
+  while (Modbus_Scan_In_Flight < MODBUS_SCAN_IN_FLIGHT)
+  {
+    Best = MODBUS_SCAN_NONE;
+    for (i = 0; i < MODBUS_SCAN_ENTRIES; i++)
+    {
+      Entry = &Modbus_Scan_List[i];
+      if (!Entry->Used || Entry->Pending || (int32_t)(Now - Entry->Release) < 0)
+        continue;
+      if (Best == MODBUS_SCAN_NONE ||
+          (int32_t)((Entry->Release + Entry->Period) -
+                    (Modbus_Scan_List[Best].Release + Modbus_Scan_List[Best].Period)) < 0)
+        Best = i;
+    }
+    if (Best == MODBUS_SCAN_NONE)
+      return;
+
+    Entry = &Modbus_Scan_List[Best];
+    if (Now - Entry->Release >= Entry->Period)
+    {
+      Lost = (Now - Entry->Release) / Entry->Period;
+      Entry->Stats.Overruns += Lost;
+      Entry->Release += Lost * Entry->Period;
+    }
+
+    Entry->Handle = Modbus_Scan_Read(Entry);
+    if (Entry->Handle == 0)
+      return; // Request FIFO full, it is tried again in the next call
+    Entry->Pending = 1;
+    Entry->Released = Now;
+    Entry->Release += Entry->Period;
+    Modbus_Scan_In_Flight++;
+  }
+}
+
+//! \brief Get the statistics of one entry
+//!
+//! The times are given in microseconds; Period_Min is 0 until the entry has
+//! been answered twice.
+//! \param Entry  Entry number given by Modbus_Scan_Add
+//! \param *Stats Where the statistics are stored
+//! \return 1 The statistics were stored
+//! \return 0 There is no such entry
+//! \sa Modbus_Scan_Reset_Stats
+unsigned char Modbus_Scan_Get_Stats (unsigned char Entry, struct Modbus_Scan_Stats *Stats)
+{
+  struct Modbus_Scan_Stats *Own;
+
+  if (Entry >= MODBUS_SCAN_ENTRIES || !Modbus_Scan_List[Entry].Used)
+    return 0;
+  Own = &Modbus_Scan_List[Entry].Stats;
+
+  Stats->Cycles = Own->Cycles;
+  Stats->Errors = Own->Errors;
+  Stats->Overruns = Own->Overruns;
+  Stats->Period_Min = (Own->Period_Min == 0xFFFFFFFF) ? 0 : Own->Period_Min * MODBUS_SCAN_US_PER_TICK;
+  Stats->Period_Max = Own->Period_Max * MODBUS_SCAN_US_PER_TICK;
+  Stats->Jitter_Max = Own->Jitter_Max * MODBUS_SCAN_US_PER_TICK;
+  Stats->Latency_Max = Own->Latency_Max * MODBUS_SCAN_US_PER_TICK;
+  return 1;
+}
+
+//! \brief Clear the statistics of one entry
+//!
+//! \param Entry Entry number given by Modbus_Scan_Add
+void Modbus_Scan_Reset_Stats (unsigned char Entry)
+{
+  if (Entry < MODBUS_SCAN_ENTRIES)
+    Modbus_Scan_Clear(&Modbus_Scan_List[Entry]);
+}
+//! @}
@@ -0,0 +1,48 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+#ifndef __Modbus_Scan_h
+#define __Modbus_Scan_h
+
+//! \addtogroup Scan
+//! @{
+
+#include "stdint.h"
+#include "Modbus_App.h"
+#include "Modbus_Timer.h"
+
+//! Entries of the scan list
+#define MODBUS_SCAN_ENTRIES     16
+//! Scan reads which can be queued or waiting for the answer at the same time
+#ifdef CAN_Mode
+#define MODBUS_SCAN_IN_FLIGHT   MODBUS_CAN_MAX_TRANSACTIONS
+#else
+#define MODBUS_SCAN_IN_FLIGHT   2
+#endif
+//! \brief Longest period or phase in milliseconds, about 14.9 hours in OSL and 12.4
+//! days in CAN. The release ticks are compared by their signed difference, so a
+//! phase plus a period must stay within 2^31 ticks.
+#define MODBUS_SCAN_MAX_MS      ((0x7FFFFFFFUL / 2) / (MODBUS_TIMER_TICK_HZ / 1000))
+//! Returned by Modbus_Scan_Add when the entry cannot be added
+#define MODBUS_SCAN_NONE        0xFF
+
+//! Statistics of one scan entry, the times are in microseconds
+struct Modbus_Scan_Stats
+{
+  uint32_t Cycles;                    //!< Reads answered
+  uint32_t Errors;                    //!< Reads finished with an exception or not answered
+  uint32_t Overruns;                  //!< Releases lost because the entry was more than one period late
+  uint32_t Period_Min;                //!< Shortest time between two answers
+  uint32_t Period_Max;                //!< Longest time between two answers
+  uint32_t Jitter_Max;                //!< Largest difference between the time between two answers and the period
+  uint32_t Latency_Max;               //!< Longest time from the release to the answer
+};
+
+unsigned char Modbus_Scan_Add (unsigned char Slave, unsigned char Function, uint16_t Adress,
+                               uint16_t Quantity, void *Buffer, uint32_t Period,
+                               uint32_t Phase);
+void Modbus_Scan_Remove (unsigned char Entry);
+void Modbus_Scan_Process (void);
+unsigned char Modbus_Scan_Get_Stats (unsigned char Entry, struct Modbus_Scan_Stats *Stats);
+void Modbus_Scan_Reset_Stats (unsigned char Entry);
+
+//! @}
+#endif
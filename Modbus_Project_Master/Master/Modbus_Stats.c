@@ -0,0 +1,263 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+//******************************************************************************
+//! \defgroup Stats Modbus Statistics
+//! \brief Modbus Statistics Module
+//!
+//! In this Module the master counts, per slave and per function code, the
+//! requests and how they finished, the CRC errors, the retries, the bytes sent
+//! and received and the round-trip time (from the sending of one attempt to its
+//! answer complete). They help to tune the periods of the scan list and the
+//! timeouts.
+//!
+//! Every record is a direct index in a fixed table and a few additions, so the
+//! hooks of the OSL and CAN modules can be called from the interrupts. The
+//! slaves above MODBUS_STATS_SLAVES only count per function code; the function
+//! codes from MODBUS_STATS_FUNCTIONS count as the code 0. The probes of the
+//! slaves which are down count in the traffic but not as requests.
+//!
+//! The round-trip time is taken with Modbus_Timer_Stamp by the OSL and CAN
+//! modules; the counters wrap around.
+//******************************************************************************
+//! @{
+
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
+#include "Modbus_Stats.h"
+
+#if MODBUS_STATS
+
+//! Statistics of one slave or function code, as they are kept
+struct Modbus_Stats_Entry
+{
+  uint32_t Requests;                  //!< Requests finished
+  uint32_t Successes;                 //!< Correct answers
+  uint32_t Exceptions;                //!< Exception answers
+  uint32_t Timeouts;                  //!< Requests without answer
+  uint32_t Dropped;                   //!< Requests dropped without being sent
+  uint32_t CRC_Errors;                //!< Answers with a wrong CRC
+  uint32_t Retries;                   //!< Sendings after the first one
+  uint32_t Bytes_Sent;                //!< Bytes sent
+  uint32_t Bytes_Received;            //!< Bytes received
+  uint32_t Answers;                   //!< Round-trip time samples
+  uint32_t RTT_Min;                   //!< Shortest round-trip time
+  uint32_t RTT_Max;                   //!< Longest round-trip time
+  uint64_t RTT_Sum;                   //!< Sum of the round-trip times
+};
+
+//! Statistics per slave, 0 is broadcast
+static struct Modbus_Stats_Entry Modbus_Stats_Slaves[MODBUS_STATS_SLAVES + 1];
+//! Statistics per function code, 0 is the rest of the codes
+static struct Modbus_Stats_Entry Modbus_Stats_Functions[MODBUS_STATS_FUNCTIONS];
+
+//*****************************************************************************
+//
+// Statistics Module functions
+//
+//*****************************************************************************
+
+//! \brief Clear one entry
+//!
+//! \param *Entry Entry to clear
+static void Modbus_Stats_Clear (struct Modbus_Stats_Entry *Entry)
+{
+  Entry->Requests = 0;
+  Entry->Successes = 0;
+  Entry->Exceptions = 0;
+  Entry->Timeouts = 0;
+  Entry->Dropped = 0;
+  Entry->CRC_Errors = 0;
+  Entry->Retries = 0;
+  Entry->Bytes_Sent = 0;
+  Entry->Bytes_Received = 0;
+  Entry->Answers = 0;
+  Entry->RTT_Min = 0;
+  Entry->RTT_Max = 0;
+  Entry->RTT_Sum = 0;
+}
+
+//! \brief Entry of a slave
+//!
+//! \param Slave Slave number, 0 for broadcast
+//! \return Its entry, 0 if it has none
+static struct Modbus_Stats_Entry *Modbus_Stats_Slave (unsigned char Slave)
+{
+  return (Slave <= MODBUS_STATS_SLAVES) ? &Modbus_Stats_Slaves[Slave] : 0;
+}
+
+//! \brief Entry of a function code
+//!
+//! \param Function Function code
+//! \return Its entry, the one of the code 0 if it has none
+static struct Modbus_Stats_Entry *Modbus_Stats_Function (unsigned char Function)
+{
+  return &Modbus_Stats_Functions[(Function < MODBUS_STATS_FUNCTIONS) ? Function : 0];
+}
+
+//! \brief Record the sending of one attempt
+//!
+//! \param Slave    Slave of the request, 0 for broadcast
+//! \param Function Function code of the request
+//! \param Bytes    Bytes sent
+//! \param Attempt  Attempt of the request, from 1; the rest count as retries
+//! \sa Modbus_OSL_Output, Modbus_CAN_FixOutput
+void Modbus_Stats_Sent (unsigned char Slave, unsigned char Function, uint16_t Bytes,
+                        unsigned char Attempt)
+{
+  struct Modbus_Stats_Entry *Entry[2];
+  unsigned char i;
+
+  Entry[0] = Modbus_Stats_Slave(Slave);
+  Entry[1] = Modbus_Stats_Function(Function);
+  for (i = (Entry[0] ? 0 : 1); i < 2; i++)
+  {
+    Entry[i]->Bytes_Sent += Bytes;
+    if (Attempt > 1)
+      Entry[i]->Retries++;
+  }
+}
+
+//! \brief Record an answer
+//!
+//! An answer with a wrong CRC counts only its bytes and the CRC error.
+//! \param Slave    Slave which answered
+//! \param Function Function code of the request
+//! \param Bytes    Bytes received
+//! \param RTT      Microseconds from the sending of the attempt to the answer complete
+//! \param CRC_OK   1 if the CRC of the answer was correct
+//! \sa Modbus_OSL_Receive_CallBack, Modbus_CAN_Segment_Process
+void Modbus_Stats_Answer (unsigned char Slave, unsigned char Function, uint16_t Bytes,
+                          uint32_t RTT, unsigned char CRC_OK)
+{
+  struct Modbus_Stats_Entry *Entry[2];
+  unsigned char i;
+
+  Entry[0] = Modbus_Stats_Slave(Slave);
+  Entry[1] = Modbus_Stats_Function(Function);
+  for (i = (Entry[0] ? 0 : 1); i < 2; i++)
+  {
+    Entry[i]->Bytes_Received += Bytes;
+    if (!CRC_OK)
+    {
+      Entry[i]->CRC_Errors++;
+      continue;
+    }
+    Entry[i]->Answers++;
+    Entry[i]->RTT_Sum += RTT;
+    if (Entry[i]->Answers == 1 || RTT < Entry[i]->RTT_Min)
+      Entry[i]->RTT_Min = RTT;
+    if (RTT > Entry[i]->RTT_Max)
+      Entry[i]->RTT_Max = RTT;
+  }
+}
+
+//! \brief Record how a request finished
+//!
+//! \param Slave    Slave of the request, 0 for broadcast
+//! \param Function Function code of the request
+//! \param Status   How it finished
+//! \sa Modbus_App_Finish
+void Modbus_Stats_Finish (unsigned char Slave, unsigned char Function, enum Modbus_Status Status)
+{
+  struct Modbus_Stats_Entry *Entry[2];
+  unsigned char i;
+
+  Entry[0] = Modbus_Stats_Slave(Slave);
+  Entry[1] = Modbus_Stats_Function(Function);
+  for (i = (Entry[0] ? 0 : 1); i < 2; i++)
+  {
+    Entry[i]->Requests++;
+    switch (Status)
+    {
+      case MODBUS_STATUS_OK:
+        Entry[i]->Successes++;
+        break;
+      case MODBUS_STATUS_EXCEPTION:
+        Entry[i]->Exceptions++;
+        break;
+      case MODBUS_STATUS_TIMEOUT:
+      case MODBUS_STATUS_CRC:
+        Entry[i]->Timeouts++;
+        break;
+      default:
+        Entry[i]->Dropped++;
+        break;
+    }
+  }
+}
+
+//! \brief Copy an entry
+//!
+//! The interrupts are masked while it is copied, so the snapshot is coherent.
+//! \param *Entry Entry to copy
+//! \param *Stats Where it is copied
+static void Modbus_Stats_Copy (struct Modbus_Stats_Entry *Entry, struct Modbus_Stats *Stats)
+{
+  tBoolean Masked;
+  uint64_t Sum;
+
+  Masked = IntMasterDisable();
+  Stats->Requests = Entry->Requests;
+  Stats->Successes = Entry->Successes;
+  Stats->Exceptions = Entry->Exceptions;
+  Stats->Timeouts = Entry->Timeouts;
+  Stats->Dropped = Entry->Dropped;
+  Stats->CRC_Errors = Entry->CRC_Errors;
+  Stats->Retries = Entry->Retries;
+  Stats->Bytes_Sent = Entry->Bytes_Sent;
+  Stats->Bytes_Received = Entry->Bytes_Received;
+  Stats->Answers = Entry->Answers;
+  Stats->RTT_Min = Entry->RTT_Min;
+  Stats->RTT_Max = Entry->RTT_Max;
+  Sum = Entry->RTT_Sum;
+  if (!Masked)
+    IntMasterEnable();
+  Stats->RTT_Avg = Stats->Answers ? (uint32_t)(Sum / Stats->Answers) : 0;
+}
+
+//! \brief Get the statistics of one slave
+//!
+//! \param Slave  Slave number, 0 for broadcast
+//! \param *Stats Where the statistics are stored
+//! \return 1 The statistics were stored
+//! \return 0 The slave is above MODBUS_STATS_SLAVES
+//! \sa Modbus_Stats_Get_Function, Modbus_Stats_Reset
+unsigned char Modbus_Stats_Get_Slave (unsigned char Slave, struct Modbus_Stats *Stats)
+{
+  struct Modbus_Stats_Entry *Entry = Modbus_Stats_Slave(Slave);
+
+  if (!Entry)
+    return 0;
+  Modbus_Stats_Copy(Entry, Stats);
+  return 1;
+}
+
+//! \brief Get the statistics of one function code
+//!
+//! \param Function Function code, any code from MODBUS_STATS_FUNCTIONS gives the rest of codes
+//! \param *Stats   Where the statistics are stored
+//! \return 1 The function code has its own statistics
+//! \return 0 The statistics of the rest of codes were stored
+//! \sa Modbus_Stats_Get_Slave, Modbus_Stats_Reset
+unsigned char Modbus_Stats_Get_Function (unsigned char Function, struct Modbus_Stats *Stats)
+{
+  Modbus_Stats_Copy(Modbus_Stats_Function(Function), Stats);
+  return (Function != 0 && Function < MODBUS_STATS_FUNCTIONS);
+}
+
+//! \brief Clear the statistics of every slave and function code
+void Modbus_Stats_Reset (void)
+{
+  tBoolean Masked;
+  unsigned char i;
+
+  Masked = IntMasterDisable();
+  for (i = 0; i <= MODBUS_STATS_SLAVES; i++)
+    Modbus_Stats_Clear(&Modbus_Stats_Slaves[i]);
+  for (i = 0; i < MODBUS_STATS_FUNCTIONS; i++)
+    Modbus_Stats_Clear(&Modbus_Stats_Functions[i]);
+  if (!Masked)
+    IntMasterEnable();
+}
+
+#endif
+//! @}
@@ -0,0 +1,48 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+#ifndef __Modbus_Stats_h
+#define __Modbus_Stats_h
+
+//! \addtogroup Stats
+//! @{
+
+#include "stdint.h"
+#include "Modbus_FIFO.h"
+
+//! 1 to keep the statistics of the requests, 0 to leave them out; it can be set from the compiler command line
+#ifndef MODBUS_STATS
+#define MODBUS_STATS            1
+#endif
+//! Slaves with their own statistics, from 1; the broadcasts are kept as slave 0
+#define MODBUS_STATS_SLAVES     32
+//! Function codes with their own statistics, from 1; the code 0 keeps the rest
+#define MODBUS_STATS_FUNCTIONS  24
+
+//! Statistics of the requests to one slave or of one function code, the times are in microseconds
+struct Modbus_Stats
+{
+  uint32_t Requests;                  //!< Requests finished, whatever their outcome
+  uint32_t Successes;                 //!< Requests finished with a correct answer
+  uint32_t Exceptions;                //!< Requests finished with an exception answer
+  uint32_t Timeouts;                  //!< Requests finished without answer (MODBUS_STATUS_TIMEOUT or MODBUS_STATUS_CRC)
+  uint32_t Dropped;                   //!< Requests dropped without being sent (MODBUS_STATUS_EXPIRED or MODBUS_STATUS_DOWN)
+  uint32_t CRC_Errors;                //!< Answers thrown away by a wrong CRC, one per attempt
+  uint32_t Retries;                   //!< Sendings after the first one
+  uint32_t Bytes_Sent;                //!< Bytes sent: ADU in OSL, PDU in CAN
+  uint32_t Bytes_Received;            //!< Bytes of the answers received: ADU in OSL, PDU in CAN
+  uint32_t Answers;                   //!< Answers received with a correct CRC, the round-trip time samples
+  uint32_t RTT_Min;                   //!< Shortest time from the sending to the answer complete
+  uint32_t RTT_Avg;                   //!< Average time from the sending to the answer complete
+  uint32_t RTT_Max;                   //!< Longest time from the sending to the answer complete
+};
+
+void Modbus_Stats_Sent (unsigned char Slave, unsigned char Function, uint16_t Bytes,
+                        unsigned char Attempt);
+void Modbus_Stats_Answer (unsigned char Slave, unsigned char Function, uint16_t Bytes,
+                          uint32_t RTT, unsigned char CRC_OK);
+void Modbus_Stats_Finish (unsigned char Slave, unsigned char Function, enum Modbus_Status Status);
+unsigned char Modbus_Stats_Get_Slave (unsigned char Slave, struct Modbus_Stats *Stats);
+unsigned char Modbus_Stats_Get_Function (unsigned char Function, struct Modbus_Stats *Stats);
+void Modbus_Stats_Reset (void);
+
+//! @}
+#endif
@@ -0,0 +1,267 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+//******************************************************************************
+//! \defgroup Timer_Wheel Modbus Timer Wheel
+//! \brief Modbus Timer Wheel Module
+//!
+//! In this Module all the timeouts of the protocol (1,5T, 3,5T, response and
+//! broadcast timeouts of OSL and the unicast and broadcast timeouts of CAN) are
+//! multiplexed onto the periodic interrupt of the _Timer 0_, so any number of
+//! them can be pending at the same time and the rest of the hardware timers are
+//! free for the application.
+//!
+//! The timers are kept in a hierarchical wheel of MODBUS_TIMER_LEVELS levels
+//! with MODBUS_TIMER_SLOTS slots each. A timer is linked at the level whose
+//! range covers its delay; every time a level completes a turn the next slot of
+//! the level above is moved down (cascade). Arm and cancel are O(1) and every
+//! tick only visits the timers which expire in it.
+//******************************************************************************
+//! @{
+
+#include "inc/hw_ints.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_timer.h"
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/timer.h"
+#include "Modbus_Timer.h"
+
+//! Mask of the slot index of one level
+#define MODBUS_TIMER_MASK       (MODBUS_TIMER_SLOTS - 1)
+
+//! Slots of the wheel, each one is a list of timers
+static struct Modbus_Timer *Modbus_Timer_Wheel[MODBUS_TIMER_LEVELS][MODBUS_TIMER_SLOTS];
+//! Ticks since the initialisation
+static volatile uint32_t Modbus_Timer_Ticks;
+//! 1 once the Timer 0 is running
+static unsigned char Modbus_Timer_Running;
+//! Clocks of one tick, loaded in the Timer 0
+static uint32_t Modbus_Timer_Load;
+
+//*****************************************************************************
+//
+// Timer Wheel Module functions
+//
+//*****************************************************************************
+
+//! \brief Link a timer at the slot given by its expiration tick
+//!
+//! The level is chosen from the ticks left; the wheel must be locked.
+//! \param *Timer Timer with _Expires_ already set
+static void Modbus_Timer_Insert (struct Modbus_Timer *Timer)
+{
+  uint32_t Delta = Timer->Expires - Modbus_Timer_Ticks;
+  struct Modbus_Timer **Slot;
+
+  if (Delta < (1UL << MODBUS_TIMER_BITS))
+    Slot = &Modbus_Timer_Wheel[0][Timer->Expires & MODBUS_TIMER_MASK];
+  else if (Delta < (1UL << (2 * MODBUS_TIMER_BITS)))
+    Slot = &Modbus_Timer_Wheel[1][(Timer->Expires >> MODBUS_TIMER_BITS) & MODBUS_TIMER_MASK];
+  else
+    Slot = &Modbus_Timer_Wheel[2][(Timer->Expires >> (2 * MODBUS_TIMER_BITS)) & MODBUS_TIMER_MASK];
+
+  Timer->Next = *Slot;
+  if (Timer->Next)
+    Timer->Next->Link = &Timer->Next;
+  *Slot = Timer;
+  Timer->Link = Slot;
+}
+
+//! \brief Unlink an armed timer from its slot
+//!
+//! The wheel must be locked.
+//! \param *Timer Armed timer
+static void Modbus_Timer_Unlink (struct Modbus_Timer *Timer)
+{
+  *Timer->Link = Timer->Next;
+  if (Timer->Next)
+    Timer->Next->Link = Timer->Link;
+  Timer->Next = 0;
+  Timer->Link = 0;
+}
+
+//! \brief Move down the timers of one slot of an upper level
+//!
+//! \param Level Level of the slot
+//! \param Slot  Slot index
+static void Modbus_Timer_Cascade (unsigned char Level, unsigned char Slot)
+{
+  struct Modbus_Timer *Timer = Modbus_Timer_Wheel[Level][Slot];
+  struct Modbus_Timer *Next;
+
+  Modbus_Timer_Wheel[Level][Slot] = 0;
+  while (Timer)
+  {
+    Next = Timer->Next;
+    Modbus_Timer_Insert(Timer);
+    Timer = Next;
+  }
+}
+
+//! \brief Timer Wheel Setup
+//!
+//! Configures the _Timer 0_ to interrupt MODBUS_TIMER_TICK_HZ times per second.
+//! It can be called by every module which uses the wheel, only the first call
+//! configures the hardware.
+void Modbus_Timer_Init (void)
+{
+  if (Modbus_Timer_Running)
+    return;
+  Modbus_Timer_Running = 1;
+  Modbus_Timer_Ticks = 0;
+
+  SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER0);
+  TimerConfigure(TIMER0_BASE, TIMER_CFG_PERIODIC);
+  Modbus_Timer_Load = SysCtlClockGet() / MODBUS_TIMER_TICK_HZ;
+  TimerLoadSet(TIMER0_BASE, TIMER_A, Modbus_Timer_Load);
+  IntEnable(INT_TIMER0A);
+  TimerIntEnable(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+  TimerEnable(TIMER0_BASE, TIMER_A);
+}
+
+//! \brief Timer Setup
+//!
+//! Sets the function called when the timer expires; the timer is left disarmed.
+//! \param *Timer    Timer to set up
+//! \param CallBack  Function called from the tick interrupt when it expires
+//! \param *Arg      Argument given to the CallBack
+void Modbus_Timer_Setup (struct Modbus_Timer *Timer, void (*CallBack)(void *Arg),
+                         void *Arg)
+{
+  Timer->Next = 0;
+  Timer->Link = 0;
+  Timer->CallBack = CallBack;
+  Timer->Arg = Arg;
+}
+
+//! \brief Arm (or re-arm) a timer
+//!
+//! The timer expires after no less than _Ticks_ whole ticks; since the current
+//! tick is already running, one tick more is added. If it was armed, the
+//! previous expiration is forgotten.
+//! \param *Timer Timer set up with Modbus_Timer_Setup
+//! \param Ticks  Delay, cut down to MODBUS_TIMER_MAX_TICKS
+//! \sa Modbus_Timer_Setup
+void Modbus_Timer_Arm (struct Modbus_Timer *Timer, uint32_t Ticks)
+{
+  tBoolean Masked;
+
+  if (Ticks > MODBUS_TIMER_MAX_TICKS)
+    Ticks = MODBUS_TIMER_MAX_TICKS;
+
+  Masked = IntMasterDisable();
+  if (Timer->Link)
+    Modbus_Timer_Unlink(Timer);
+  Timer->Expires = Modbus_Timer_Ticks + Ticks + 1;
+  Modbus_Timer_Insert(Timer);
+  if (!Masked)
+    IntMasterEnable();
+}
+
+//! \brief Disarm a timer
+//!
+//! Nothing is done if it was not armed.
+//! \param *Timer Timer to disarm
+void Modbus_Timer_Cancel (struct Modbus_Timer *Timer)
+{
+  tBoolean Masked;
+
+  Masked = IntMasterDisable();
+  if (Timer->Link)
+    Modbus_Timer_Unlink(Timer);
+  if (!Masked)
+    IntMasterEnable();
+}
+
+//! \brief Check whether a timer is armed or not
+//!
+//! \param *Timer Timer to check
+//! \return 0 The timer is not armed
+//! \return 1 The timer is armed
+unsigned char Modbus_Timer_Armed (struct Modbus_Timer *Timer)
+{
+  return (Timer->Link != 0);
+}
+
+//! \brief Ticks since the initialisation
+//!
+//! \return Current tick, it wraps around after 2^32 ticks
+uint32_t Modbus_Timer_Now (void)
+{
+  return Modbus_Timer_Ticks;
+}
+
+//! \brief Microseconds since the initialisation
+//!
+//! The current tick is completed with the count of the _Timer 0_, so the
+//! resolution is the clock of the system instead of the tick. If the tick
+//! interrupt is pending because it is masked, the tick not counted yet is added.
+//! \return Current time in microseconds, it wraps around after 2^32 us
+uint32_t Modbus_Timer_Stamp (void)
+{
+  uint32_t Ticks, Count;
+
+  do
+  {
+    Ticks = Modbus_Timer_Ticks;
+    Count = Modbus_Timer_Load - TimerValueGet(TIMER0_BASE, TIMER_A);
+    if (TimerIntStatus(TIMER0_BASE, false) & TIMER_TIMA_TIMEOUT)
+    {
+      // Reloaded but not counted; the count is read again after the reload
+      Ticks++;
+      Count = Modbus_Timer_Load - TimerValueGet(TIMER0_BASE, TIMER_A);
+    }
+  } while (Ticks != Modbus_Timer_Ticks &&
+           !(TimerIntStatus(TIMER0_BASE, false) & TIMER_TIMA_TIMEOUT));
+
+  return Ticks * (1000000 / MODBUS_TIMER_TICK_HZ) +
+         Count / (Modbus_Timer_Load / (1000000 / MODBUS_TIMER_TICK_HZ));
+}
+
+//! \brief Clocks of the system since the initialisation
+//!
+//! Cheaper than Modbus_Timer_Stamp, for the stamps which must cost only a few
+//! cycles: there is no division and the pending tick is not checked, so a
+//! stamp taken while the tick interrupt is masked can be one tick short.
+//! \return Current time in clocks of the system, it wraps around after 2^32 clocks
+uint32_t Modbus_Timer_Clocks (void)
+{
+  return Modbus_Timer_Ticks * Modbus_Timer_Load +
+         (Modbus_Timer_Load - HWREG(TIMER0_BASE + TIMER_O_TAR));
+}
+
+//! \brief Tick interrupt
+//!
+//! Advances the wheel one tick, cascades the upper levels when the lower one
+//! completes a turn and calls back the timers which expire. Every timer is
+//! disarmed before its CallBack, so it can be armed again from there.
+void Modbus_Timer_IntHandler (void)
+{
+  struct Modbus_Timer **Slot;
+  struct Modbus_Timer *Timer;
+  tBoolean Masked;
+
+  TimerIntClear(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+
+  Masked = IntMasterDisable();
+  Modbus_Timer_Ticks++;
+  if ((Modbus_Timer_Ticks & MODBUS_TIMER_MASK) == 0)
+  {
+    if (((Modbus_Timer_Ticks >> MODBUS_TIMER_BITS) & MODBUS_TIMER_MASK) == 0)
+      Modbus_Timer_Cascade(2, (Modbus_Timer_Ticks >> (2 * MODBUS_TIMER_BITS)) & MODBUS_TIMER_MASK);
+    Modbus_Timer_Cascade(1, (Modbus_Timer_Ticks >> MODBUS_TIMER_BITS) & MODBUS_TIMER_MASK);
+  }
+
+  Slot = &Modbus_Timer_Wheel[0][Modbus_Timer_Ticks & MODBUS_TIMER_MASK];
+  while ((Timer = *Slot) != 0)
+  {
+    Modbus_Timer_Unlink(Timer);
+    if (!Masked)
+      IntMasterEnable();
+    Timer->CallBack(Timer->Arg);
+    Masked = IntMasterDisable();
+  }
+  if (!Masked)
+    IntMasterEnable();
+}
+//! @}
@@ -0,0 +1,47 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+#ifndef __Modbus_Timer_h
+#define __Modbus_Timer_h
+
+//! \addtogroup Timer_Wheel
+//! @{
+
+#include "stdint.h"
+
+//! Ticks per second of the timer wheel
+#ifdef CAN_Mode
+#define MODBUS_TIMER_TICK_HZ    1000
+#else
+#define MODBUS_TIMER_TICK_HZ    20000
+#endif
+//! Bits of the slot index, every level of the wheel has 2^MODBUS_TIMER_BITS slots
+#define MODBUS_TIMER_BITS       6
+//! Slots per level
+#define MODBUS_TIMER_SLOTS      (1 << MODBUS_TIMER_BITS)
+//! Levels of the wheel
+#define MODBUS_TIMER_LEVELS     3
+//! Longest delay which can be armed, longer delays are cut down to it
+#define MODBUS_TIMER_MAX_TICKS  ((1UL << (MODBUS_TIMER_BITS * MODBUS_TIMER_LEVELS)) - 2)
+
+//! Software timer; the owner keeps it and the wheel only links it while it is armed
+struct Modbus_Timer
+{
+  struct Modbus_Timer *Next;          //!< Next timer in the same slot
+  struct Modbus_Timer **Link;         //!< Pointer which points to this timer, 0 if it is not armed
+  uint32_t Expires;                   //!< Tick when the timer expires
+  void (*CallBack)(void *Arg);        //!< Function called from the tick interrupt when it expires
+  void *Arg;                          //!< Argument given to the CallBack
+};
+
+void Modbus_Timer_Init (void);
+void Modbus_Timer_Setup (struct Modbus_Timer *Timer, void (*CallBack)(void *Arg),
+                         void *Arg);
+void Modbus_Timer_Arm (struct Modbus_Timer *Timer, uint32_t Ticks);
+void Modbus_Timer_Cancel (struct Modbus_Timer *Timer);
+unsigned char Modbus_Timer_Armed (struct Modbus_Timer *Timer);
+uint32_t Modbus_Timer_Now (void);
+uint32_t Modbus_Timer_Stamp (void);
+uint32_t Modbus_Timer_Clocks (void);
+void Modbus_Timer_IntHandler (void);
+
+//! @}
+#endif
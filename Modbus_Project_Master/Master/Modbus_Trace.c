@@ -0,0 +1,158 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+//******************************************************************************
+//! \defgroup Trace Modbus Trace
+//! \brief Modbus Trace Module
+//!
+//! In this Module the master records every stage of its requests in a ring of
+//! MODBUS_TRACE_SIZE records: enqueue, dequeue, first and last byte sent, first
+//! byte of the answer, answer complete and callback done; with the slave, the
+//! function code, the attempt and the outcome. When the ring is full the oldest
+//! records are overwritten.
+//!
+//! The trace is compiled only if MODBUS_TRACE is 1; otherwise the hooks of the
+//! rest of modules (MODBUS_TRACE_EVENT) are empty. A record is one stamp of
+//! Modbus_Timer_Clocks and a few stores with the interrupts masked, so it can
+//! be taken from the UART and CAN interrupts.
+//!
+//! Modbus_Trace_Export writes the ring through a function of the application
+//! (UART, USB, memory...) in a binary format, all the fields little-endian:
+//! > - Header, 20 bytes: "MBTR", version, bytes per record, 2 reserved bytes,
+//! >     records taken since the last clear (32 bits), records exported
+//! >     (32 bits) and clocks per second (32 bits).
+//! > - Records, MODBUS_TRACE_RECORD bytes each and the oldest first: clock
+//! >     (32 bits), handle (16 bits), slave, function, event, attempt, outcome
+//! >     and exception.
+//!
+//! The decoder of the host (tools/Modbus_Trace_Decode.c) turns a dump into the
+//! latency of every stage of every request.
+//******************************************************************************
+//! @{
+
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/sysctl.h"
+#include "Modbus_Trace.h"
+#include "Modbus_Timer.h"
+
+#if MODBUS_TRACE
+
+//! Trace ring
+static struct Modbus_Trace_Record Modbus_Trace_Ring[MODBUS_TRACE_SIZE];
+//! Records taken since the last clear; the next one goes to Head % MODBUS_TRACE_SIZE
+static uint32_t Modbus_Trace_Head;
+//! 1 while the ring is exported, the new stages are not recorded
+static volatile unsigned char Modbus_Trace_Frozen;
+
+//*****************************************************************************
+//
+// Trace Module functions
+//
+//*****************************************************************************
+
+//! \brief Record one stage of a request
+//!
+//! Called through MODBUS_TRACE_EVENT. The interrupts are masked while the
+//! record is written, so the records are in the order of their clocks.
+//! \param Event     enum Modbus_Trace_Event
+//! \param Slave     Slave of the request
+//! \param Function  Function code of the request
+//! \param Handle    Handle of the request
+//! \param Attempt   Attempt of the request, 0 if it is not known
+//! \param Outcome   enum Modbus_Status for MODBUS_TRACE_CALLBACK, 0 for the rest
+//! \param Exception Exception code for MODBUS_TRACE_CALLBACK, 0 for the rest
+void Modbus_Trace_Event (unsigned char Event, unsigned char Slave, unsigned char Function,
+                         uint16_t Handle, unsigned char Attempt, unsigned char Outcome,
+                         unsigned char Exception)
+{
+  struct Modbus_Trace_Record *Record;
+  tBoolean Masked;
+
+  if (Modbus_Trace_Frozen)
+    return;
+
+  Masked = IntMasterDisable();
+  Record = &Modbus_Trace_Ring[Modbus_Trace_Head++ & (MODBUS_TRACE_SIZE - 1)];
+  Record->Clock = Modbus_Timer_Clocks();
+  Record->Handle = Handle;
+  Record->Slave = Slave;
+  Record->Function = Function;
+  Record->Event = Event;
+  Record->Attempt = Attempt;
+  Record->Outcome = Outcome;
+  Record->Exception = Exception;
+  if (!Masked)
+    IntMasterEnable();
+}
+
+//! \brief Store a 32 bits value little-endian
+//!
+//! \param *Data  Where it is stored
+//! \param Value  Value
+static void Modbus_Trace_Put_32 (unsigned char *Data, uint32_t Value)
+{
+  Data[0] = Value;
+  Data[1] = Value >> 8;
+  Data[2] = Value >> 16;
+  Data[3] = Value >> 24;
+}
+
+//! \brief Export the trace ring
+//!
+//! The header and the records, from the oldest, are given to _Write_ in the
+//! format described in the module. The stages which happen meanwhile are not
+//! recorded. The ring is not cleared.
+//! \param Write Function of the application which sends or stores the bytes
+//! \sa Modbus_Trace_Clear
+void Modbus_Trace_Export (void (*Write)(const unsigned char *Data, uint16_t Length))
+{
+  unsigned char Data[20];
+  struct Modbus_Trace_Record *Record;
+  uint32_t Count, i;
+
+  Modbus_Trace_Frozen = 1;
+  Count = Modbus_Trace_Head < MODBUS_TRACE_SIZE ? Modbus_Trace_Head : MODBUS_TRACE_SIZE;
+
+  Data[0] = 'M';
+  Data[1] = 'B';
+  Data[2] = 'T';
+  Data[3] = 'R';
+  Data[4] = MODBUS_TRACE_VERSION;
+  Data[5] = MODBUS_TRACE_RECORD;
+  Data[6] = 0;
+  Data[7] = 0;
+  Modbus_Trace_Put_32(&Data[8], Modbus_Trace_Head);
+  Modbus_Trace_Put_32(&Data[12], Count);
+  Modbus_Trace_Put_32(&Data[16], SysCtlClockGet());
+  Write(Data, 20);
+
+  for (i = Modbus_Trace_Head - Count; i != Modbus_Trace_Head; i++)
+  {
+    Record = &Modbus_Trace_Ring[i & (MODBUS_TRACE_SIZE - 1)];
+    Modbus_Trace_Put_32(&Data[0], Record->Clock);
+    Data[4] = Record->Handle;
+    Data[5] = Record->Handle >> 8;
+    Data[6] = Record->Slave;
+    Data[7] = Record->Function;
+    Data[8] = Record->Event;
+    Data[9] = Record->Attempt;
+    Data[10] = Record->Outcome;
+    Data[11] = Record->Exception;
+    Write(Data, MODBUS_TRACE_RECORD);
+  }
+
+  Modbus_Trace_Frozen = 0;
+}
+
+//! \brief Empty the trace ring
+void Modbus_Trace_Clear (void)
+{
+  tBoolean Masked;
+
+  Masked = IntMasterDisable();
+  Modbus_Trace_Head = 0;
+  if (!Masked)
+    IntMasterEnable();
+}
+
+#endif
+//! @}
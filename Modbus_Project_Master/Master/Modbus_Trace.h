@@ -0,0 +1,61 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+#ifndef __Modbus_Trace_h
+#define __Modbus_Trace_h
+
+//! \addtogroup Trace
+//! @{
+
+#include "stdint.h"
+
+//! 1 to record the transactions in the trace ring, 0 to leave the trace out; it can be set from the compiler command line
+#ifndef MODBUS_TRACE
+#define MODBUS_TRACE            0
+#endif
+//! Records of the trace ring, a power of 2
+#define MODBUS_TRACE_SIZE       256
+//! Version of the export format
+#define MODBUS_TRACE_VERSION    1
+//! Bytes of one exported record
+#define MODBUS_TRACE_RECORD     12
+
+//! Stages of a request recorded in the trace
+enum Modbus_Trace_Event
+{
+  MODBUS_TRACE_ENQUEUE,       //!< Given by the user function, queued or sent at once
+  MODBUS_TRACE_DEQUEUE,       //!< Taken to be sent
+  MODBUS_TRACE_TX_FIRST,      //!< First byte (segment in CAN) of one attempt handed to the hardware
+  MODBUS_TRACE_TX_LAST,       //!< Last byte (segment in CAN) of one attempt handed to the hardware
+  MODBUS_TRACE_RX_FIRST,      //!< First byte (segment in CAN) of the answer received
+  MODBUS_TRACE_RX_COMPLETE,   //!< Answer complete, 3,5T in OSL or last segment in CAN
+  MODBUS_TRACE_CALLBACK       //!< Finished and its completion callback done
+};
+
+//! One record of the trace ring
+struct Modbus_Trace_Record
+{
+  uint32_t Clock;             //!< Clocks of the system, Modbus_Timer_Clocks
+  uint16_t Handle;            //!< Handle of the request, 0 for merged reads and probes
+  unsigned char Slave;        //!< Slave of the request
+  unsigned char Function;     //!< Function code of the request
+  unsigned char Event;        //!< enum Modbus_Trace_Event
+  unsigned char Attempt;      //!< Attempt of the request, 0 if it is not known at that stage
+  unsigned char Outcome;      //!< enum Modbus_Status for MODBUS_TRACE_CALLBACK, 0 for the rest
+  unsigned char Exception;    //!< Exception code for MODBUS_TRACE_CALLBACK, 0 for the rest
+};
+
+#if MODBUS_TRACE
+//! Record one stage of a request
+#define MODBUS_TRACE_EVENT(Event, Slave, Function, Handle, Attempt, Outcome, Exception) \
+        Modbus_Trace_Event((Event), (Slave), (Function), (Handle), (Attempt), (Outcome), (Exception))
+#else
+#define MODBUS_TRACE_EVENT(Event, Slave, Function, Handle, Attempt, Outcome, Exception)
+#endif
+
+void Modbus_Trace_Event (unsigned char Event, unsigned char Slave, unsigned char Function,
+                         uint16_t Handle, unsigned char Attempt, unsigned char Outcome,
+                         unsigned char Exception);
+void Modbus_Trace_Export (void (*Write)(const unsigned char *Data, uint16_t Length));
+void Modbus_Trace_Clear (void);
+
+//! @}
+#endif
@@ -38,7 +38,12 @@
 */
 //! @{
 
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
 #include "Modbus_App.h"
+#include "Modbus_Timer.h"
+#include "Modbus_Trace.h"
+#include "Modbus_Stats.h"
 
 //*****************************************************************************
 //
@@ -57,13 +62,11 @@
 //
 //*****************************************************************************
 
-//! FIFO Request. It stores the request which have not been sent yet.
-static struct Modbus_FIFO_s Modbus_FIFO_Tx;
+//! FIFOs Request, one per priority. They store the requests which have not been sent yet.
+static struct Modbus_FIFO_s Modbus_FIFO_Tx[MODBUS_APP_PRIORITIES];
 //! \brief Error Communication FIFO; It stores the error responses next to the request
 //! who provoked it and the messages not replied.
 static struct Modbus_FIFO_Errors Modbus_FIFO_Error;
-//! It stores temporary a request to add it later into the Request FIFO.
-static struct Modbus_FIFO_Item Modbus_App_Request;
 //! \brief It stores the actual request, in this way, it is conserved its data while
 //! the answer arrives.
 static struct Modbus_FIFO_Item Modbus_App_Actual_Req;
@@ -77,6 +80,57 @@ static unsigned char Modbus_App_L_Msg;
 static unsigned char Modbus_App_Req_pdu[MAX_PDU];
 //! Outcoming message length
 static unsigned char Modbus_App_L_Req_pdu;
+//! Last handle given to a request
+static uint16_t Modbus_App_Handle;
+//! Handle of the last request accepted by a user function, 0 if it was rejected
+static uint16_t Modbus_App_Last_Handle;
+//! \brief Options for the next request of the user functions without _Ex_, set by _Modbus_Next_CallBack_,
+//! _Modbus_Next_Priority_ and _Modbus_Next_Retry_Policy_
+static struct Modbus_Request_Options Modbus_App_Next = {0, MODBUS_PRIORITY_NORMAL, 0, 0};
+#if MODBUS_APP_MERGE
+//! Register reads merged into one request
+struct Modbus_App_Merge_Group
+{
+  unsigned char Items;                                    //!< Merged requests, 0 if the group is free
+  struct Modbus_FIFO_Item Request[MODBUS_APP_MERGE_ITEMS]; //!< The merged requests, as they were queued
+  uint16_t Buffer[125];                                   //!< Registers read by the merged request
+};
+//! Groups of merged reads; a group is busy until its request finishes
+static struct Modbus_App_Merge_Group Modbus_App_Merge_Groups[MODBUS_APP_MERGE_GROUPS];
+#endif
+//! Waiting time of the requests sent to one slave, in ticks
+struct Modbus_App_Queue
+{
+  uint32_t Sent;        //!< Requests sent
+  uint32_t Wait_Sum;    //!< Sum of their waiting times
+  uint32_t Wait_Max;    //!< Longest waiting time
+};
+//! Waiting times per slave, 0 is broadcast
+static struct Modbus_App_Queue Modbus_App_Queues[248];
+//! Health of one slave
+struct Modbus_App_Health
+{
+  unsigned char State;    //!< enum Modbus_Health
+  unsigned char Failures; //!< Consecutive requests without answer
+  unsigned char Probing;  //!< 1 while its probe is in flight
+  uint32_t Probe;         //!< Tick of its next probe, while it is down
+};
+//! Health per slave, 0 (broadcast) is never down
+static struct Modbus_App_Health Modbus_App_Health[248];
+//! Slaves which are down
+static unsigned char Modbus_App_Down;
+//! Tick of the earliest probe, while some slave is down
+static uint32_t Modbus_App_Next_Probe;
+//! Destination of the probes read
+static uint16_t Modbus_App_Probe_Register;
+//! Retry policies per function code; the 0 is used for the rest of the codes
+static struct Modbus_Retry_Policy Modbus_App_Retry[24];
+//! Retry policy of the probes: one sending only
+static const struct Modbus_Retry_Policy Modbus_App_Probe_Retry = {1, 0, 0, 0};
+//! State of the pseudo-random generator of the backoff jitter
+static uint32_t Modbus_App_Seed;
+//! Slave of the last request taken from the Request FIFOs, the round-robin starts after it
+static unsigned char Modbus_App_Last_Slave;
 //! Modbus communication mode. Only Serial & CAN communication.
 enum Modbus_Comm_Modes Modbus_Comm_Mode;// = MODBUS_CANN; //WATCH OUT WITH THISS!!!!!!!!!!!!!!!!!
 
@@ -96,6 +150,26 @@ static unsigned char Modbus_App_Write_CallBack(void);
 static unsigned char Modbus_App_Mask_Write_CallBack(void);
 static unsigned char Modbus_App_Read_Write_M_Registers_CallBack(void);
 
+// Request handles and completion
+
+static void Modbus_App_New_Handle(struct Modbus_FIFO_Item *Request,
+                                  const struct Modbus_Request_Options *Options);
+static unsigned char Modbus_App_Next_Done(uint16_t Handle);
+static void Modbus_App_Complete(enum Modbus_Status Status, unsigned char Exception);
+static void Modbus_App_Finish(struct Modbus_FIFO_Item *Request, enum Modbus_Status Status,
+                              unsigned char Exception);
+#if MODBUS_APP_MERGE
+static void Modbus_App_Merge(struct Modbus_FIFO_s *FIFO);
+#endif
+static unsigned char Modbus_App_FIFO_Empty(void);
+static struct Modbus_FIFO_Item *Modbus_App_Select(struct Modbus_FIFO_s *FIFO, unsigned char *Waiting);
+static unsigned char Modbus_App_Before(struct Modbus_FIFO_Item *A, struct Modbus_FIFO_Item *B);
+static void Modbus_App_Account(struct Modbus_FIFO_Item *Request);
+static void Modbus_App_Health_Update(unsigned char Slave, enum Modbus_Status Status);
+static unsigned char Modbus_App_Probe(void);
+static const struct Modbus_Retry_Policy *Modbus_App_Policy(void);
+static uint32_t Modbus_App_Random(void);
+
 // To tune up output requests
 
 static void Modbus_App_Standard_Request(void);
@@ -104,6 +178,11 @@ static void Modbus_App_Write_M_Registers(void);
 static void Modbus_App_Mask_Write_Register(void);
 static void Modbus_App_Read_Write_M_Registers(void);
 
+// Packed bitmaps
+
+static void Modbus_App_Bits_Get(const uint32_t *Map, uint16_t First, uint16_t Count, unsigned char *Bytes);
+static void Modbus_App_Bits_Set(uint32_t *Map, uint16_t First, uint16_t Count, const unsigned char *Bytes);
+
 /**
 *   @defgroup App_Control Application Control for the Communication Mode: OSL/CAN
 *   @ingroup App
@@ -128,7 +207,10 @@ static void Modbus_App_Read_Write_M_Registers(void);
 void Modbus_Master_Init(enum Modbus_Comm_Modes Com_Mode, enum Baud Baudrate, 
                         unsigned char Attempts, enum Modbus_OSL_Modes OSL_Mode)
 { 
-  Modbus_FIFO_Init(&Modbus_FIFO_Tx);
+  unsigned char i;
+
+  for(i=0; i<MODBUS_APP_PRIORITIES; i++)
+    Modbus_FIFO_Init(&Modbus_FIFO_Tx[i]);
   Modbus_FIFO_E_Init(&Modbus_FIFO_Error);
   
   if (Com_Mode == CDEFAULT) 
@@ -177,10 +259,12 @@ unsigned char Modbus_Master_Communication (void)
 //! descarta la función por errores en los datos se pasa al estado ERROR para
 //! que se active el Flag de Reenvío. Si la respuesta recibida es de excepción
 //! se encola la petición y la respuesta en la cola FIFO de Errores y se pasa
-//! a IDLE para seguir con las peticiones.
+//! a IDLE para seguir con las peticiones. En ambos casos se llama al callback
+//! de finalización de la petición, si tiene.
 //! \sa Modbus_App_Read_Single_Bits_CallBack, Modbus_App_Read_Registers_CallBack
 //! \sa Modbus_App_Write_CallBack, Modbus_App_Mask_Write_CallBack
 //! \sa Modbus_OSL_Reset_Attempt, Modbus_FIFO_E_Enqueue, Modbus_CAN_Reset_Attempt
+//! \sa Modbus_App_Complete
 void Modbus_App_Manage_CallBack (void)
 {
   // Si la Respuesta es normal y de la función esperada se gestiona.
@@ -234,9 +318,11 @@ void Modbus_App_Manage_CallBack (void)
 
      if(Modbus_OSL_MainState_Get()!=MODBUS_OSL_ERROR)
      {
-       /* Respuesta Correcta, se pasa a la siguiente petición. */
+       /* Respuesta Correcta, se avisa al usuario y se pasa a la siguiente
+       petición. */
        Modbus_OSL_Reset_Attempt();
        Modbus_OSL_MainState_Set(MODBUS_OSL_IDLE);
+       Modbus_App_Complete(MODBUS_STATUS_OK, 0);
        //Debug_App_Msg_Ok++;
      }
   }
@@ -254,15 +340,11 @@ void Modbus_App_Manage_CallBack (void)
       if(Modbus_App_L_Msg==2 &&
         (Modbus_App_Msg[1]<=8 || Modbus_App_Msg[1]==10 || Modbus_App_Msg[1]!=11))
       {
-        /* Encolar Petición + Mensaje de Excepción. */
-        Modbus_App_Error_Msg.Request=Modbus_App_Actual_Req;
-        Modbus_App_Error_Msg.Response[0]=Modbus_App_Msg[0];
-        Modbus_App_Error_Msg.Response[1]=Modbus_App_Msg[1];
-        Modbus_FIFO_E_Enqueue(&Modbus_FIFO_Error,&Modbus_App_Error_Msg);
-
-        /* Resetear Nº Envíos; se pasa a la siguiente petición. */
+        /* Resetear Nº Envíos; se encola Petición + Mensaje de Excepción, se
+        avisa al usuario y se pasa a la siguiente petición. */
         Modbus_OSL_Reset_Attempt();
         Modbus_OSL_MainState_Set(MODBUS_OSL_IDLE);
+        Modbus_App_Complete(MODBUS_STATUS_EXCEPTION, Modbus_App_Msg[1]);
       }
     }
   }
@@ -270,32 +352,80 @@ void Modbus_App_Manage_CallBack (void)
 //! \brief Encola o Envía una petición.
 //! \ingroup App_Exchange
 //!
-//! Llamada por las funciones de Modbus de usuario, esta función envía una
-//! petición directamente si la cola de Peticiones está vacía y las comunicaciones
-//! libres y si no la encola para su posterior envío.
-//! return 1 La cola está llena y no se puede encolar
-//! return 0 Todo correcto
-//! \sa Modbus_FIFO_Enqueue, Modbus_App_Send
-unsigned char Modbus_App_Enqueue_Or_Send(void)
-{
-  if(Modbus_OSL_MainState_Get()==MODBUS_OSL_IDLE && Modbus_FIFO_Empty(&Modbus_FIFO_Tx))
+//! Llamada por las funciones de Modbus de usuario, esta función asigna a la
+//! petición su identificador y sus opciones (callback, prioridad, plazo y
+//! política de reintentos), la envía directamente si las colas de Peticiones
+//! están vacías y las comunicaciones libres y si no la encola en la cola de su
+//! prioridad para su posterior envío.
+//! \param *Request Petición formateada por la función de usuario
+//! \param *Options Opciones de la petición, 0 para las de por defecto
+//! \return Identificador de la petición
+//! \return 0 La cola está llena y no se puede encolar
+//! \sa Modbus_FIFO_Enqueue, Modbus_App_Send, Modbus_App_New_Handle
+uint16_t Modbus_App_Enqueue_Or_Send(struct Modbus_FIFO_Item *Request,
+                                    const struct Modbus_Request_Options *Options)
+{
+  Modbus_App_New_Handle(Request, Options);
+  MODBUS_TRACE_EVENT(MODBUS_TRACE_ENQUEUE,Request->Slave,Request->Function,
+                     Request->Handle,0,0,0);
+  if(Modbus_OSL_MainState_Get()==MODBUS_OSL_IDLE && Modbus_App_FIFO_Empty() &&
+     Modbus_App_Health[Request->Slave].State!=MODBUS_SLAVE_DOWN &&
+     Modbus_OSL_Slave_Available(Request->Slave))
   {
-    Modbus_App_Actual_Req=Modbus_App_Request;
+    Modbus_App_Actual_Req=*Request;
+    MODBUS_TRACE_EVENT(MODBUS_TRACE_DEQUEUE,Modbus_App_Actual_Req.Slave,Modbus_App_Actual_Req.Function,
+                       Modbus_App_Actual_Req.Handle,0,0,0);
+    Modbus_App_Account(&Modbus_App_Actual_Req);
     Modbus_App_Send();
   }
   else
   {
-    if(Modbus_FIFO_Enqueue(&Modbus_FIFO_Tx,&Modbus_App_Request))
-      return 1;
+    if(Modbus_FIFO_Enqueue(&Modbus_FIFO_Tx[Request->Priority],Request))
+      return 0;
+  }
+  return Request->Handle;
+}
+//! \brief Calcula la longitud de la respuesta esperada.
+//! \ingroup App_Exchange
+//!
+//! A partir de la petición ya formateada en _Modbus_App_Req_pdu_ calcula la
+//! longitud del PDU de la respuesta normal (sin Nº de Slave ni CRC), para que
+//! OSL ajuste el Timeout de Respuesta al tiempo de transmisión de la misma.
+//! \return Longitud del PDU de la respuesta esperada
+//! \sa Modbus_App_Send, Modbus_OSL_Output
+static uint16_t Modbus_App_Rsp_Length(void)
+{
+  uint16_t Quantity;
+
+  // Cantidad de Bits/Registros a leer en las funciones de lectura.
+  Quantity=(Modbus_App_Req_pdu[3]<<8) | Modbus_App_Req_pdu[4];
+  switch(Modbus_App_Actual_Req.Function)
+  {
+      case 1:
+      case 2:
+        // Función + Nº de bytes + 8 Bits por byte.
+        return 2+(Quantity+7)/8;
+      case 3:
+      case 4:
+      case 23:
+        // Función + Nº de bytes + 2 bytes por Registro.
+        return 2+Quantity*2;
+      case 22:
+        // Eco de la petición.
+        return 7;
+      default:
+        // Funciones 5, 6, 15 y 16: Función + Dirección + Valor/Cantidad.
+        return 5;
   }
-  return 0;
 }
+
 //! \brief Envía una petición.
 //! \ingroup App_Exchange
 //!
 //! Envía la petición almacenada en _Modbus_App_Actual_Req_; utiliza para dar
 //! formato al mensaje una función que depende del tipo de petición y para
-//! enviarla llama a _Modbus_OSL_Output_.
+//! enviarla llama a _Modbus_OSL_Output_ junto con la longitud de la respuesta
+//! esperada.
 //! \sa struct Modbus_FIFO_Item, Modbus_OSL_Output, Modbus_CAN_Fit_Output, Modbus_App_Standard_Request
 //! \sa Modbus_App_Write_M_Coils, Modbus_App_Write_M_Registers
 //! \sa Modbus_App_Mask_Write_Register, Modbus_App_Read_Write_M_Registers
@@ -331,7 +461,8 @@ void Modbus_App_Send(void)
         Modbus_Fatal_Error(20);
         break;
   }
-  Modbus_OSL_Output (Modbus_App_Req_pdu,Modbus_App_Actual_Req.Slave,Modbus_App_L_Req_pdu);
+  Modbus_OSL_Output (Modbus_App_Req_pdu,Modbus_App_Actual_Req.Slave,Modbus_App_L_Req_pdu,
+                     Modbus_App_Rsp_Length());
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -352,10 +483,13 @@ void Modbus_App_Send(void)
 */
 unsigned char Modbus_Master_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char attempts)///
 {
+          unsigned char i;
+
           if(attempts >= 1)
           {            
               Modbus_Comm_Mode = MODBUS_CAN_MODE;  
-              Modbus_FIFO_Init(&Modbus_FIFO_Tx);
+              for(i = 0; i < MODBUS_APP_PRIORITIES; i++)
+                Modbus_FIFO_Init(&Modbus_FIFO_Tx[i]);
               Modbus_FIFO_E_Init(&Modbus_FIFO_Error);
               Modbus_CAN_Init(bit_rate, attempts);  
               return 1;
@@ -396,10 +530,11 @@ unsigned char Modbus_Master_Communication (void)///
 *   from the expected Slave. If the request was a read, the data is stored in the destination vector.
 *   If the function is discarded because of a data error, the status is changed to ERROR to activate the
 *   forward flag. If the answer is an exception, the request and its answer are enqueued in the Error FIFO, after that,
-*   the status is switched to IDLE to continue with the rest of petitions.
+*   the status is switched to IDLE to continue with the rest of petitions. In both cases the completion callback of the
+*   request, if any, is called.
 *   @sa Modbus_App_Read_Single_Bits_CallBack, Modbus_App_Read_Registers_CallBack
 *   @sa Modbus_App_Write_CallBack, Modbus_App_Mask_Write_CallBack
-*   @sa Modbus_CAN_Reset_Attempt, Modbus_FIFO_E_Enqueue, Modbus_OSL_Reset_Attempt
+*   @sa Modbus_CAN_Reset_Attempt, Modbus_FIFO_E_Enqueue, Modbus_OSL_Reset_Attempt, Modbus_App_Complete
 */
 void Modbus_App_Manage_CallBack (void)///
 {
@@ -454,9 +589,10 @@ void Modbus_App_Manage_CallBack (void)///
 
      if(Modbus_GetMainState() != MODBUS_ERROR)
      {
-       /* Correct answer, next request */
+       /* Correct answer, the user is told and next request */
        Modbus_CAN_Reset_Attempt();
        Modbus_SetMainState(MODBUS_IDLE);       
+       Modbus_App_Complete(MODBUS_STATUS_OK, 0);
      }
   }
   // Exception or unexpected function
@@ -472,15 +608,11 @@ void Modbus_App_Manage_CallBack (void)///
       if(Modbus_App_L_Msg==2 &&
         (Modbus_App_Msg[1]<=8 || Modbus_App_Msg[1]==10 || Modbus_App_Msg[1]!=11))
       {
-    	  /*Request and exception message are added to the ERROR queue*/
-        Modbus_App_Error_Msg.Request=Modbus_App_Actual_Req;
-        Modbus_App_Error_Msg.Response[0]=Modbus_App_Msg[0];
-        Modbus_App_Error_Msg.Response[1]=Modbus_App_Msg[1];
-        Modbus_FIFO_E_Enqueue(&Modbus_FIFO_Error,&Modbus_App_Error_Msg);
-
-        /*Number of deliveries reseted; next request can be handle*/
+        /*Number of deliveries reseted; request and exception message are added to the ERROR queue,
+        the user is told and next request can be handle*/
         Modbus_CAN_Reset_Attempt();
         Modbus_SetMainState(MODBUS_IDLE);
+        Modbus_App_Complete(MODBUS_STATUS_EXCEPTION, Modbus_App_Msg[1]);
       }
     }
   }
@@ -490,25 +622,36 @@ void Modbus_App_Manage_CallBack (void)///
 *   @brief Enqueue or Send a request.
 *   @ingroup App_Exchange
 *
-*   This function is called from user Modbus functions. This one sends a request directly if the
-*   Request FIFO is empty and the communications are not occupied, otherwise, the petition is enqueued to send it later.
-*   return 1 The Request FIFO is full and the petition cannot be enqueued.
-*   return 0 Everything ok
-*   @sa Modbus_FIFO_Enqueue, Modbus_App_Send
+*   This function is called from user Modbus functions. It gives the request its handle and its options (callback, priority,
+*   deadline and retry policy). Then it sends the request directly if the Request FIFOs are empty and the slave has no request
+*   in flight (a transaction is available for it), otherwise, the petition is enqueued in the FIFO of its priority to send it later.
+*   @param *Request Request formatted by the user function
+*   @param *Options Options of the request, 0 for the default ones
+*   @return Handle of the request
+*   @return 0 The Request FIFO is full and the petition cannot be enqueued.
+*   @sa Modbus_FIFO_Enqueue, Modbus_App_Send, Modbus_CAN_Transaction_Available, Modbus_App_New_Handle
 */
-unsigned char Modbus_App_Enqueue_Or_Send(void)///
+uint16_t Modbus_App_Enqueue_Or_Send(struct Modbus_FIFO_Item *Request,
+                                    const struct Modbus_Request_Options *Options)
 {
-  if(Modbus_GetMainState() == MODBUS_IDLE && Modbus_FIFO_Empty(&Modbus_FIFO_Tx))
+  Modbus_App_New_Handle(Request, Options);
+  MODBUS_TRACE_EVENT(MODBUS_TRACE_ENQUEUE, Request->Slave, Request->Function,
+                     Request->Handle, 0, 0, 0);
+  if(Modbus_App_FIFO_Empty() && Modbus_CAN_Transaction_Available(Request->Slave) &&
+     Modbus_App_Health[Request->Slave].State != MODBUS_SLAVE_DOWN)
   {
-    Modbus_App_Actual_Req = Modbus_App_Request;
+    Modbus_App_Actual_Req = *Request;
+    MODBUS_TRACE_EVENT(MODBUS_TRACE_DEQUEUE, Modbus_App_Actual_Req.Slave, Modbus_App_Actual_Req.Function,
+                       Modbus_App_Actual_Req.Handle, 0, 0, 0);
+    Modbus_App_Account(&Modbus_App_Actual_Req);
     Modbus_App_Send();
   }
   else
   {
-    if(Modbus_FIFO_Enqueue(&Modbus_FIFO_Tx,&Modbus_App_Request))
-      return 1;
+    if(Modbus_FIFO_Enqueue(&Modbus_FIFO_Tx[Request->Priority],Request))
+      return 0;
   }
-  return 0;
+  return Request->Handle;
 }
 
 /**
@@ -602,297 +745,1188 @@ unsigned char Modbus_Get_Error (struct Modbus_FIFO_E_Item *Error)
 }
 
 /**
-*   @brief No answer; It enqueues the request in the Error FIFO.
-*   @ingroup App_Control 
+*   @brief Set the completion callback of the next request.
+*   @ingroup App_Control
 *
-*   If this function is activated means that the maximum number of sendings of one function was exceeded without achieving any answer.
-*   Therefore, the proper request is enqueued as an exception message, the difference is that in the "answer" field of the message is
-*   stored [0,0].
-*   @sa Modbus_FIFO_E_Enqueue, Modbus_OSL_Repeat_Request, Modbus_CAN_Repeat_Request
+*   The callback is given to the next request which reaches the queue (it is not taken by a call rejected because of wrong
+*   parameters). It is called from _Modbus_Master_Communication_ when the request finishes: with MODBUS_STATUS_OK once the read
+*   data is in the Response vector, with MODBUS_STATUS_EXCEPTION and the exception code, or with MODBUS_STATUS_TIMEOUT or
+*   MODBUS_STATUS_CRC when all the attempts failed. The errors are still enqueued in the Error FIFO too. Broadcast requests
+*   have no answer, so their callback is never called.
+*   @param CallBack Function to call, 0 for none
+*   @warning It is kept for the user functions without _Ex_; the option is shared by all the callers until a request takes
+*   it, so it is not safe when requests are also made from interrupts. Give it in the call instead, in the Options of the
+*   _Ex_ user functions.
+*   @sa Modbus_Last_Handle, Modbus_App_Complete, enum Modbus_Status, struct Modbus_Request_Options
 */
-void Modbus_App_No_Response(void)
+void Modbus_Next_CallBack (void (*CallBack)(uint16_t Handle, enum Modbus_Status Status,
+                                            unsigned char Exception))
 {
-  Modbus_App_Error_Msg.Request=Modbus_App_Actual_Req;  
-  Modbus_App_Error_Msg.Response[0]=0;
-  Modbus_App_Error_Msg.Response[1]=0;
-  Modbus_FIFO_E_Enqueue(&Modbus_FIFO_Error,&Modbus_App_Error_Msg);
+  Modbus_App_Next.CallBack = CallBack;
 }
 
 /**
-*   @defgroup App_Exchange Interconnection between OSL/CAN Layer and App Layer
-*   @ingroup App
-*   @brief Functions to exchange data between App and OSL/CAN module.
+*   @brief Get the handle of the last request.
+*   @ingroup App_Control
 *
-*   It includes functions to exchange information data between the CAN/OSL and App module,
-*   allowing APP to send/receive messages through CAN/OSL.
+*   The handle identifies the request in its completion callback.
+*   @return Handle of the last request accepted by a user function without _Ex_, or 0 if it was rejected because the Request
+*   FIFO was full
+*   @warning Another request made from an interrupt may change it before it is read; the _Ex_ user functions return the handle
+*   of their own request instead.
+*   @sa Modbus_Next_CallBack
 */
+uint16_t Modbus_Last_Handle (void)
+{
+  return Modbus_App_Last_Handle;
+}
 
 /**
-*   @brief It gets and sends a petition from the request FIFO if it is not empty.
-*   @ingroup App_Exchange
+*   @brief Set the priority and the deadline of the next request.
+*   @ingroup App_Control
 *
-*   @return 0 It has sent a request from the queue
-*   @return 1 Empty queue, there is no requests to be sent
-*   @sa Modbus_FIFO_Dequeue, Modbus_App_Send
+*   Like the callback, they are given to the next request which reaches the queue; by default a request has normal
+*   priority and no deadline. The queued requests of a higher priority are always sent first. Among the requests of the
+*   same priority, the one with the earliest deadline is sent first, but never before an older request to the same slave;
+*   the requests without deadline are sent round-robin among the slaves. If the deadline expires before the request is sent, it is
+*   dropped: it is enqueued in the Error FIFO with [0,0] as answer and its callback is called with MODBUS_STATUS_EXPIRED.
+*   @param Priority Priority of the next request
+*   @param Deadline Milliseconds from the call of the user function to send it, 0 for none; longer deadlines than
+*   MODBUS_APP_DEADLINE_MAX (about 29.8 hours in OSL) are cut down to it
+*   @warning As _Modbus_Next_CallBack_, it is not safe when requests are also made from interrupts.
+*   @sa Modbus_Next_CallBack, Modbus_App_FIFOSend, struct Modbus_Request_Options
 */
-unsigned char Modbus_App_FIFOSend(void)
+void Modbus_Next_Priority (enum Modbus_Priority Priority, uint32_t Deadline)
 {
-  // La función devuelve 1 si ha desencolado y entra en el "if"
-  if (Modbus_FIFO_Dequeue(&Modbus_FIFO_Tx,&Modbus_App_Actual_Req))
-  {
-    Modbus_App_Send();  
+  Modbus_App_Next.Priority = Priority;
+  Modbus_App_Next.Deadline = Deadline;
+}
+
+/**
+*   @brief Get the queue statistics of one slave.
+*   @ingroup App_Control
+*
+*   The depth is counted at the moment in the Request FIFOs; the waiting times are the ones of the requests sent since
+*   the last _Modbus_Reset_Queue_Stats_, from the call of the user function to the first sending.
+*   @param Slave Slave number, 0 for broadcast
+*   @param *Stats Structure where the statistics are stored
+*   @return 1 The statistics were stored
+*   @return 0 Wrong slave number
+*   @sa Modbus_Reset_Queue_Stats, struct Modbus_Queue_Stats
+*/
+unsigned char Modbus_Get_Queue_Stats (unsigned char Slave, struct Modbus_Queue_Stats *Stats)
+{
+  struct Modbus_App_Queue *Queue;
+  struct Modbus_FIFO_Item *Item;
+  uint16_t i;
+  unsigned char p;
+
+  if(Slave > 247)
     return 0;
-  }
+  Queue = &Modbus_App_Queues[Slave];
+
+  Stats->Depth = 0;
+  for(p=0; p<MODBUS_APP_PRIORITIES; p++)
+    for(i=0; (Item = Modbus_FIFO_Peek_At(&Modbus_FIFO_Tx[p], i)) != 0; i++)
+      if(Item->Slave == Slave)
+        Stats->Depth++;
+  Stats->Sent = Queue->Sent;
+  Stats->Wait_Avg = Queue->Sent ? (Queue->Wait_Sum / Queue->Sent) * (1000000UL / MODBUS_TIMER_TICK_HZ) : 0;
+  Stats->Wait_Max = Queue->Wait_Max * (1000000UL / MODBUS_TIMER_TICK_HZ);
   return 1;
 }
 
-/**   
-*   @brief It receives a char from another module.
-*   @ingroup App_Exchange
+/**
+*   @brief Clear the queue statistics of all the slaves.
+*   @ingroup App_Control
 *
-*   It allows to store chars in some position of the vector _Modbus_App_Msg_; It is used in _Modbus_OSL_RTU_to_App(which also uses
-*   _Modbus_OSL_RTU_Char_Get_) and in _Modbus_CAN_to_App to transfer messages from RTU to App through OSL layer without connecting them;
-*   Also to transfer from CAN to App.
-*   @param Msg Char value to be stored in _Modbus_App_Msg_
-*   @param i Vector index where to store the char
-*   @sa Modbus_App_Msg, Modbus_OSL_RTU_to_App, Modbus_OSL_RTU_Char_Get
+*   @sa Modbus_Get_Queue_Stats
 */
-void Modbus_App_Receive_Char (unsigned char Msg, unsigned char i)
+void Modbus_Reset_Queue_Stats (void)
 {
-    Modbus_App_Msg[i]=Msg;
-  
+  unsigned char i;
+
+  for(i=0; i<248; i++)
+  {
+    Modbus_App_Queues[i].Sent = 0;
+    Modbus_App_Queues[i].Wait_Sum = 0;
+    Modbus_App_Queues[i].Wait_Max = 0;
+  }
 }
 
-/** 
-*   @brief It receives the message length.
-*   @ingroup App_Exchange
+/**
+*   @brief Get the health of one slave.
+*   @ingroup App_Control
 *
-*   It is used in _Modbus_OSL_RTU_to_App_ and _Modbus_CAN_to_App_ to send from OSL/CAN the length 
-*   of the correct incoming message to App.
-*   @param Index Length message value
-*   @sa Modbus_App_Msg, Modbus_App_L_Msg, Modbus_OSL_RTU_to_App
+*   Every slave starts up. While a slave is down, its requests are not sent: they are enqueued in the Error FIFO with
+*   [0,0] as answer and their callbacks are called with MODBUS_STATUS_DOWN. A probe is sent to it every
+*   MODBUS_APP_PROBE_PERIOD milliseconds and the first answer puts it up again.
+*   @param Slave Slave number
+*   @return Health of the slave, MODBUS_SLAVE_UP for broadcast or a wrong number
+*   @sa enum Modbus_Health
 */
-void Modbus_App_L_Msg_Set(unsigned char Index)
+enum Modbus_Health Modbus_Slave_Health (unsigned char Slave)
 {
-  Modbus_App_L_Msg=Index;
+  if(Slave > 247)
+    return MODBUS_SLAVE_UP;
+  return (enum Modbus_Health)Modbus_App_Health[Slave].State;
 }
 
 /**
-*   @defgroup App_Modbus Modbus Functions
-*   @ingroup App
-*   @brief Modbus user functions to send requests in addition with internal functions from App Module to give the proper format to the requests.
-*   Also, it manages the responses.
-*   
-*   For each public Modbus function, it exists an user one to make the request; Also, other functions to give format to the request 
-*   before the sending are grouped here. Moreover, it is implemented the proper functions to understand the received responses 
-*   from the Slaves and to store the received values of the Read requests.
+*   @brief Set the retry policy of a function code.
+*   @ingroup App_Control
+*
+*   By default every function is sent up to the attempts given to _Modbus_Master_Init_ and resent at once. A policy with
+*   one attempt disables the retries, e.g. for writes which must not be done twice. With backoff, the resend waits on
+*   the Timer Wheel, doubling the wait on every resend, and meanwhile the requests to other slaves are sent.
+*   @param Function Function code, 0 for all of them
+*   @param *Policy Policy, it is copied
+*   @sa Modbus_Next_Retry_Policy, struct Modbus_Retry_Policy
 */
+void Modbus_Set_Retry_Policy (unsigned char Function, const struct Modbus_Retry_Policy *Policy)
+{
+  unsigned char i;
+
+  if(Function == 0)
+  {
+    for(i=0; i<24; i++)
+      Modbus_App_Retry[i] = *Policy;
+  }
+  else if(Function < 24)
+    Modbus_App_Retry[Function] = *Policy;
+}
 
 /**
-*   @defgroup App_User User Functions
-*   @ingroup App_Modbus
-*   @brief User functions to make the requests.
-*
-*   Public Modbus functions to Read/Write the I/O.
-*   It checks the data correctness of the request and it is enqueued or sent in 
-*   _Modbus_App_Enqueue_Or_Send_. It returns 0 if all is correct, or 1 if either there was a wrong parameter or 
-*   the request FIFO was filled. It has to be taken into account that the Read/Write multiple I/O functions have a limit number of I/O
-*   each one. Furthermore, the addresses are from 0 to 65.535; then if the address is near this number it can exceed the maximum and
-*   the request would not be done.
-*   >_Example_: For the address 65.000, it can not be done a Read of 600 Coils.
-*   Additionally, it has to be heeded that the maximum number of slaves is 247 in OSL/CAN.
+*   @brief Set the retry policy of the next request.
+*   @ingroup App_Control
 *
-*   @warning If the response of one of these functions is 1, the request was not done.
+*   Like the callback, it is given to the next request which reaches the queue, instead of the policy of its function.
+*   @param *Policy Policy, it is not copied so it must exist until the request finishes; 0 for the one of its function
+*   @warning As _Modbus_Next_CallBack_, it is not safe when requests are also made from interrupts.
+*   @sa Modbus_Set_Retry_Policy, Modbus_Next_CallBack, struct Modbus_Request_Options
 */
-//! @{
+void Modbus_Next_Retry_Policy (const struct Modbus_Retry_Policy *Policy)
+{
+  Modbus_App_Next.Retry = Policy;
+}
 
 /**
-*   @brief Read multiple Coils.
+*   @brief Maximum number of sendings of the actual request.
+*   @ingroup App_Exchange
 *
-*   It reads from 1 to 2000 continuous Coils from one Slave. The read is stored in the vector pointed by *Response.
-*   @param Slave Slave number which it is requested the data.
-*   @param Adress Initial address of the read
-*   @param Coils Coils amount to be read
-*   @param *Response Pointer to where the read will be stored
-*   @return 0 Correct request 
-*   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   @param Default Attempts given to the OSL/CAN layer, used if the policy does not set them
+*   @return Number of sendings before giving up
+*   @sa Modbus_OSL_Repeat_Request, Modbus_CAN_Repeat_Request
 */
-unsigned char Modbus_Read_Coils (unsigned char Slave, uint16_t Adress, 
-                                 uint16_t Coils, unsigned char *Response)
-{ 
-  if(Slave>247 || Slave==0 || Coils>2000  || Coils==0 || ((long)Adress+(long)Coils)>65535)
-      return 1;
-  else
-  { 
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=1;
-    Modbus_App_Request.Data[0].UI2=Adress;
-    Modbus_App_Request.Data[1].UI2=Coils;
-    Modbus_App_Request.Data[2].PC=Response;
-      
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
-    
-    return 0;
-  } 
+unsigned char Modbus_App_Max_Attempts (unsigned char Default)
+{
+  const struct Modbus_Retry_Policy *Policy = Modbus_App_Policy();
+
+  return Policy->Attempts ? Policy->Attempts : Default;
 }
 
 /**
-*   @brief Read multiple Discrete Inputs.
-*   
-*   It reads from 1 to 2000 continuous Discrete Inputs from one Slave. The read is stored in the vector pointed by *Response.
-*   @param Slave Slave number which it is requested the data.
-*   @param Adress Initial address of the read
-*   @param Inputs Amount of Discrete Inputs to be read
-*   @param *Response Pointer to where the read will be stored
-*   @return 0 Correct request
-*   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   @brief Wait before a resend of the actual request.
+*   @ingroup App_Exchange
+*
+*   The backoff of the policy is doubled on every resend up to its limit, and then a random part of it, given by the
+*   jitter, is taken away so the slaves which failed together are not retried together.
+*   @param Attempt Number of the sending which is going to be done, from 2
+*   @return Ticks of the Timer Wheel to wait, 0 to resend at once
+*   @sa Modbus_OSL_Repeat_Request, Modbus_CAN_Repeat_Request
 */
-unsigned char Modbus_Read_D_Inputs (unsigned char Slave, uint16_t Adress, 
-                                    uint16_t Inputs, unsigned char *Response)
-{ 
-  if(Slave>247 || Slave==0 || Inputs>2000 || Inputs==0 || ((long)Adress+(long)Inputs)>65535)
-      return 1;
-  else
-  { 
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=2;
-    Modbus_App_Request.Data[0].UI2=Adress;
-    Modbus_App_Request.Data[1].UI2=Inputs;
-    Modbus_App_Request.Data[2].PC=Response;
-  
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
-    
+uint32_t Modbus_App_Backoff (unsigned char Attempt)
+{
+  const struct Modbus_Retry_Policy *Policy = Modbus_App_Policy();
+  uint32_t Backoff, Random;
+  unsigned char i;
+
+  if(!Policy->Backoff || Attempt < 2)
     return 0;
-  } 
+  Backoff = Policy->Backoff;
+  for(i=2; i<Attempt && Backoff < MODBUS_TIMER_MAX_TICKS; i++)
+    Backoff <<= 1;
+  if(Policy->Backoff_Max && Backoff > Policy->Backoff_Max)
+    Backoff = Policy->Backoff_Max;
+  if(Backoff > MODBUS_TIMER_MAX_TICKS / (MODBUS_TIMER_TICK_HZ / 1000))
+    Backoff = MODBUS_TIMER_MAX_TICKS / (MODBUS_TIMER_TICK_HZ / 1000);
+  Backoff *= MODBUS_TIMER_TICK_HZ / 1000;
+
+  if(Policy->Jitter)
+  {
+    Random = (Backoff * (Policy->Jitter > 100 ? 100 : Policy->Jitter)) / 100;
+    Backoff -= Modbus_App_Random() % (Random + 1);
+  }
+  return Backoff;
 }
 
 /**
-*   @brief Read multiple Holding Registers.
+*   @brief Retry policy of the actual request.
+*   @ingroup App_Exchange
 *
-*   It reads from 1 to 125 continuous registers from one slave. The read is stored in the vector pointed by *Response.
-*   @param Slave Slave number which it is requested the data.
-*   @param Adress Initial address of the read
-*   @param Registers Amount of Holding Registers to be read
-*   @param *Response Pointer to where the read will be stored
-*   @return 0 Correct request
-*   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   @return The policy given to the request or, if none, the one of its function
+*   @sa Modbus_Set_Retry_Policy, Modbus_Next_Retry_Policy
 */
-unsigned char Modbus_Read_H_Registers (unsigned char Slave, uint16_t Adress,
-                                       uint16_t Registers, uint16_t *Response)
-{ 
-  if(Slave>247 || Slave==0 || Registers>125 || Registers==0 || ((long)Adress+(long)Registers)>65535)
-      return 1;
-  else
-  { 
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=3;
-    Modbus_App_Request.Data[0].UI2=Adress;
-    Modbus_App_Request.Data[1].UI2=Registers;
-    Modbus_App_Request.Data[2].PUI2=Response;
-      
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
-    
-    return 0;
-  } 
+static const struct Modbus_Retry_Policy *Modbus_App_Policy(void)
+{
+  if(Modbus_App_Actual_Req.Retry)
+    return Modbus_App_Actual_Req.Retry;
+  if(Modbus_App_Actual_Req.Function < 24)
+    return &Modbus_App_Retry[Modbus_App_Actual_Req.Function];
+  return &Modbus_App_Retry[0];
 }
+
 /**
-*   @brief Read multiple Input Registers.
+*   @brief Pseudo-random number for the backoff jitter (xorshift).
+*   @ingroup App_Exchange
 *
-*   It reads from 1 to 125 continuous registers from one slave. The read is stored in the vector pointed by *Response.
-*   @param Slave Slave number which it is requested the data.
-*   @param Adress Initial address of the read
-*   @param Registers Amount of Input Registers to be read
-*   @param *Response Pointer to where the read will be stored
-*   @return 0 Correct request
-*   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   It is seeded with the tick of the first call.
+*   @return Random number
 */
-unsigned char Modbus_Read_I_Registers (unsigned char Slave, uint16_t Adress,
-                                       uint16_t Registers, uint16_t *Response)
-{ 
-  if(Slave>247 || Slave==0 || Registers>125 || Registers==0 || ((long)Adress+(long)Registers)>65535)
-      return 1;
-  else
-  { 
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=4;
-    Modbus_App_Request.Data[0].UI2=Adress;
-    Modbus_App_Request.Data[1].UI2=Registers;
-    Modbus_App_Request.Data[2].PUI2=Response;
-      
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
-    
-    return 0;
-  } 
+static uint32_t Modbus_App_Random(void)
+{
+  if(!Modbus_App_Seed)
+    Modbus_App_Seed = Modbus_Timer_Now() | 1;
+  Modbus_App_Seed ^= Modbus_App_Seed << 13;
+  Modbus_App_Seed ^= Modbus_App_Seed >> 17;
+  Modbus_App_Seed ^= Modbus_App_Seed << 5;
+  return Modbus_App_Seed;
 }
 
 /**
-*   @brief Write one Coil.
+*   @brief It gives the new request its handle and its options.
+*   @ingroup App_Exchange
 *
-*   It set to 0 or 1 one coil in the concrete address.
-*   @param Slave Slave number which it is requested the data.
-*   @param Adress Address to write
-*   @param Coil Coil value (If it is not 0, it will be set to 1)
-*   @return 0 Correct request
-*   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   The handles are consecutive and skip 0; the interrupts are masked while one is taken, so a request made from an
+*   interrupt never gets the same handle. Without options the request has no callback, normal priority, no deadline and
+*   the retry policy of its function. The deadline is stored as a tick of the Timer Wheel, never 0; it is cut down to
+*   MODBUS_APP_DEADLINE_MAX, the window where two ticks can be compared, but it is not armed in the wheel so its range
+*   does not limit it.
+*   @param *Request Request to complete
+*   @param *Options Its options, 0 for the default ones
+*   @sa Modbus_App_Enqueue_Or_Send, struct Modbus_Request_Options
 */
-unsigned char Modbus_Write_Coil (unsigned char Slave, uint16_t Adress,unsigned char Coil)
-{ 
-  if(Slave>247)   
-    return 1;
-  else      
+static void Modbus_App_New_Handle(struct Modbus_FIFO_Item *Request,
+                                  const struct Modbus_Request_Options *Options)
+{
+  tBoolean Masked;
+  uint32_t Deadline;
+
+  Masked = IntMasterDisable();
+  if(++Modbus_App_Handle == 0)
+    Modbus_App_Handle = 1;
+  Request->Handle = Modbus_App_Handle;
+  if(!Masked)
+    IntMasterEnable();
+
+  Request->CallBack = 0;
+  Request->Priority = MODBUS_PRIORITY_NORMAL;
+  Request->Retry = 0;
+  Deadline = 0;
+  if(Options)
   {
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=5;
-    Modbus_App_Request.Data[0].UI2=Adress;
-    
-    // Se envia 0 o 0xFF00
-    if(Coil==0)
-      Modbus_App_Request.Data[1].UI2=0;
-    else
-      Modbus_App_Request.Data[1].UI2=65280; 
-    
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
-    
-    return 0;
+    Request->CallBack = Options->CallBack;
+    Request->Priority = Options->Priority;
+    if(Request->Priority > MODBUS_PRIORITY_LOW)
+      Request->Priority = MODBUS_PRIORITY_LOW;
+    Request->Retry = Options->Retry;
+    Deadline = Options->Deadline;
+    if(Deadline > MODBUS_APP_DEADLINE_MAX)
+      Deadline = MODBUS_APP_DEADLINE_MAX;
+  }
+
+  Request->Queued = Modbus_Timer_Now();
+  Request->Deadline = 0;
+  if(Deadline)
+  {
+    Request->Deadline = Request->Queued + Deadline * (MODBUS_TIMER_TICK_HZ / 1000);
+    if(Request->Deadline == 0)
+      Request->Deadline = 1;
   }
 }
 
-/*
-*   @brief Write one I/O Register.
+/**
+*   @brief It finishes a call of a user function without _Ex_.
+*   @ingroup App_Exchange
 *
-*   The value is written in the register of the indicated address.
-*   @param Slave Slave number which it is requested the data.
-*   @param Adress Address to write
-*   @param Register Value to be written in the Register
+*   The handle is kept for _Modbus_Last_Handle_ and, if the request was accepted, the options set by _Modbus_Next_CallBack_,
+*   _Modbus_Next_Priority_ and _Modbus_Next_Retry_Policy_ are used only once. A request rejected because the Request FIFO
+*   was full does not take them.
+*   @param Handle Handle returned by the _Ex_ user function, 0 if it was rejected
 *   @return 0 Correct request
 *   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   @sa Modbus_Last_Handle, Modbus_App_Next
 */
-unsigned char Modbus_Write_Register (unsigned char Slave, uint16_t Adress, uint16_t Register)
-{ 
-  if(Slave>247)   
+static unsigned char Modbus_App_Next_Done(uint16_t Handle)
+{
+  Modbus_App_Last_Handle = Handle;
+  if(Handle == 0)
     return 1;
-  else      
-  {
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=6;
-    Modbus_App_Request.Data[0].UI2=Adress;
-    Modbus_App_Request.Data[1].UI2=Register;
-      
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
+  Modbus_App_Next.CallBack = 0;
+  Modbus_App_Next.Priority = MODBUS_PRIORITY_NORMAL;
+  Modbus_App_Next.Deadline = 0;
+  Modbus_App_Next.Retry = 0;
+  return 0;
+}
+
+/**
+*   @brief It finishes the actual request.
+*   @ingroup App_Exchange
+*
+*   The health of the slave is updated first; a probe finishes there. If the actual request is a merged read, every
+*   request of its group is finished: on success each one gets its registers copied from the group buffer, and then the
+*   group is freed.
+*   @param Status How the request finished
+*   @param Exception Exception code, 0 if it is not an exception
+*   @sa Modbus_App_Actual_Req, Modbus_App_Finish, Modbus_App_Merge, Modbus_App_Health_Update
+*/
+static void Modbus_App_Complete(enum Modbus_Status Status, unsigned char Exception)
+{
+#if MODBUS_APP_MERGE
+  struct Modbus_App_Merge_Group *Group;
+  struct Modbus_FIFO_Item *Request;
+  uint16_t Low, i, j;
+#endif
+
+  Modbus_App_Health_Update(Modbus_App_Actual_Req.Slave, Status);
+  if(Modbus_App_Actual_Req.Handle == 0 && Modbus_App_Actual_Req.Data[2].PUI2 == &Modbus_App_Probe_Register)
+    return;
+
+#if MODBUS_APP_MERGE
+  // Merged requests are the only other ones with handle 0
+  if(Modbus_App_Actual_Req.Handle == 0 && Modbus_App_Actual_Req.CallBack == 0 &&
+     (Modbus_App_Actual_Req.Function == 3 || Modbus_App_Actual_Req.Function == 4))
+  {
+    // A callback can send a new request, so the actual one is not read after the first call
+    Group = &Modbus_App_Merge_Groups[Modbus_App_Actual_Req.Data[3].UC];
+    Low = Modbus_App_Actual_Req.Data[0].UI2;
+    for(i=0; i<Group->Items; i++)
+    {
+      Request = &Group->Request[i];
+      if(Status == MODBUS_STATUS_OK)
+        for(j=0; j<Request->Data[1].UI2; j++)
+          Request->Data[2].PUI2[j] = Group->Buffer[Request->Data[0].UI2 - Low + j];
+      Modbus_App_Finish(Request, Status, Exception);
+    }
+    Group->Items = 0;
+    return;
+  }
+#endif
+  Modbus_App_Finish(&Modbus_App_Actual_Req, Status, Exception);
+}
+
+/**
+*   @brief It enqueues the error of a request, if any, and calls its completion callback.
+*   @ingroup App_Exchange
+*
+*   An exception is stored in the Error FIFO next to the request who provoked it; a request not replied is stored with
+*   [0,0] in the "answer" field. The outcome is counted in the statistics of the slave and the function code.
+*   @param *Request Finished request
+*   @param Status How the request finished
+*   @param Exception Exception code, 0 if it is not an exception
+*   @sa Modbus_FIFO_E_Enqueue, Modbus_Next_CallBack, Modbus_Stats_Finish
+*/
+static void Modbus_App_Finish(struct Modbus_FIFO_Item *Request, enum Modbus_Status Status,
+                              unsigned char Exception)
+{
+#if MODBUS_TRACE
+  // The callback can send a new request over the actual one
+  unsigned char Slave = Request->Slave, Function = Request->Function;
+  uint16_t Handle = Request->Handle;
+#endif
+
+  if(Status != MODBUS_STATUS_OK)
+  {
+    Modbus_App_Error_Msg.Request=*Request;
+    if(Status == MODBUS_STATUS_EXCEPTION)
+      Modbus_App_Error_Msg.Response[0]=Request->Function | 128;
+    else
+      Modbus_App_Error_Msg.Response[0]=0;
+    Modbus_App_Error_Msg.Response[1]=Exception;
+    Modbus_FIFO_E_Enqueue(&Modbus_FIFO_Error,&Modbus_App_Error_Msg);
+  }
+#if MODBUS_STATS
+  Modbus_Stats_Finish(Request->Slave, Request->Function, Status);
+#endif
+  if(Request->CallBack)
+    Request->CallBack(Request->Handle, Status, Exception);
+  MODBUS_TRACE_EVENT(MODBUS_TRACE_CALLBACK, Slave, Function, Handle, 0, Status, Exception);
+}
+
+#if MODBUS_APP_MERGE
+/**
+*   @brief It merges the register reads queued behind the actual request into it.
+*   @ingroup App_Exchange
+*
+*   When the actual request reads holding or input registers, the queue is searched for the requests which read the
+*   same kind of registers from the same slave, with a range which overlaps, touches or is no further than
+*   MODBUS_APP_MERGE_GAP registers from the merged range, while the merged range is not over 125 registers. The requests
+*   to other slaves between them are skipped, so the merge does not depend on how they are interleaved; the search stops
+*   at a broadcast or at any other request to the same slave, which must keep its order. Every request found is brought
+*   to the head of the queue and dequeued. They are kept in a
+*   free group and the actual request is replaced by one read of the whole range into the group buffer, with handle 0.
+*   Nothing is merged if no request qualifies or every group is busy.
+*   @warning The registers of the gaps are read too, so they must exist in the slave: an exception is given to every
+*   merged request.
+*   @param *FIFO Request FIFO where the actual request was
+*   @sa Modbus_App_FIFOSend, Modbus_App_Complete, Modbus_FIFO_Peek_At, Modbus_FIFO_Move_First
+*/
+static void Modbus_App_Merge(struct Modbus_FIFO_s *FIFO)
+{
+  struct Modbus_App_Merge_Group *Group;
+  struct Modbus_FIFO_Item *Next;
+  uint16_t Low, High, Start, End, i;
+  unsigned char g;
+
+  if(Modbus_App_Actual_Req.Function != 3 && Modbus_App_Actual_Req.Function != 4)
+    return;
+
+  for(g=0; g<MODBUS_APP_MERGE_GROUPS && Modbus_App_Merge_Groups[g].Items; g++);
+  if(g == MODBUS_APP_MERGE_GROUPS)
+    return;
+  Group = &Modbus_App_Merge_Groups[g];
+
+  Low = Modbus_App_Actual_Req.Data[0].UI2;
+  High = Low + Modbus_App_Actual_Req.Data[1].UI2;
+  Group->Request[0] = Modbus_App_Actual_Req;
+  Group->Items = 1;
+  i = 0;
+  while(Group->Items < MODBUS_APP_MERGE_ITEMS && (Next = Modbus_FIFO_Peek_At(FIFO, i)) != 0)
+  {
+    if(Next->Slave == 0)
+      break;
+    if(Next->Slave != Modbus_App_Actual_Req.Slave)
+    {
+      i++;
+      continue;
+    }
+    if(Next->Function != Modbus_App_Actual_Req.Function)
+      break;
+    Start = Next->Data[0].UI2;
+    End = Start + Next->Data[1].UI2;
+    if((long)Start > (long)High + MODBUS_APP_MERGE_GAP || (long)End + MODBUS_APP_MERGE_GAP < (long)Low ||
+       (End > High ? End : High) - (Start < Low ? Start : Low) > 125)
+    {
+      // A later read of the same slave must not go before this one
+      break;
+    }
+    // The requests skipped stay in the positions before i
+    if(i)
+      Modbus_FIFO_Move_First(FIFO, i);
+    Modbus_FIFO_Dequeue(FIFO, &Group->Request[Group->Items]);
+    MODBUS_TRACE_EVENT(MODBUS_TRACE_DEQUEUE, Group->Request[Group->Items].Slave, Group->Request[Group->Items].Function,
+                       Group->Request[Group->Items].Handle, 0, 0, 0);
+    Modbus_App_Account(&Group->Request[Group->Items++]);
+    if(Start < Low)
+      Low = Start;
+    if(End > High)
+      High = End;
+  }
+  if(Group->Items == 1)
+  {
+    Group->Items = 0;
+    return;
+  }
+
+  Modbus_App_Actual_Req.Data[0].UI2 = Low;
+  Modbus_App_Actual_Req.Data[1].UI2 = High - Low;
+  Modbus_App_Actual_Req.Data[2].PUI2 = Group->Buffer;
+  Modbus_App_Actual_Req.Data[3].UC = g;
+  Modbus_App_Actual_Req.Handle = 0;
+  Modbus_App_Actual_Req.CallBack = 0;
+}
+#endif
+
+/**
+*   @brief No answer; It enqueues the request in the Error FIFO.
+*   @ingroup App_Control 
+*
+*   If this function is activated means that the maximum number of sendings of one function was exceeded without achieving any answer.
+*   Therefore, the proper request is enqueued as an exception message, the difference is that in the "answer" field of the message is
+*   stored [0,0]. The completion callback of the request, if any, is called as well. A merged read is given back as the
+*   requests it was made of.
+*   @param Status MODBUS_STATUS_TIMEOUT, or MODBUS_STATUS_CRC if the answer to the last attempt was discarded by its CRC
+*   @sa Modbus_FIFO_E_Enqueue, Modbus_OSL_Repeat_Request, Modbus_CAN_Repeat_Request, Modbus_App_Complete
+*/
+void Modbus_App_No_Response(enum Modbus_Status Status)
+{
+  Modbus_App_Complete(Status, 0);
+}
+
+/**
+*   @defgroup App_Exchange Interconnection between OSL/CAN Layer and App Layer
+*   @ingroup App
+*   @brief Functions to exchange data between App and OSL/CAN module.
+*
+*   It includes functions to exchange information data between the CAN/OSL and App module,
+*   allowing APP to send/receive messages through CAN/OSL.
+*/
+
+/**
+*   @brief It gets and sends a petition from the request FIFOs if they are not empty.
+*   @ingroup App_Exchange
+*
+*   A due probe to a slave which is down goes first. Then the Request FIFOs are served from the highest priority. In
+*   each one, the petition is chosen by _Modbus_App_Select_,
+*   so a slow or dead slave only delays its own requests. In CAN mode only the slaves with a free transaction are
+*   chosen; if none of them has, the next priority is tried. The register reads queued behind the petition are merged
+*   into it when possible.
+*   @return 0 It has sent a request from the queue
+*   @return 1 Empty queues, there is no requests to be sent
+*   @return 2 The requests have to wait for their slaves (CAN) or there are slaves down to probe
+*   @sa Modbus_FIFO_Dequeue, Modbus_App_Send, Modbus_App_Select, Modbus_CAN_Transaction_Available, Modbus_App_Merge
+*/
+unsigned char Modbus_App_FIFOSend(void)
+{
+  struct Modbus_FIFO_Item *Next;
+  unsigned char i, Waiting = 0;
+
+  if (Modbus_App_Probe())
+    return 0;
+  for (i = 0; i < MODBUS_APP_PRIORITIES; i++)
+  {
+    Next = Modbus_App_Select(&Modbus_FIFO_Tx[i], &Waiting);
+#if OSL_Mode
+    // The callback of an expired request can have sent a new one
+    if (Modbus_OSL_MainState_Get() != MODBUS_OSL_IDLE)
+      return 0;
+#endif
+    if (!Next)
+      continue;
+    Modbus_FIFO_Dequeue(&Modbus_FIFO_Tx[i],&Modbus_App_Actual_Req);
+    MODBUS_TRACE_EVENT(MODBUS_TRACE_DEQUEUE, Modbus_App_Actual_Req.Slave, Modbus_App_Actual_Req.Function,
+                       Modbus_App_Actual_Req.Handle, 0, 0, 0);
+    Modbus_App_Last_Slave = Modbus_App_Actual_Req.Slave;
+    Modbus_App_Account(&Modbus_App_Actual_Req);
+#if MODBUS_APP_MERGE
+    Modbus_App_Merge(&Modbus_FIFO_Tx[i]);
+#endif
+    Modbus_App_Send();  
+    return 0;
+  }
+  return (Waiting || Modbus_App_Down) ? 2 : 1;
+}
+
+/**
+*   @brief It checks whether all the Request FIFOs are empty.
+*   @ingroup App_Exchange
+*
+*   @return 1 There are no requests waiting
+*   @return 0 Some Request FIFO is not empty
+*   @sa Modbus_FIFO_Empty
+*/
+static unsigned char Modbus_App_FIFO_Empty(void)
+{
+  unsigned char i;
+
+  for (i = 0; i < MODBUS_APP_PRIORITIES; i++)
+    if (!Modbus_FIFO_Empty(&Modbus_FIFO_Tx[i]))
+      return 0;
+  return 1;
+}
+
+/**
+*   @brief It chooses the next request of a Request FIFO and puts it at its head.
+*   @ingroup App_Exchange
+*
+*   The FIFO is seen as one queue per slave: only the oldest request of each slave can be chosen, so the requests to the
+*   same slave keep their order, and no request goes before an older broadcast or a resend of its slave. Among them, the one with the earliest
+*   deadline is chosen and, if none has deadline, the one of the next slave after the last served (round-robin). The
+*   chosen request is dropped while its deadline has expired, giving it to the user as MODBUS_STATUS_EXPIRED. The requests
+*   to a slave which is down are chosen before any other and dropped as MODBUS_STATUS_DOWN, without using the bus.
+*   @param *FIFO Request FIFO
+*   @param *Waiting Set to 1 if a request was not chosen because its slave has no free transaction (CAN) or a request to
+*   it is waiting to be resent (OSL)
+*   @return Pointer to the head of the FIFO, or 0 if no request can be sent
+*   @sa Modbus_App_Before, Modbus_FIFO_Peek_At, Modbus_FIFO_Move_First, Modbus_App_Finish
+*/
+static struct Modbus_FIFO_Item *Modbus_App_Select(struct Modbus_FIFO_s *FIFO, unsigned char *Waiting)
+{
+  struct Modbus_FIFO_Item *Item, *Best;
+  struct Modbus_FIFO_Item Expired;
+  uint32_t Seen[8];
+  uint16_t i, Best_i;
+
+  while (1)
+  {
+    // The slaves are marked as they appear, only their oldest request is a candidate
+    for (i = 0; i < 8; i++)
+      Seen[i] = 0;
+    Best = 0;
+    Best_i = 0;
+    for (i = 0; (Item = Modbus_FIFO_Peek_At(FIFO, i)) != 0; i++)
+    {
+      if (Item->Slave == 0 && i > 0)
+        break;
+      if (Seen[Item->Slave >> 5] & (1UL << (Item->Slave & 31)))
+        continue;
+      Seen[Item->Slave >> 5] |= 1UL << (Item->Slave & 31);
+      if (Modbus_App_Health[Item->Slave].State == MODBUS_SLAVE_DOWN)
+      {
+        Best = Item;
+        Best_i = i;
+        break;
+      }
+#if CAN_Mode
+      if (!Modbus_CAN_Transaction_Available(Item->Slave))
+#else
+      if (!Modbus_OSL_Slave_Available(Item->Slave))
+#endif
+      {
+        // Nothing goes before a broadcast which is waiting
+        *Waiting = 1;
+        if (Item->Slave == 0)
+          break;
+        continue;
+      }
+      if (!Best || Modbus_App_Before(Item, Best))
+      {
+        Best = Item;
+        Best_i = i;
+      }
+      if (Item->Slave == 0)
+        break;
+    }
+    if (!Best)
+      return 0;
+    if (Best_i)
+      Modbus_FIFO_Move_First(FIFO, Best_i);
+
+    Item = Modbus_FIFO_Peek(FIFO);
+    if (Modbus_App_Health[Item->Slave].State == MODBUS_SLAVE_DOWN)
+    {
+      Modbus_FIFO_Dequeue(FIFO, &Expired);
+      Modbus_App_Finish(&Expired, MODBUS_STATUS_DOWN, 0);
+      continue;
+    }
+    if (!Item->Deadline || (int32_t)(Modbus_Timer_Now() - Item->Deadline) < 0)
+      return Item;
+    Modbus_FIFO_Dequeue(FIFO, &Expired);
+    Modbus_App_Finish(&Expired, MODBUS_STATUS_EXPIRED, 0);
+  }
+}
+
+/**
+*   @brief It compares two candidates of _Modbus_App_Select_.
+*   @ingroup App_Exchange
+*
+*   A request with deadline goes before one without it and, between two with deadline, the earliest one. Otherwise,
+*   the slave which comes first after _Modbus_App_Last_Slave_ goes first.
+*   @param *A Request to compare
+*   @param *B Best request so far
+*   @return 1 A goes before B
+*   @return 0 B goes before A
+*   @sa Modbus_App_Select
+*/
+static unsigned char Modbus_App_Before(struct Modbus_FIFO_Item *A, struct Modbus_FIFO_Item *B)
+{
+  if (A->Deadline && B->Deadline)
+    return ((int32_t)(A->Deadline - B->Deadline) < 0);
+  if (A->Deadline || B->Deadline)
+    return (A->Deadline != 0);
+  return ((unsigned char)(A->Slave - Modbus_App_Last_Slave - 1) <
+          (unsigned char)(B->Slave - Modbus_App_Last_Slave - 1));
+}
+
+/**
+*   @brief It records the waiting time of a request which is going to be sent.
+*   @ingroup App_Exchange
+*
+*   @param *Request Request taken from the Request FIFOs or sent directly
+*   @sa Modbus_Get_Queue_Stats
+*/
+static void Modbus_App_Account(struct Modbus_FIFO_Item *Request)
+{
+  struct Modbus_App_Queue *Queue = &Modbus_App_Queues[Request->Slave];
+  uint32_t Wait = Modbus_Timer_Now() - Request->Queued;
+
+  Queue->Sent++;
+  Queue->Wait_Sum += Wait;
+  if (Wait > Queue->Wait_Max)
+    Queue->Wait_Max = Wait;
+}
+
+/**
+*   @brief It updates the health of a slave when a request to it finishes.
+*   @ingroup App_Exchange
+*
+*   Any answer, even an exception, puts the slave up. A request without answer makes it suspect and, after
+*   MODBUS_APP_DOWN_AFTER in a row, down: its requests fail without being sent and it is probed every
+*   MODBUS_APP_PROBE_PERIOD milliseconds. A wrong CRC makes it suspect but it does not count to put it down, since
+*   something answered.
+*   @param Slave Slave of the request
+*   @param Status How the request finished
+*   @sa Modbus_App_Probe, Modbus_Slave_Health
+*/
+static void Modbus_App_Health_Update(unsigned char Slave, enum Modbus_Status Status)
+{
+  struct Modbus_App_Health *Health = &Modbus_App_Health[Slave];
+
+  if (Slave == 0)
+    return;
+  Health->Probing = 0;
+  switch (Status)
+  {
+    case MODBUS_STATUS_OK:
+    case MODBUS_STATUS_EXCEPTION:
+      if (Health->State == MODBUS_SLAVE_DOWN)
+        Modbus_App_Down--;
+      Health->State = MODBUS_SLAVE_UP;
+      Health->Failures = 0;
+      break;
+    case MODBUS_STATUS_TIMEOUT:
+      if (Health->Failures < 255)
+        Health->Failures++;
+      if (Health->State != MODBUS_SLAVE_DOWN && Health->Failures >= MODBUS_APP_DOWN_AFTER)
+      {
+        Health->State = MODBUS_SLAVE_DOWN;
+        Modbus_App_Down++;
+      }
+      else if (Health->State == MODBUS_SLAVE_UP)
+        Health->State = MODBUS_SLAVE_SUSPECT;
+      if (Health->State == MODBUS_SLAVE_DOWN)
+      {
+        Health->Probe = Modbus_Timer_Now() + MODBUS_APP_PROBE_PERIOD * (MODBUS_TIMER_TICK_HZ / 1000);
+        if (Modbus_App_Down == 1 || (int32_t)(Health->Probe - Modbus_App_Next_Probe) < 0)
+          Modbus_App_Next_Probe = Health->Probe;
+      }
+      break;
+    default:
+      if (Health->State == MODBUS_SLAVE_UP)
+        Health->State = MODBUS_SLAVE_SUSPECT;
+      break;
+  }
+}
+
+/**
+*   @brief It sends a probe to a slave which is down, if one is due.
+*   @ingroup App_Exchange
+*
+*   The probe reads the holding register 0 and it is sent only once: any answer, even an exception, shows that the
+*   slave is alive again. Its result only updates the health of the slave, it is not given to the user.
+*   @return 1 A probe was sent
+*   @return 0 No probe is due (or, in CAN, its slave has no free transaction)
+*   @sa Modbus_App_Health_Update, Modbus_App_FIFOSend
+*/
+static unsigned char Modbus_App_Probe(void)
+{
+  struct Modbus_App_Health *Health;
+  uint32_t Now = Modbus_Timer_Now();
+  unsigned char i, Sent = 0;
+
+  if (!Modbus_App_Down || (int32_t)(Now - Modbus_App_Next_Probe) < 0)
+    return 0;
+
+  Modbus_App_Next_Probe = Now + MODBUS_APP_PROBE_PERIOD * (MODBUS_TIMER_TICK_HZ / 1000);
+  for (i = 1; i <= 247; i++)
+  {
+    Health = &Modbus_App_Health[i];
+    if (Health->State != MODBUS_SLAVE_DOWN || Health->Probing)
+      continue;
+    if (!Sent && (int32_t)(Now - Health->Probe) >= 0
+#if CAN_Mode
+        && Modbus_CAN_Transaction_Available(i)
+#endif
+       )
+    {
+      Health->Probing = 1;
+      Health->Probe = Now + MODBUS_APP_PROBE_PERIOD * (MODBUS_TIMER_TICK_HZ / 1000);
+      Modbus_App_Actual_Req.Slave = i;
+      Modbus_App_Actual_Req.Function = 3;
+      Modbus_App_Actual_Req.Data[0].UI2 = 0;
+      Modbus_App_Actual_Req.Data[1].UI2 = 1;
+      Modbus_App_Actual_Req.Data[2].PUI2 = &Modbus_App_Probe_Register;
+      Modbus_App_Actual_Req.Handle = 0;
+      Modbus_App_Actual_Req.CallBack = 0;
+      Modbus_App_Actual_Req.Priority = MODBUS_PRIORITY_HIGH;
+      Modbus_App_Actual_Req.Deadline = 0;
+      Modbus_App_Actual_Req.Queued = Now;
+      Modbus_App_Actual_Req.Retry = &Modbus_App_Probe_Retry;
+      Modbus_App_Send();
+      Sent = 1;
+    }
+    if ((int32_t)(Health->Probe - Modbus_App_Next_Probe) < 0)
+      Modbus_App_Next_Probe = Health->Probe;
+  }
+  return Sent;
+}
+
+/**   
+*   @brief It receives a char from another module.
+*   @ingroup App_Exchange
+*
+*   It allows to store chars in some position of the vector _Modbus_App_Msg_; It is used in _Modbus_OSL_RTU_to_App(which also uses
+*   _Modbus_OSL_RTU_Char_Get_) and in _Modbus_CAN_to_App to transfer messages from RTU to App through OSL layer without connecting them;
+*   Also to transfer from CAN to App.
+*   @param Msg Char value to be stored in _Modbus_App_Msg_
+*   @param i Vector index where to store the char
+*   @sa Modbus_App_Msg, Modbus_OSL_RTU_to_App, Modbus_OSL_RTU_Char_Get
+*/
+void Modbus_App_Receive_Char (unsigned char Msg, unsigned char i)
+{
+    Modbus_App_Msg[i]=Msg;
+  
+}
+
+/** 
+*   @brief It receives the message length.
+*   @ingroup App_Exchange
+*
+*   It is used in _Modbus_OSL_RTU_to_App_ and _Modbus_CAN_to_App_ to send from OSL/CAN the length 
+*   of the correct incoming message to App.
+*   @param Index Length message value
+*   @sa Modbus_App_Msg, Modbus_App_L_Msg, Modbus_OSL_RTU_to_App
+*/
+void Modbus_App_L_Msg_Set(unsigned char Index)
+{
+  Modbus_App_L_Msg=Index;
+}
+
+/** 
+*   @brief It gives a copy of the actual request.
+*   @ingroup App_Exchange
+*
+*   It is used in _Modbus_CAN_FixOutput_ to keep the request in its transaction while the answer arrives.
+*   @param *Item Where the actual request is copied
+*   @sa Modbus_App_Actual_Req, Modbus_App_Actual_Req_Set
+*/
+void Modbus_App_Actual_Req_Get(struct Modbus_FIFO_Item *Item)
+{
+  *Item=Modbus_App_Actual_Req;
+}
+
+/** 
+*   @brief It sets the actual request.
+*   @ingroup App_Exchange
+*
+*   It is used in _Modbus_CAN_Controller_ to restore the request of the transaction being handled before resending it or
+*   managing its answer.
+*   @param *Item Request to be the actual one
+*   @sa Modbus_App_Actual_Req, Modbus_App_Actual_Req_Get
+*/
+void Modbus_App_Actual_Req_Set(struct Modbus_FIFO_Item *Item)
+{
+  Modbus_App_Actual_Req=*Item;
+}
+
+/** 
+*   @brief It gives the handle of the actual request.
+*   @ingroup App_Exchange
+*
+*   It is used by the OSL/CAN layer to tag the stages of the request in the trace without copying it.
+*   @return Handle of the actual request, 0 for merged reads and probes
+*   @sa Modbus_App_Actual_Req, Modbus_Trace_Event
+*/
+uint16_t Modbus_App_Actual_Handle(void)
+{
+  return Modbus_App_Actual_Req.Handle;
+}
+
+/**
+*   @defgroup App_Modbus Modbus Functions
+*   @ingroup App
+*   @brief Modbus user functions to send requests in addition with internal functions from App Module to give the proper format to the requests.
+*   Also, it manages the responses.
+*   
+*   For each public Modbus function, it exists an user one to make the request; Also, other functions to give format to the request 
+*   before the sending are grouped here. Moreover, it is implemented the proper functions to understand the received responses 
+*   from the Slaves and to store the received values of the Read requests.
+*/
+
+/**
+*   @defgroup App_User User Functions
+*   @ingroup App_Modbus
+*   @brief User functions to make the requests.
+*
+*   Public Modbus functions to Read/Write the I/O.
+*   It checks the data correctness of the request and it is enqueued or sent in 
+*   _Modbus_App_Enqueue_Or_Send_. It returns 0 if all is correct, or 1 if either there was a wrong parameter or 
+*   the request FIFO was filled. It has to be taken into account that the Read/Write multiple I/O functions have a limit number of I/O
+*   each one. Furthermore, the addresses are from 0 to 65.535; then if the address is near this number it can exceed the maximum and
+*   the request would not be done.
+*   >_Example_: For the address 65.000, it can not be done a Read of 600 Coils.
+*   Additionally, it has to be heeded that the maximum number of slaves is 247 in OSL/CAN.
+*
+*   After a call which returns 0, _Modbus_Last_Handle_ gives the handle of the request; a completion callback can be set for it
+*   beforehand with _Modbus_Next_CallBack_. Each function has an _Ex_ version which takes these options in the call (struct
+*   Modbus_Request_Options) and returns the handle of its own request, or 0 instead of 1; it is the one to use when requests
+*   are also made from interrupts.
+*
+*   @warning If the response of one of these functions is 1, the request was not done.
+*/
+//! @{
+
+/**
+*   @brief Read multiple Coils.
+*
+*   It reads from 1 to 2000 continuous Coils from one Slave. The read is stored in the vector pointed by *Response.
+*   @param Slave Slave number which it is requested the data.
+*   @param Adress Initial address of the read
+*   @param Coils Coils amount to be read
+*   @param *Response Pointer to where the read will be stored
+*   @return 0 Correct request 
+*   @return 1 It cannot be enqueued or wrong parameters
+*   @sa Modbus_App_Enqueue_Or_Send
+*/
+unsigned char Modbus_Read_Coils (unsigned char Slave, uint16_t Adress, 
+                                 uint16_t Coils, unsigned char *Response)
+{
+  return Modbus_App_Next_Done(Modbus_Read_Coils_Ex(&Modbus_App_Next, Slave, Adress, Coils, Response));
+}
+
+/**
+*   @brief As _Modbus_Read_Coils_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Read_Coils, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Read_Coils_Ex (const struct Modbus_Request_Options *Options,
+                               unsigned char Slave, uint16_t Adress, 
+                               uint16_t Coils, unsigned char *Response)
+{
+  struct Modbus_FIFO_Item Request;
+ 
+  if(Slave>247 || Slave==0 || Coils>2000  || Coils==0 || ((long)Adress+(long)Coils)>65535)
+      return 0;
+  else
+  { 
+    Request.Slave=Slave;
+    Request.Function=1;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Coils;
+    Request.Data[2].PC=Response;
+    Request.Data[3].UC=0;
+      
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
+  } 
+}
+
+/**
+*   @brief Read multiple Discrete Inputs.
+*   
+*   It reads from 1 to 2000 continuous Discrete Inputs from one Slave. The read is stored in the vector pointed by *Response.
+*   @param Slave Slave number which it is requested the data.
+*   @param Adress Initial address of the read
+*   @param Inputs Amount of Discrete Inputs to be read
+*   @param *Response Pointer to where the read will be stored
+*   @return 0 Correct request
+*   @return 1 It cannot be enqueued or wrong parameters
+*   @sa Modbus_App_Enqueue_Or_Send
+*/
+unsigned char Modbus_Read_D_Inputs (unsigned char Slave, uint16_t Adress, 
+                                    uint16_t Inputs, unsigned char *Response)
+{
+  return Modbus_App_Next_Done(Modbus_Read_D_Inputs_Ex(&Modbus_App_Next, Slave, Adress, Inputs, Response));
+}
+
+/**
+*   @brief As _Modbus_Read_D_Inputs_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Read_D_Inputs, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Read_D_Inputs_Ex (const struct Modbus_Request_Options *Options,
+                                  unsigned char Slave, uint16_t Adress, 
+                                  uint16_t Inputs, unsigned char *Response)
+{
+  struct Modbus_FIFO_Item Request;
+ 
+  if(Slave>247 || Slave==0 || Inputs>2000 || Inputs==0 || ((long)Adress+(long)Inputs)>65535)
+      return 0;
+  else
+  { 
+    Request.Slave=Slave;
+    Request.Function=2;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Inputs;
+    Request.Data[2].PC=Response;
+    Request.Data[3].UC=0;
+  
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
+  } 
+}
+
+/**
+*   @brief Read multiple Holding Registers.
+*
+*   It reads from 1 to 125 continuous registers from one slave. The read is stored in the vector pointed by *Response.
+*   @param Slave Slave number which it is requested the data.
+*   @param Adress Initial address of the read
+*   @param Registers Amount of Holding Registers to be read
+*   @param *Response Pointer to where the read will be stored
+*   @return 0 Correct request
+*   @return 1 It cannot be enqueued or wrong parameters
+*   @sa Modbus_App_Enqueue_Or_Send
+*/
+unsigned char Modbus_Read_H_Registers (unsigned char Slave, uint16_t Adress,
+                                       uint16_t Registers, uint16_t *Response)
+{
+  return Modbus_App_Next_Done(Modbus_Read_H_Registers_Ex(&Modbus_App_Next, Slave, Adress, Registers, Response));
+}
+
+/**
+*   @brief As _Modbus_Read_H_Registers_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Read_H_Registers, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Read_H_Registers_Ex (const struct Modbus_Request_Options *Options,
+                                     unsigned char Slave, uint16_t Adress,
+                                     uint16_t Registers, uint16_t *Response)
+{
+  struct Modbus_FIFO_Item Request;
+ 
+  if(Slave>247 || Slave==0 || Registers>125 || Registers==0 || ((long)Adress+(long)Registers)>65535)
+      return 0;
+  else
+  { 
+    Request.Slave=Slave;
+    Request.Function=3;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Registers;
+    Request.Data[2].PUI2=Response;
+      
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
+  } 
+}
+/**
+*   @brief Read multiple Input Registers.
+*
+*   It reads from 1 to 125 continuous registers from one slave. The read is stored in the vector pointed by *Response.
+*   @param Slave Slave number which it is requested the data.
+*   @param Adress Initial address of the read
+*   @param Registers Amount of Input Registers to be read
+*   @param *Response Pointer to where the read will be stored
+*   @return 0 Correct request
+*   @return 1 It cannot be enqueued or wrong parameters
+*   @sa Modbus_App_Enqueue_Or_Send
+*/
+unsigned char Modbus_Read_I_Registers (unsigned char Slave, uint16_t Adress,
+                                       uint16_t Registers, uint16_t *Response)
+{
+  return Modbus_App_Next_Done(Modbus_Read_I_Registers_Ex(&Modbus_App_Next, Slave, Adress, Registers, Response));
+}
+
+/**
+*   @brief As _Modbus_Read_I_Registers_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Read_I_Registers, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Read_I_Registers_Ex (const struct Modbus_Request_Options *Options,
+                                     unsigned char Slave, uint16_t Adress,
+                                     uint16_t Registers, uint16_t *Response)
+{
+  struct Modbus_FIFO_Item Request;
+ 
+  if(Slave>247 || Slave==0 || Registers>125 || Registers==0 || ((long)Adress+(long)Registers)>65535)
+      return 0;
+  else
+  { 
+    Request.Slave=Slave;
+    Request.Function=4;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Registers;
+    Request.Data[2].PUI2=Response;
+      
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
+  } 
+}
+
+/**
+*   @brief Write one Coil.
+*
+*   It set to 0 or 1 one coil in the concrete address.
+*   @param Slave Slave number which it is requested the data.
+*   @param Adress Address to write
+*   @param Coil Coil value (If it is not 0, it will be set to 1)
+*   @return 0 Correct request
+*   @return 1 It cannot be enqueued or wrong parameters
+*   @sa Modbus_App_Enqueue_Or_Send
+*/
+unsigned char Modbus_Write_Coil (unsigned char Slave, uint16_t Adress,unsigned char Coil)
+{
+  return Modbus_App_Next_Done(Modbus_Write_Coil_Ex(&Modbus_App_Next, Slave, Adress, Coil));
+}
+
+/**
+*   @brief As _Modbus_Write_Coil_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Write_Coil, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Write_Coil_Ex (const struct Modbus_Request_Options *Options,
+                               unsigned char Slave, uint16_t Adress,unsigned char Coil)
+{
+  struct Modbus_FIFO_Item Request;
+ 
+  if(Slave>247)   
+    return 0;
+  else      
+  {
+    Request.Slave=Slave;
+    Request.Function=5;
+    Request.Data[0].UI2=Adress;
+    
+    // Se envia 0 o 0xFF00
+    if(Coil==0)
+      Request.Data[1].UI2=0;
+    else
+      Request.Data[1].UI2=65280; 
     
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
+  }
+}
+
+/*
+*   @brief Write one I/O Register.
+*
+*   The value is written in the register of the indicated address.
+*   @param Slave Slave number which it is requested the data.
+*   @param Adress Address to write
+*   @param Register Value to be written in the Register
+*   @return 0 Correct request
+*   @return 1 It cannot be enqueued or wrong parameters
+*   @sa Modbus_App_Enqueue_Or_Send
+*/
+unsigned char Modbus_Write_Register (unsigned char Slave, uint16_t Adress, uint16_t Register)
+{
+  return Modbus_App_Next_Done(Modbus_Write_Register_Ex(&Modbus_App_Next, Slave, Adress, Register));
+}
+
+/**
+*   @brief As _Modbus_Write_Register_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Write_Register, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Write_Register_Ex (const struct Modbus_Request_Options *Options,
+                                   unsigned char Slave, uint16_t Adress, uint16_t Register)
+{
+  struct Modbus_FIFO_Item Request;
+ 
+  if(Slave>247)   
     return 0;
+  else      
+  {
+    Request.Slave=Slave;
+    Request.Function=6;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Register;
+      
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
   }
 }
 
@@ -906,25 +1940,192 @@ unsigned char Modbus_Write_Register (unsigned char Slave, uint16_t Adress, uint1
 *   @param *Value Pointer to where the values to write are stored
 *   @return 0 Correct Request 
 *   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   @sa Modbus_App_Enqueue_Or_Send
 */
 unsigned char Modbus_Write_M_Coils (unsigned char Slave, uint16_t Adress,
                                     uint16_t Coils, unsigned char *Value)
-{ 
+{
+  return Modbus_App_Next_Done(Modbus_Write_M_Coils_Ex(&Modbus_App_Next, Slave, Adress, Coils, Value));
+}
+
+/**
+*   @brief As _Modbus_Write_M_Coils_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Write_M_Coils, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Write_M_Coils_Ex (const struct Modbus_Request_Options *Options,
+                                  unsigned char Slave, uint16_t Adress,
+                                  uint16_t Coils, unsigned char *Value)
+{
+  struct Modbus_FIFO_Item Request;
+ 
   if(Slave>247 || Coils>1968 || Coils==0 || ((long)Adress+(long)Coils)>65535)   
-    return 1;
+    return 0;
   else      
   {
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=15;
-    Modbus_App_Request.Data[0].UI2=Adress;
-    Modbus_App_Request.Data[1].UI2=Coils;
-    Modbus_App_Request.Data[2].PC=Value;
+    Request.Slave=Slave;
+    Request.Function=15;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Coils;
+    Request.Data[2].PC=Value;
+    Request.Data[3].UC=0;
       
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
-    
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
+  }
+}
+
+/**
+*   @brief Read multiple Coils into a packed bitmap.
+*
+*   As _Modbus_Read_Coils_, but the read is stored one bit per Coil in the bitmap pointed by *Response: the first Coil in the bit
+*   _Offset_ (bit Offset%32 of the word Offset/32) and the rest after it. The other bits of the bitmap are kept.
+*   @param Slave Slave number which it is requested the data.
+*   @param Adress Initial address of the read
+*   @param Coils Coils amount to be read
+*   @param *Response Packed bitmap where the read will be stored
+*   @param Offset Bit of the bitmap for the first Coil
+*   @return 0 Correct request
+*   @return 1 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Read_Coils, MODBUS_BITMAP_WORDS
+*/
+unsigned char Modbus_Read_Coils_Packed (unsigned char Slave, uint16_t Adress, uint16_t Coils,
+                                        uint32_t *Response, uint16_t Offset)
+{
+  return Modbus_App_Next_Done(Modbus_Read_Coils_Packed_Ex(&Modbus_App_Next, Slave, Adress, Coils, Response, Offset));
+}
+
+/**
+*   @brief As _Modbus_Read_Coils_Packed_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Read_Coils_Packed, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Read_Coils_Packed_Ex (const struct Modbus_Request_Options *Options,
+                                      unsigned char Slave, uint16_t Adress, uint16_t Coils,
+                                      uint32_t *Response, uint16_t Offset)
+{
+  struct Modbus_FIFO_Item Request;
+
+  if(Slave>247 || Slave==0 || Coils>2000  || Coils==0 || ((long)Adress+(long)Coils)>65535 ||
+     ((long)Offset+(long)Coils)>65535)
+      return 0;
+  else
+  {
+    Request.Slave=Slave;
+    Request.Function=1;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Coils;
+    Request.Data[2].PUI4=Response;
+    Request.Data[3].UC=1;
+    Request.Data[4].UI2=Offset;
+
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
+  }
+}
+
+/**
+*   @brief Read multiple Discrete Inputs into a packed bitmap.
+*
+*   As _Modbus_Read_D_Inputs_, but the read is stored one bit per Input in the bitmap pointed by *Response from the bit _Offset_.
+*   @param Slave Slave number which it is requested the data.
+*   @param Adress Initial address of the read
+*   @param Inputs Amount of Discrete Inputs to be read
+*   @param *Response Packed bitmap where the read will be stored
+*   @param Offset Bit of the bitmap for the first Input
+*   @return 0 Correct request
+*   @return 1 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Read_D_Inputs, Modbus_Read_Coils_Packed
+*/
+unsigned char Modbus_Read_D_Inputs_Packed (unsigned char Slave, uint16_t Adress, uint16_t Inputs,
+                                           uint32_t *Response, uint16_t Offset)
+{
+  return Modbus_App_Next_Done(Modbus_Read_D_Inputs_Packed_Ex(&Modbus_App_Next, Slave, Adress, Inputs, Response, Offset));
+}
+
+/**
+*   @brief As _Modbus_Read_D_Inputs_Packed_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Read_D_Inputs_Packed, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Read_D_Inputs_Packed_Ex (const struct Modbus_Request_Options *Options,
+                                         unsigned char Slave, uint16_t Adress, uint16_t Inputs,
+                                         uint32_t *Response, uint16_t Offset)
+{
+  struct Modbus_FIFO_Item Request;
+
+  if(Slave>247 || Slave==0 || Inputs>2000 || Inputs==0 || ((long)Adress+(long)Inputs)>65535 ||
+     ((long)Offset+(long)Inputs)>65535)
+      return 0;
+  else
+  {
+    Request.Slave=Slave;
+    Request.Function=2;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Inputs;
+    Request.Data[2].PUI4=Response;
+    Request.Data[3].UC=1;
+    Request.Data[4].UI2=Offset;
+
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
+  }
+}
+
+/**
+*   @brief Write multiple Coils from a packed bitmap.
+*
+*   As _Modbus_Write_M_Coils_, but the values are taken one bit per Coil from the bitmap pointed by *Value, the first Coil from
+*   the bit _Offset_. The bitmap is read when the request is sent, so it must be kept until then.
+*   @param Slave Slave number which it is requested the data.
+*   @param Adress Initial address to write
+*   @param Coils Number of Coils to write
+*   @param *Value Packed bitmap with the values to write
+*   @param Offset Bit of the bitmap for the first Coil
+*   @return 0 Correct Request
+*   @return 1 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Write_M_Coils, Modbus_Read_Coils_Packed
+*/
+unsigned char Modbus_Write_M_Coils_Packed (unsigned char Slave, uint16_t Adress, uint16_t Coils,
+                                           uint32_t *Value, uint16_t Offset)
+{
+  return Modbus_App_Next_Done(Modbus_Write_M_Coils_Packed_Ex(&Modbus_App_Next, Slave, Adress, Coils, Value, Offset));
+}
+
+/**
+*   @brief As _Modbus_Write_M_Coils_Packed_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Write_M_Coils_Packed, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Write_M_Coils_Packed_Ex (const struct Modbus_Request_Options *Options,
+                                         unsigned char Slave, uint16_t Adress, uint16_t Coils,
+                                         uint32_t *Value, uint16_t Offset)
+{
+  struct Modbus_FIFO_Item Request;
+
+  if(Slave>247 || Coils>1968 || Coils==0 || ((long)Adress+(long)Coils)>65535 ||
+     ((long)Offset+(long)Coils)>65535)
     return 0;
+  else
+  {
+    Request.Slave=Slave;
+    Request.Function=15;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Coils;
+    Request.Data[2].PUI4=Value;
+    Request.Data[3].UC=1;
+    Request.Data[4].UI2=Offset;
+
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
   }
 }
 
@@ -938,25 +2139,39 @@ unsigned char Modbus_Write_M_Coils (unsigned char Slave, uint16_t Adress,
 *   @param *Value Pointer to where the values to write are stored
 *   @return 0 Correct request
 *   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   @sa Modbus_App_Enqueue_Or_Send
 */
 unsigned char Modbus_Write_M_Registers (unsigned char Slave, uint16_t Adress,
                                         uint16_t Registers, uint16_t *Value)
-{ 
+{
+  return Modbus_App_Next_Done(Modbus_Write_M_Registers_Ex(&Modbus_App_Next, Slave, Adress, Registers, Value));
+}
+
+/**
+*   @brief As _Modbus_Write_M_Registers_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Write_M_Registers, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Write_M_Registers_Ex (const struct Modbus_Request_Options *Options,
+                                      unsigned char Slave, uint16_t Adress,
+                                      uint16_t Registers, uint16_t *Value)
+{
+  struct Modbus_FIFO_Item Request;
+ 
   if(Slave>247 || Registers>123 || Registers==0 || ((long)Adress+(long)Registers)>65535)   
-    return 1;
+    return 0;
   else      
   {
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=16;
-    Modbus_App_Request.Data[0].UI2=Adress;
-    Modbus_App_Request.Data[1].UI2=Registers;
-    Modbus_App_Request.Data[2].PUI2=Value;
+    Request.Slave=Slave;
+    Request.Function=16;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=Registers;
+    Request.Data[2].PUI2=Value;
       
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
-    
-    return 0;
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
   }
 }
 
@@ -974,25 +2189,39 @@ unsigned char Modbus_Write_M_Registers (unsigned char Slave, uint16_t Adress,
 *   @param OR_Mask OR mask
 *   @return 0 Correct request
 *   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   @sa Modbus_App_Enqueue_Or_Send
 */
 unsigned char Modbus_Mask_Write_Register (unsigned char Slave, uint16_t Adress,
                                           uint16_t AND_Mask, uint16_t OR_Mask)
-{ 
+{
+  return Modbus_App_Next_Done(Modbus_Mask_Write_Register_Ex(&Modbus_App_Next, Slave, Adress, AND_Mask, OR_Mask));
+}
+
+/**
+*   @brief As _Modbus_Mask_Write_Register_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Mask_Write_Register, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Mask_Write_Register_Ex (const struct Modbus_Request_Options *Options,
+                                        unsigned char Slave, uint16_t Adress,
+                                        uint16_t AND_Mask, uint16_t OR_Mask)
+{
+  struct Modbus_FIFO_Item Request;
+ 
   if(Slave>247)   
-    return 1;
+    return 0;
   else      
   {
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=22;
-    Modbus_App_Request.Data[0].UI2=Adress;
-    Modbus_App_Request.Data[1].UI2=AND_Mask;
-    Modbus_App_Request.Data[2].UI2=OR_Mask;
+    Request.Slave=Slave;
+    Request.Function=22;
+    Request.Data[0].UI2=Adress;
+    Request.Data[1].UI2=AND_Mask;
+    Request.Data[2].UI2=OR_Mask;
       
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
-    
-    return 0;
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
   }
 }
 
@@ -1009,31 +2238,47 @@ unsigned char Modbus_Mask_Write_Register (unsigned char Slave, uint16_t Adress,
 *   @param *Value Pointer to where the values to write are stored
 *   @return 0 Correct request
 *   @return 1 It cannot be enqueued or wrong parameters
-*   @sa Modbus_App_Enqueue_Or_Send, Modbus_App_Request
+*   @sa Modbus_App_Enqueue_Or_Send
 */
 unsigned char Modbus_Read_Write_M_Registers (unsigned char Slave, uint16_t R_Adress,
                                              uint16_t R_Registers, uint16_t *Response,
                                              uint16_t W_Adress, uint16_t W_Registers,
                                              uint16_t *Value)
-{ 
+{
+  return Modbus_App_Next_Done(Modbus_Read_Write_M_Registers_Ex(&Modbus_App_Next, Slave, R_Adress, R_Registers, Response, W_Adress, W_Registers, Value));
+}
+
+/**
+*   @brief As _Modbus_Read_Write_M_Registers_, with the options of the request given in the call.
+*
+*   @param *Options Callback, priority, deadline and retry policy of the request; 0 for none of them
+*   @return Handle of the request, given to its callback too
+*   @return 0 It cannot be enqueued or wrong parameters
+*   @sa Modbus_Read_Write_M_Registers, struct Modbus_Request_Options
+*/
+uint16_t Modbus_Read_Write_M_Registers_Ex (const struct Modbus_Request_Options *Options,
+                                           unsigned char Slave, uint16_t R_Adress,
+                                           uint16_t R_Registers, uint16_t *Response,
+                                           uint16_t W_Adress, uint16_t W_Registers,
+                                           uint16_t *Value)
+{
+  struct Modbus_FIFO_Item Request;
+ 
   if(Slave>247 || Slave==0 || R_Registers>125 || R_Registers==0 || ((long)R_Adress+(long)R_Registers)>65535
      || W_Registers>121 || W_Registers==0 || ((long)W_Adress+(long)W_Registers)>65535)   
-    return 1;
+    return 0;
   else      
   {
-    Modbus_App_Request.Slave=Slave;
-    Modbus_App_Request.Function=23;
-    Modbus_App_Request.Data[0].UI2=R_Adress;
-    Modbus_App_Request.Data[1].UI2=R_Registers;
-    Modbus_App_Request.Data[2].UI2=W_Adress;
-    Modbus_App_Request.Data[3].UI2=W_Registers;
-    Modbus_App_Request.Data[4].PUI2=Value;
-    Modbus_App_Request.Data[5].PUI2=Response;
+    Request.Slave=Slave;
+    Request.Function=23;
+    Request.Data[0].UI2=R_Adress;
+    Request.Data[1].UI2=R_Registers;
+    Request.Data[2].UI2=W_Adress;
+    Request.Data[3].UI2=W_Registers;
+    Request.Data[4].PUI2=Value;
+    Request.Data[5].PUI2=Response;
     
-    if(Modbus_App_Enqueue_Or_Send())
-      return 1;
-    
-    return 0;
+    return Modbus_App_Enqueue_Or_Send(&Request, Options);
   }
 }
 //! @}
@@ -1072,6 +2317,85 @@ void Modbus_App_Standard_Request(void)
   Modbus_App_L_Req_pdu=5;
 }
 
+/**
+*   @brief Copy a range of a packed bitmap into the bytes of a PDU.
+*
+*   The bits are taken 32 at a time. If the range starts at the beginning of a word every chunk is one whole word; otherwise it is
+*   funnelled from the two words where it lies. The words after the range are not read.
+*   @param *Map Packed bitmap
+*   @param First First bit to copy
+*   @param Count Bits to copy
+*   @param *Bytes Where the (Count+7)/8 bytes are stored, the first bit in the lowest bit of the first byte
+*   @sa Modbus_App_Write_M_Coils, Modbus_Write_M_Coils_Packed
+*/
+static void Modbus_App_Bits_Get(const uint32_t *Map, uint16_t First, uint16_t Count, unsigned char *Bytes)
+{
+  const uint32_t *Word=&Map[First>>5];
+  unsigned char Shift=First & 31, n, i;
+  uint32_t Bits;
+  
+  while(Count)
+  {
+    n=(Count>32) ? 32 : Count;
+    if(!Shift)
+      Bits=Word[0];
+    else
+    {
+      Bits=Word[0]>>Shift;
+      if(n>32-Shift)
+        Bits|=Word[1]<<(32-Shift);
+    }
+    if(n<32)
+      Bits&=(1UL<<n)-1;
+    for(i=0;i<n;i+=8)
+    {
+      *Bytes++=Bits;
+      Bits>>=8;
+    }
+    Word++;
+    Count-=n;
+  }
+}
+
+/**
+*   @brief Copy the bytes of a PDU into a range of a packed bitmap.
+*
+*   The bits are gathered 32 at a time. If the range starts at the beginning of a word the whole words are stored at once;
+*   otherwise, and for the last chunk, they are written with a mask into the words where they lie, so the bits of the bitmap
+*   out of the range are kept.
+*   @param *Map Packed bitmap
+*   @param First First bit to write
+*   @param Count Bits to write
+*   @param *Bytes The (Count+7)/8 bytes with the values, the first bit in the lowest bit of the first byte
+*   @sa Modbus_App_Read_Single_Bits_CallBack, Modbus_Read_Coils_Packed, Modbus_Read_D_Inputs_Packed
+*/
+static void Modbus_App_Bits_Set(uint32_t *Map, uint16_t First, uint16_t Count, const unsigned char *Bytes)
+{
+  uint32_t *Word=&Map[First>>5];
+  unsigned char Shift=First & 31, n, i;
+  uint32_t Bits, Mask;
+  
+  while(Count)
+  {
+    n=(Count>32) ? 32 : Count;
+    Bits=0;
+    for(i=0;i<n;i+=8)
+      Bits|=(uint32_t)*Bytes++<<i;
+    if(!Shift && n==32)
+      Word[0]=Bits;
+    else
+    {
+      Mask=(n<32) ? (1UL<<n)-1 : 0xFFFFFFFF;
+      Bits&=Mask;
+      Word[0]=(Word[0] & ~(Mask<<Shift)) | (Bits<<Shift);
+      if(Shift && n>32-Shift)
+        Word[1]=(Word[1] & ~(Mask>>(32-Shift))) | (Bits>>(32-Shift));
+    }
+    Word++;
+    Count-=n;
+  }
+}
+
 /**
 *   @brief Format of the function Write Multiple Coils
 *
@@ -1097,6 +2421,14 @@ void Modbus_App_Write_M_Coils(void)
     Modbus_App_Req_pdu[5]=Modbus_App_Actual_Req.Data[1].UI2/8;
   else
     Modbus_App_Req_pdu[5]=(Modbus_App_Actual_Req.Data[1].UI2/8)+1;
+  
+  if(Modbus_App_Actual_Req.Data[3].UC)
+  {
+    Modbus_App_Bits_Get(Modbus_App_Actual_Req.Data[2].PUI4,Modbus_App_Actual_Req.Data[4].UI2,
+                        Modbus_App_Actual_Req.Data[1].UI2,&Modbus_App_Req_pdu[6]);
+    Modbus_App_L_Req_pdu=6+Modbus_App_Req_pdu[5];
+    return;
+  }
       
   // Empaquetado de los bits; "6+k" marca la posición en el vector, "j" el índice
   // en el origen de datos además de limitar el total de Coils a empaquetar,
@@ -1235,6 +2567,13 @@ unsigned char Modbus_App_Read_Single_Bits_CallBack(void)
         return 1;
   }
   
+  if(Modbus_App_Actual_Req.Data[3].UC)
+  {
+    Modbus_App_Bits_Set(Modbus_App_Actual_Req.Data[2].PUI4,Modbus_App_Actual_Req.Data[4].UI2,
+                        Modbus_App_Actual_Req.Data[1].UI2,&Modbus_App_Msg[2]);
+    return 0;
+  }
+  
   // Desempaquetar los bits; "i+2" marca la posición en la respuesta, "k" el 
   // índice en el vector donde se guardan los bits y limita cuando se llega al 
   // total de bits, "j" desplaza el bit a la primera posición para que "& 1" 
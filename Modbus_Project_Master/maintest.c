@@ -88,7 +88,7 @@ void main(void)
         static uint16_t registers_change[125];
         static uint16_t registers_change2[125];
         static int i;//DEBUG
-        static unsigned char ant, now, intentos;      
+        static unsigned char intentos;      
         exitt = 0;        
         //SYSTEM CLOCK PLL-> 400Mhz/2 = 200Mhz / DIV_5= 40 Mhz
         //CAN CLOCK works at 8Mhz always
@@ -154,41 +154,20 @@ void main(void)
         Modbus_Read_H_Registers (1, 0, 74, data16);
         printString("M: Function 10 sent.");
         //wait answer
-        ant = 0;
         printString("///////////////////");   
         while(Modbus_Master_Communication())
         {       
-            now = getbu();
-          //  if(ant != now && now != 0)
-            if(now == 1)
-            {
-              if(getboo() == 1){
-                    ant = 0;                    
-              }
-                  ant++;                   
-                  printSimpleData(ant);                     
-                  resIn1 = getInput();              
-                  for(i =0; i < getIndex();i++)
-                      printSimpleDataSinCarro(resIn1[i]); 
-                  printString(" ");       
-                  setbu();
-                  intentos = getAttempts();
-                  if(intentos > 1)
-                      printString("Temporizador ha saltado");
-            }
         }                
         printString("///////////////////");   
-        printSimpleData(resIn1[1]);
-        printSimpleData(getbu());        
-        if(Debug_Timeout())
-        {
-            printString("M: Timeout activado");   
-        }
-        else
-        {            
-            printString("M: Data received."); 
-            printString("M: Timeout no activado");                      
-        }        
+        //last answer
+        resIn1 = getInput();              
+        for(i =0; i < getIndex();i++)
+            printSimpleDataSinCarro(resIn1[i]); 
+        printString(" ");       
+        intentos = getAttempts();
+        if(intentos > 1)
+            printString("Temporizador ha saltado");
+        printString("M: Data received."); 
         //resOut1 = getOutput();                       
         while(1){}
 }
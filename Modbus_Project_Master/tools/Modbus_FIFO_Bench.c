@@ -0,0 +1,181 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+//******************************************************************************
+// Modbus FIFO Bench
+//
+// Host program which compares the Request FIFO of the master (Master/Modbus_FIFO.c,
+// a single producer/single consumer ring with free-running Head/Tail indices
+// masked with MAX_ITEMS - 1) against the former one (an Items counter shared by
+// both sides and the indices wrapped with "% MAX_ITEMS", 255 items), copied
+// below. It is built with any C compiler of the host:
+//
+//     cc -O2 -I../Master -o Modbus_FIFO_Bench Modbus_FIFO_Bench.c ../Master/Modbus_FIFO.c
+//     Modbus_FIFO_Bench
+//
+// Both FIFOs are checked first: the items must come out in the same order they
+// went in, a full FIFO must refuse one more and an empty one must give none.
+// The speed is given in millions of operations (an enqueue or a dequeue) per
+// second for two patterns: one in, one out (the FIFO never holds more than one
+// request) and bursts which fill the FIFO and empty it. The program returns 1 if
+// a FIFO fails the check. On a host the two are close, as the division is
+// cheap there; on the target the ring also saves the UDIV of the "%", and it is
+// the one which can be filled from an interrupt.
+//******************************************************************************
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "Modbus_FIFO.h"
+
+//! Size of the former Request FIFO
+#define BASELINE_ITEMS  255
+
+//! Former Request FIFO
+struct Baseline_FIFO
+{
+  unsigned char Items;                             //!< Number of items in the FIFO
+  unsigned char Head;                              //!< Head index
+  unsigned char Tail;                              //!< Tail index
+  struct Modbus_FIFO_Item Buffer[BASELINE_ITEMS];  //!< Request petitions list
+};
+
+static void Baseline_Init (struct Baseline_FIFO *FIFO)
+{
+  FIFO->Items = FIFO->Head = FIFO->Tail = 0;
+}
+
+static unsigned char Baseline_Enqueue (struct Baseline_FIFO *FIFO, struct Modbus_FIFO_Item *Item)
+{
+  if (FIFO->Items >= BASELINE_ITEMS)
+    return 1;
+  FIFO->Items++;
+  FIFO->Buffer[FIFO->Head] = *Item;
+  FIFO->Head = (FIFO->Head + 1) % BASELINE_ITEMS;
+  return 0;
+}
+
+static unsigned char Baseline_Dequeue (struct Baseline_FIFO *FIFO, struct Modbus_FIFO_Item *Item)
+{
+  if (FIFO->Items == 0)
+    return 0;
+  FIFO->Items--;
+  *Item = FIFO->Buffer[FIFO->Tail];
+  FIFO->Tail = (FIFO->Tail + 1) % BASELINE_ITEMS;
+  return 1;
+}
+
+static struct Baseline_FIFO Baseline;
+static struct Modbus_FIFO_s Ring;
+
+//! One FIFO seen through its own functions
+struct FIFO_Ops
+{
+  const char *Name;
+  unsigned Size;
+  void (*Init) (void);
+  unsigned char (*Enqueue) (struct Modbus_FIFO_Item *Item);
+  unsigned char (*Dequeue) (struct Modbus_FIFO_Item *Item);
+};
+
+static void B_Init (void) { Baseline_Init(&Baseline); }
+static unsigned char B_Enqueue (struct Modbus_FIFO_Item *Item) { return Baseline_Enqueue(&Baseline, Item); }
+static unsigned char B_Dequeue (struct Modbus_FIFO_Item *Item) { return Baseline_Dequeue(&Baseline, Item); }
+static void R_Init (void) { Modbus_FIFO_Init(&Ring); }
+static unsigned char R_Enqueue (struct Modbus_FIFO_Item *Item) { return Modbus_FIFO_Enqueue(&Ring, Item); }
+static unsigned char R_Dequeue (struct Modbus_FIFO_Item *Item) { return Modbus_FIFO_Dequeue(&Ring, Item); }
+
+static const struct FIFO_Ops FIFOs[] =
+{
+  { "Counter and %", BASELINE_ITEMS, B_Init, B_Enqueue, B_Dequeue },
+  { "SPSC ring",     MAX_ITEMS,      R_Init, R_Enqueue, R_Dequeue },
+};
+
+//! Number of errors of the order, full and empty checks
+static unsigned Check (const struct FIFO_Ops *F)
+{
+  struct Modbus_FIFO_Item Item;
+  unsigned Errors = 0, In = 0, Out = 0, Round, i;
+
+  memset(&Item, 0, sizeof(Item));
+  F->Init();
+  if (F->Dequeue(&Item))
+    Errors++;
+  // Several rounds, so the indices wrap around
+  for (Round = 0; Round < 1000; Round++)
+  {
+    for (i = 0; i < (Round % F->Size) + 1; i++)
+    {
+      Item.Data[0].UI2 = In++;
+      if (F->Enqueue(&Item))
+        Errors++;
+    }
+    for (i = 0; i < (Round % F->Size) + 1; i++)
+      if (!F->Dequeue(&Item) || Item.Data[0].UI2 != (uint16_t)Out++)
+        Errors++;
+  }
+  for (i = 0; i < F->Size; i++)
+    if (F->Enqueue(&Item))
+      Errors++;
+  if (!F->Enqueue(&Item))
+    Errors++;
+  return Errors;
+}
+
+//! Millions of operations per second; Burst items are enqueued and then dequeued on every round
+static double Speed (const struct FIFO_Ops *F, unsigned Burst)
+{
+  struct Modbus_FIFO_Item Item;
+  unsigned long Rounds = 1000, r;
+  unsigned i;
+  volatile unsigned Sink = 0;
+  clock_t Start, Time;
+
+  memset(&Item, 0, sizeof(Item));
+  F->Init();
+  // The rounds double until the time is long enough to be measured
+  for (;;)
+  {
+    Start = clock();
+    for (r = 0; r < Rounds; r++)
+    {
+      for (i = 0; i < Burst; i++)
+      {
+        Item.Data[0].UI2 = i;
+        F->Enqueue(&Item);
+      }
+      for (i = 0; i < Burst; i++)
+      {
+        F->Dequeue(&Item);
+        Sink += Item.Data[0].UI2;
+      }
+    }
+    Time = clock() - Start;
+    if (Time > CLOCKS_PER_SEC / 4)
+      break;
+    Rounds *= 2;
+  }
+  (void)Sink;
+  return 2.0 * Rounds * Burst / 1e6 / ((double)Time / CLOCKS_PER_SEC);
+}
+
+int main (void)
+{
+  unsigned Errors = 0, Failed, Burst, f;
+
+  // The bursts fill the smaller FIFO, so both do the same work
+  Burst = MAX_ITEMS < BASELINE_ITEMS ? MAX_ITEMS : BASELINE_ITEMS;
+  for (f = 0; f < sizeof(FIFOs) / sizeof(FIFOs[0]); f++)
+  {
+    printf("%s (%u items of %u bytes)\n", FIFOs[f].Name, FIFOs[f].Size, (unsigned)sizeof(struct Modbus_FIFO_Item));
+    Failed = Check(&FIFOs[f]);
+    if (Failed)
+    {
+      printf("  %u errors\n", Failed);
+      Errors++;
+      continue;
+    }
+    printf("  Conformance OK\n");
+    printf("  One in, one out:    %8.1f Mops/s\n", Speed(&FIFOs[f], 1));
+    printf("  Bursts of %3u:      %8.1f Mops/s\n", Burst, Speed(&FIFOs[f], Burst));
+  }
+  return Errors ? 1 : 0;
+}
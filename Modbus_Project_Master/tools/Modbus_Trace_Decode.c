@@ -0,0 +1,261 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+//******************************************************************************
+// Modbus Trace Decoder
+//
+// Host program which turns a dump of the trace ring of the master
+// (Modbus_Trace_Export) into the latency of every stage of every request and a
+// summary per function code. It is built apart from the firmware, with any C
+// compiler of the host:
+//
+//     cc -o Modbus_Trace_Decode Modbus_Trace_Decode.c
+//     Modbus_Trace_Decode dump.bin
+//
+// The stages of a request, in microseconds:
+//   Queue   enqueue to dequeue
+//   Start   dequeue to first byte sent (first attempt)
+//   Tx      first to last byte sent (last attempt)
+//   Turn    last byte sent to first byte of the answer
+//   Rx      first byte of the answer to answer complete
+//   Done    answer complete (or last byte sent if there is no answer) to callback done
+//   Total   enqueue to callback done
+// A stage which cannot be known (no answer, merged read, record overwritten)
+// is shown as "-".
+//******************************************************************************
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+//! Stages recorded by the master, as in enum Modbus_Trace_Event
+enum { ENQUEUE, DEQUEUE, TX_FIRST, TX_LAST, RX_FIRST, RX_COMPLETE, CALLBACK, EVENTS };
+
+//! Stages of the breakdown
+enum { QUEUE, START, TX, TURN, RX, DONE, TOTAL, STAGES };
+
+//! Requests followed at the same time
+#define OPEN_REQUESTS   64
+//! Function codes
+#define FUNCTIONS       256
+
+static const char *Stage_Names[STAGES] = { "Queue", "Start", "Tx", "Turn", "Rx", "Done", "Total" };
+static const char *Outcome_Names[] = { "OK", "EXCEPTION", "TIMEOUT", "CRC", "EXPIRED", "DOWN" };
+
+//! One request being followed
+struct Request
+{
+  int Used;
+  unsigned Handle, Slave, Function, Attempts;
+  int Seen[EVENTS];
+  uint64_t Time[EVENTS];              // TX_FIRST and the later stages are of the last attempt
+  uint64_t Start;                     // First byte sent of the first attempt
+  uint64_t Touched;                   // Last record of the request
+};
+
+//! Statistics of one stage of one function code
+struct Summary
+{
+  unsigned long Count;
+  double Sum, Min, Max;
+};
+
+static struct Request Open[OPEN_REQUESTS];
+static struct Summary Summaries[FUNCTIONS][STAGES];
+static unsigned long Finished[FUNCTIONS][6];
+static double Clocks_Per_Us;
+
+static uint32_t Get_32 (const unsigned char *Data)
+{
+  return Data[0] | Data[1] << 8 | (uint32_t)Data[2] << 16 | (uint32_t)Data[3] << 24;
+}
+
+//! Request with that handle, slave and function, or a new one
+static struct Request *Find (unsigned Handle, unsigned Slave, unsigned Function, int Event,
+                             unsigned Attempt)
+{
+  struct Request *Free = 0;
+  int i;
+
+  for (i = 0; i < OPEN_REQUESTS; i++)
+  {
+    if (Open[i].Used && Open[i].Handle == Handle && Open[i].Slave == Slave &&
+        Open[i].Function == Function)
+    {
+      // A new request with the same handle: the handles wrapped, or handle 0
+      // (merged reads and probes), which never get their callback record
+      if (Event == ENQUEUE || (Handle == 0 && Event == TX_FIRST && Attempt <= Open[i].Attempts))
+        break;
+      return &Open[i];
+    }
+    if (!Free || (Free->Used && (!Open[i].Used || Open[i].Touched < Free->Touched)))
+      Free = &Open[i];
+  }
+  // Otherwise a free slot or, if there is none, the request not seen for longest
+  if (i < OPEN_REQUESTS)
+    Free = &Open[i];
+  memset(Free, 0, sizeof(*Free));
+  Free->Used = 1;
+  Free->Handle = Handle;
+  Free->Slave = Slave;
+  Free->Function = Function;
+  return Free;
+}
+
+//! Time in microseconds between two stages, negative if it is not known
+static double Between (struct Request *Request, int From, int To)
+{
+  if (!Request->Seen[From] || !Request->Seen[To] || Request->Time[To] < Request->Time[From])
+    return -1;
+  return (Request->Time[To] - Request->Time[From]) / Clocks_Per_Us;
+}
+
+static void Print_Request (struct Request *Request, unsigned Outcome, unsigned Exception)
+{
+  double Stage[STAGES];
+  int i;
+
+  Stage[QUEUE] = Between(Request, ENQUEUE, DEQUEUE);
+  Stage[START] = -1;
+  if (Request->Seen[DEQUEUE] && Request->Attempts && Request->Start >= Request->Time[DEQUEUE])
+    Stage[START] = (Request->Start - Request->Time[DEQUEUE]) / Clocks_Per_Us;
+  Stage[TX] = Between(Request, TX_FIRST, TX_LAST);
+  Stage[TURN] = Between(Request, TX_LAST, RX_FIRST);
+  Stage[RX] = Between(Request, RX_FIRST, RX_COMPLETE);
+  Stage[DONE] = Request->Seen[RX_COMPLETE] ? Between(Request, RX_COMPLETE, CALLBACK)
+                                           : Between(Request, TX_LAST, CALLBACK);
+  Stage[TOTAL] = Between(Request, ENQUEUE, CALLBACK);
+
+  printf("%6u %5u %4u %4u %-9s", Request->Handle, Request->Slave, Request->Function,
+         Request->Attempts, Outcome < 6 ? Outcome_Names[Outcome] : "?");
+  for (i = 0; i < STAGES; i++)
+  {
+    if (Stage[i] < 0)
+      printf(" %10s", "-");
+    else
+    {
+      struct Summary *Summary = &Summaries[Request->Function][i];
+      printf(" %10.1f", Stage[i]);
+      if (!Summary->Count || Stage[i] < Summary->Min)
+        Summary->Min = Stage[i];
+      if (!Summary->Count || Stage[i] > Summary->Max)
+        Summary->Max = Stage[i];
+      Summary->Sum += Stage[i];
+      Summary->Count++;
+    }
+  }
+  if (Outcome == 1)
+    printf("  exception %u", Exception);
+  printf("\n");
+  if (Outcome < 6)
+    Finished[Request->Function][Outcome]++;
+}
+
+int main (int argc, char **argv)
+{
+  FILE *File;
+  unsigned char Header[20], Data[32];
+  uint32_t Total, Count, Clock_Hz, n, Clock, Last = 0;
+  uint64_t Time = 0;
+  unsigned Record_Size, Handle, Slave, Function, Event, Attempt, Outcome, Exception, f;
+  struct Request *Request;
+  int i;
+
+  if (argc != 2)
+  {
+    fprintf(stderr, "Usage: %s dump.bin\n", argv[0]);
+    return 2;
+  }
+  File = fopen(argv[1], "rb");
+  if (!File)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  if (fread(Header, 1, 20, File) != 20 || memcmp(Header, "MBTR", 4) != 0)
+  {
+    fprintf(stderr, "%s: not a Modbus trace dump\n", argv[1]);
+    return 1;
+  }
+  Record_Size = Header[5];
+  Total = Get_32(&Header[8]);
+  Count = Get_32(&Header[12]);
+  Clock_Hz = Get_32(&Header[16]);
+  if (Header[4] != 1 || Record_Size < 12 || Record_Size > sizeof(Data) || !Clock_Hz)
+  {
+    fprintf(stderr, "%s: version %u of the trace not supported\n", argv[1], Header[4]);
+    return 1;
+  }
+  Clocks_Per_Us = Clock_Hz / 1000000.0;
+  printf("%lu records, %lu lost, %lu Hz\n\n", (unsigned long)Count,
+         (unsigned long)(Total - Count), (unsigned long)Clock_Hz);
+  printf("%6s %5s %4s %4s %-9s", "Handle", "Slave", "Fn", "Try", "Outcome");
+  for (i = 0; i < STAGES; i++)
+    printf(" %10s", Stage_Names[i]);
+  printf("\n");
+
+  for (n = 0; n < Count; n++)
+  {
+    if (fread(Data, 1, Record_Size, File) != Record_Size)
+    {
+      fprintf(stderr, "%s: dump cut after %lu records\n", argv[1], (unsigned long)n);
+      break;
+    }
+    // The clock wraps around; the records are in order, so only the difference counts
+    Clock = Get_32(&Data[0]);
+    if (n)
+      Time += (int32_t)(Clock - Last) > 0 ? (uint32_t)(Clock - Last) : 0;
+    Last = Clock;
+
+    Handle = Data[4] | Data[5] << 8;
+    Slave = Data[6];
+    Function = Data[7];
+    Event = Data[8];
+    Attempt = Data[9];
+    Outcome = Data[10];
+    Exception = Data[11];
+    if (Event >= EVENTS)
+      continue;
+
+    Request = Find(Handle, Slave, Function, Event, Attempt);
+    Request->Touched = Time;
+    if (Event == TX_FIRST)
+    {
+      // New attempt: the stages of the previous one do not count
+      if (!Request->Attempts)
+        Request->Start = Time;
+      if (Attempt > Request->Attempts)
+        Request->Attempts = Attempt;
+      Request->Seen[TX_LAST] = Request->Seen[RX_FIRST] = Request->Seen[RX_COMPLETE] = 0;
+    }
+    Request->Time[Event] = Time;
+    Request->Seen[Event] = 1;
+    if (Event == CALLBACK)
+    {
+      Print_Request(Request, Outcome, Exception);
+      Request->Used = 0;
+    }
+  }
+  fclose(File);
+
+  printf("\nMicroseconds per function code: count avg (min-max)\n");
+  for (f = 0; f < FUNCTIONS; f++)
+  {
+    unsigned long Requests = 0;
+    for (i = 0; i < 6; i++)
+      Requests += Finished[f][i];
+    if (!Requests)
+      continue;
+    printf("Function %u: %lu requests", f, Requests);
+    for (i = 0; i < 6; i++)
+      if (Finished[f][i])
+        printf(", %lu %s", Finished[f][i], Outcome_Names[i]);
+    printf("\n");
+    for (i = 0; i < STAGES; i++)
+    {
+      struct Summary *Summary = &Summaries[f][i];
+      if (Summary->Count)
+        printf("  %-6s %6lu %10.1f (%.1f-%.1f)\n", Stage_Names[i], Summary->Count,
+               Summary->Sum / Summary->Count, Summary->Min, Summary->Max);
+    }
+  }
+  return 0;
+}
@@ -14,6 +14,26 @@ enum Modbus_Comm_Modes
     MODBUS_CAN_MODE,    //!< CAN communication
     CDEFAULT       //!< Serial communication
 };
+
+//! Counters of the Diagnostics function (8), in the order of their sub-functions.
+enum Modbus_App_Diag_Counters
+{
+    MODBUS_DIAG_BUS_MESSAGES,   //!< Sub-function 0x0B: messages detected on the bus, with or without errors (RTU); complete requests (CAN)
+    MODBUS_DIAG_BUS_ERRORS,     //!< Sub-function 0x0C: messages thrown away by CRC, parity or sequence errors, each one counted once
+    MODBUS_DIAG_EXCEPTIONS,     //!< Sub-function 0x0D: exception responses sent
+    MODBUS_DIAG_SLAVE_MESSAGES, //!< Sub-function 0x0E: requests addressed to this slave, broadcasts included
+    MODBUS_DIAG_NO_RESPONSES,   //!< Sub-function 0x0F: requests not answered (broadcasts)
+    MODBUS_DIAG_OVERRUNS,       //!< Sub-function 0x12: frames thrown away by a character overrun
+    MODBUS_DIAG_COUNTERS        //!< Amount of counters
+};
+
+//! 32 bits words of a packed bitmap of _Bits_ coils or discrete inputs
+#define MODBUS_BITMAP_WORDS(Bits)      (((Bits) + 31) / 32)
+//! Value (0/1) of the address _n_ of a packed bitmap
+#define MODBUS_BIT_GET(Map, n)         (((Map)[(n) >> 5] >> ((n) & 31)) & 1)
+//! Set the address _n_ of a packed bitmap to _Value_ (0/1)
+#define MODBUS_BIT_SET(Map, n, Value)  ((Map)[(n) >> 5] = ((Map)[(n) >> 5] & ~(1UL << ((n) & 31))) | \
+                                        ((uint32_t)((Value) & 1) << ((n) & 31)))
 //! @}
 
 #if OSL_Mode
@@ -41,5 +61,7 @@ void Modbus_App_Manage_Request (void);
 void Modbus_App_Receive_Char (unsigned char Msg,unsigned char i);
 void Modbus_App_L_Msg_Set(unsigned char Index);
 void Modbus_App_Send(void);
+void Modbus_App_Diag_Count(enum Modbus_App_Diag_Counters Counter);
+void Modbus_Slave_Packed_Bits(uint32_t *Coils, uint32_t *D_Inputs);
 
 #endif // __Modbus_App_H__
\ No newline at end of file
@@ -14,6 +14,7 @@
 #include "driverlib/interrupt.h"
 #include "Modbus_App.h"
 #include "Modbus_CAN.h"
+#include "Modbus_Latency.h"
 
 //GLOBAL VARIABLES:
 //-SYSTEM
@@ -35,20 +36,39 @@ static  unsigned char input_pdu[MAX_PDU];
 static unsigned char modbus_index;
 //!Variable to store the buffer input data.
 static unsigned char buffer_input_pdu[MAX_FRAME];
+//! Next message object to read in each receive chain (unicast and broadcast), counted from the first one of the chain.
+static unsigned char modbus_rx_next[2];
+#if MODBUS_CAN_SEQUENCE
+//! Total length announced by the long request being received, 0 if no beginning was received.
+static uint16_t modbus_expected_length;
+#endif
 
 //-CAN
 //!Variable used to store the bit rate of the communications.
 static enum  Modbus_CAN_BitRate modbus_bit_rate;
 //! Variable used to store both bit time and rate information.
 static tCANBitClkParms modbus_canbit;
-//! Waiting time in cycles*3 between sendings.
-static unsigned long modbus_delay;
 //! Receive Message Object.
 static  tCANMsgObject RxObject;
-//! Transmit Message Object.
-static  tCANMsgObject TxObject;
+//! One segment (CAN frame) waiting in the TX queue.
+struct Modbus_CAN_Segment
+{
+        unsigned long id;                       //!< Message ID, header + slave
+        unsigned char length;                   //!< Data length
+        unsigned char data[MAX_FRAME];          //!< Data
+};
+//! TX queue; segments waiting for a transmit message object.
+static  struct Modbus_CAN_Segment modbus_tx_queue[MODBUS_CAN_TX_QUEUE];
+//! TX queue head, only written by Modbus_CAN_FixOutput().
+static  volatile unsigned char modbus_tx_head;
+//! TX queue tail, only written when a batch was sent.
+static  volatile unsigned char modbus_tx_tail;
+//! Segments loaded in the transmit message objects, 0 if they are free.
+static  volatile unsigned char modbus_tx_batch;
 //! @}
 
+static void Modbus_CAN_TX_Start(void);
+
 void Modbus_CAN_IntHandler(void)
 {
     unsigned long can_status, can_sts_status;
@@ -84,33 +104,31 @@ void Modbus_CAN_IntHandler(void)
         }            
         CANIntClear(MODBUS_CAN, can_status);
     }
-    else if(can_status >= 1 && can_status <= 16)
+    else if(can_status >= 1 && can_status <= MODBUS_CAN_TX_OBJECTS)
     {
-        //LAST SENDING message object should have the interruption pending, so last data was sent             
+        //LAST SENDING message object of the batch should have the interruption pending, so the whole batch was sent             
         CANIntClear(MODBUS_CAN, can_status);//clear interruption        
-        // I  notify that I sent the data correctly
-        //modbus_complete_transmission = 1;
+        if(can_status == modbus_tx_batch)
+        {
+            modbus_tx_tail += modbus_tx_batch;
+            modbus_tx_batch = 0;
+            // I  notify that I sent the data correctly
+            //modbus_complete_transmission = 1;
+            //Next segments waiting in the TX queue, if any
+            Modbus_CAN_TX_Start();
+        }
     }
-    else if(can_status == 17) // Message 17 gets the unicasts
+    else if(can_status >= MODBUS_CAN_RX_OBJECT && can_status < MODBUS_CAN_RX_OBJECT + MODBUS_CAN_RX_UNICAST_OBJECTS + MODBUS_CAN_RX_BROADCAST_OBJECTS)
     {                    
+        //Unicast FIFO first, then broadcast FIFO
         if(!modbus_complete_reception)
         {
             ledOn();
-            modbus_broadcast = 0;
             Modbus_CAN_CallBack();                     
             ledOff();
         }
-      
-    }
-    else if(can_status == 18) //Message 18 gets the broadcasts
-    {      
-      if(!modbus_complete_reception)
-      {  
-          ledOn();
-          modbus_broadcast = 1;
-          Modbus_CAN_CallBack();               
-          ledOff();
-      }
+        //If a request is waiting to be processed, the next segments stay in the FIFO until the controller drains them
+        CANIntClear(MODBUS_CAN, can_status);
     }
     else
     {
@@ -128,6 +146,7 @@ void Modbus_CAN_Init(enum Modbus_CAN_BitRate bit_rate, unsigned char slave_numbe
                 //////////Variables//////////
 		slave = slave_number;      
                 //modbus_complete_transmission = 0;               
+                modbus_tx_head = modbus_tx_tail = modbus_tx_batch = 0;
                 modbus_bit_rate = bit_rate;
                 //set bit timing, bit rate and delay
                 Modbus_CAN_SetBitRate(modbus_bit_rate);                                
@@ -173,33 +192,93 @@ void Modbus_CAN_SetBitRate(enum Modbus_CAN_BitRate bit_rate)
                           modbus_canbit.ulPhase2Seg = 4;
                           modbus_canbit.ulSJW = 4;
                           modbus_canbit.ulQuantumPrescaler = 8;
-                          /*(4000000/3) * 0.07 *10 = 9333333 ("TRANSFER TIME"); 
-                             900000 * 4 = process time
-                          */
-                          modbus_delay = 9333333 + 900000*4; // 10 times slower THAN 1MBPS
                           break;
             case MODBUS_1MBPS:
                           modbus_canbit.ulSyncPropPhase1Seg = 5;      //3 *tq; following the example from the microcontroller's pdf
                           modbus_canbit.ulPhase2Seg = 2;
                           modbus_canbit.ulSJW = 2;
                           modbus_canbit.ulQuantumPrescaler = 1;
-                          /*(4000000/3) * 0.07 = 933333 ("TRANSFER TIME"); 
-                            900000*4 = process time
-                          */
-                          modbus_delay = 933333 + 900000*4; 
                           break;
             default : Modbus_CAN_Error_Management(110); break;
       }
 }
 
+/**
+*     @brief Function to load the next segments into the transmit message objects.
+*
+*     If the transmit message objects are free, up to MODBUS_CAN_TX_OBJECTS segments are loaded from the TX queue into the message
+*     objects 1, 2, 3... As the CAN controller sends first the lowest message object, they leave in order and only the last one
+*     needs the TX interruption: when it arrives, the whole batch was sent.
+*     @note It is called from the CAN interrupt or with the CAN interrupt disabled.
+*/
+static void Modbus_CAN_TX_Start(void)
+{
+        unsigned char pending, obj;
+        struct Modbus_CAN_Segment *segment;
+        tCANMsgObject tx_object;
+        if(modbus_tx_batch)
+                return; //The message objects are still busy
+        pending = (unsigned char)(modbus_tx_head - modbus_tx_tail);
+        if(pending > MODBUS_CAN_TX_OBJECTS)
+                pending = MODBUS_CAN_TX_OBJECTS;
+        modbus_tx_batch = pending;
+        tx_object.ulMsgIDMask = 0x000;//It's not used mask, I send all messages without filtering
+        for(obj = 1; obj <= pending; obj++)
+        {
+                segment = &modbus_tx_queue[(unsigned char)(modbus_tx_tail + obj - 1) & (MODBUS_CAN_TX_QUEUE - 1)];
+                tx_object.ulMsgID = segment->id;
+                tx_object.ulMsgLen = segment->length;
+                tx_object.pucMsgData = segment->data;
+                // Only the last one of the batch uses INTERRUPTIONS
+                tx_object.ulFlags = (obj == pending) ? MSG_OBJ_TX_INT_ENABLE : MSG_OBJ_NO_FLAGS;
+#if MODBUS_CAN_SEQUENCE
+                tx_object.ulFlags |= MSG_OBJ_EXTENDED_ID;
+#endif
+                CANMessageSet(MODBUS_CAN, obj, &tx_object, MSG_OBJ_TYPE_TX);
+#if MODBUS_LATENCY
+                //Individual Frame or Beginning Long Frame: first byte of an answer
+                if(!(segment->id & 0x400))
+                        Modbus_Latency_First_Byte();
+#endif
+        }
+}
+
+/**
+*     @brief Function to add a segment to the TX queue.
+*
+*     If the TX queue is full, it waits until the CAN interrupt makes room for it.
+*     @param id Message ID (header + slave).
+*     @param data Segment data.
+*     @param length Segment length (up to MAX_FRAME).
+*/
+static void Modbus_CAN_TX_Enqueue(unsigned long id, unsigned char *data, unsigned char length)
+{
+        int i;
+        struct Modbus_CAN_Segment *segment;
+        while((unsigned char)(modbus_tx_head - modbus_tx_tail) >= MODBUS_CAN_TX_QUEUE)
+        {
+                //Full; the queue is being emptied by the CAN interrupt
+                IntDisable(INT_CAN0);
+                Modbus_CAN_TX_Start();
+                IntEnable(INT_CAN0);
+        }
+        segment = &modbus_tx_queue[modbus_tx_head & (MODBUS_CAN_TX_QUEUE - 1)];
+        segment->id = id;
+        segment->length = length;
+        for(i=0; i < length; i++)
+        {
+                segment->data[i] = data[i];
+        }
+        modbus_tx_head++;
+}
+
 void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char pdu_length)
 {
-	unsigned char aux_length;
-        unsigned char local_output[MAX_FRAME];
-        int i, iterations, objNumber;
+	unsigned char aux_length, frame_length;
+        int iterations;
         uint16_t registerr;                  
+        unsigned long id;
             //init variables
-            objNumber = 1;                     
             iterations = 0;  
             aux_length = pdu_length;        
             //storing in global variables                   
@@ -210,7 +289,6 @@ void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char pdu_length)
             // 010 + slave = Beginning Long Frame (1)
             // 100 + slave = Continuation Long Frame (4)
             // 110 + slave = End Long Frame (6)
-            TxObject.ulMsgIDMask = 0x000;//It's not used mask, I send all messages without filtering                                       
             while(aux_length) // != 0 true
             {                
                 registerr = 0x000;
@@ -221,16 +299,7 @@ void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char pdu_length)
                     {              
                           registerr = 0x0;                               
                     }                    
-                    TxObject.ulMsgID = ((registerr << 8) | slave);
-                    TxObject.ulFlags = MSG_OBJ_TX_INT_ENABLE;
-                    TxObject.ulMsgLen = aux_length;      
-                    
-                    for(i=0; i < aux_length; i++)
-                    {
-                        local_output[i] = mb_req_pdu[i + (iterations * MAX_FRAME)];                             
-                    }                    
-                    aux_length -= aux_length;// it should be 0 now                      
-                    ledOff();                    
+                    frame_length = aux_length;
                 }
                 else //division needed because it's > 8 bits
                 {
@@ -241,62 +310,126 @@ void Modbus_CAN_FixOutput(unsigned char *mb_req_pdu, unsigned char pdu_length)
                     {
                         registerr = 0x2;
                     }
-                    TxObject.ulMsgID = ((registerr << 8) | slave);                    
-                    TxObject.ulFlags = MSG_OBJ_NO_FLAGS;
-                    TxObject.ulMsgLen = MAX_FRAME;
-                    for(i=0; i < MAX_FRAME; i++)
-                    {
-                        local_output[i] = mb_req_pdu[i + (iterations * MAX_FRAME)];                        
-                    }
-                    aux_length -= MAX_FRAME;                    
-                    iterations++;                    
+                    frame_length = MAX_FRAME;
                 }                             
-                TxObject.pucMsgData = local_output;
-                CANMessageSet(MODBUS_CAN, objNumber, &TxObject, MSG_OBJ_TYPE_TX);
-                // If it is not the last frame
-                if(aux_length)
-                    Modbus_CAN_Delay();
+                id = (registerr << 8) | slave;
+#if MODBUS_CAN_SEQUENCE
+                //Chunk number and total length in the 29-bits message ID
+                id |= ((unsigned long)iterations << MODBUS_CAN_SEQ_SHIFT) | ((unsigned long)pdu_length << MODBUS_CAN_LENGTH_SHIFT);
+#endif
+                Modbus_CAN_TX_Enqueue(id, &mb_req_pdu[iterations * MAX_FRAME], frame_length);
+                aux_length -= frame_length;
+                iterations++;                    
             }        
+            //The segments leave from the CAN interrupt; I do not wait for them
+            IntDisable(INT_CAN0);
+            Modbus_CAN_TX_Start();
+            IntEnable(INT_CAN0);
+            ledOff();                    
 }
 
 void Modbus_CAN_ReceptionConfiguration(void)
 {
         // It is required to receive unicast frames from Master (P/R = 1)+slave
         // and broadcast frames from Master (P/R = 1) + 0
-        int objNumber = 17;        
+        int i;        
         modbus_complete_reception = 0;
-       //RECEPTION MESSAGE OBJECT num.17 UNICAST num.18 BROADCAST              
+#if MODBUS_CAN_SEQUENCE
+        modbus_expected_length = 0;
+#endif
+       //RECEPTION FIFO UNICAST (from num.17) and FIFO BROADCAST (after the unicast one)              
         RxObject.ulMsgID = (0x1 << 8) | slave; //xx1+ slave
         RxObject.ulMsgIDMask = 0x1FF;
-        RxObject.ulFlags = MSG_OBJ_USE_ID_FILTER | MSG_OBJ_RX_INT_ENABLE;
         RxObject.pucMsgData = &buffer_input_pdu[0];
-        CANMessageSet(MODBUS_CAN, objNumber, &RxObject, MSG_OBJ_TYPE_RX);
-        //MESSAGE OBJECT 18
-        objNumber = 18;
+        for(i = 0; i < MODBUS_CAN_RX_UNICAST_OBJECTS; i++)
+        {
+                //The last message object of the chain has not the FIFO bit
+                RxObject.ulFlags = MSG_OBJ_USE_ID_FILTER | MSG_OBJ_RX_INT_ENABLE;
+#if MODBUS_CAN_SEQUENCE
+                //Only 29-bits message IDs; the mask still looks at the 9 lower bits
+                RxObject.ulFlags |= MSG_OBJ_EXTENDED_ID | MSG_OBJ_USE_EXT_FILTER;
+#endif
+                if(i < MODBUS_CAN_RX_UNICAST_OBJECTS - 1)
+                        RxObject.ulFlags |= MSG_OBJ_FIFO;
+                CANMessageSet(MODBUS_CAN, MODBUS_CAN_RX_OBJECT + i, &RxObject, MSG_OBJ_TYPE_RX);
+        }
+        //BROADCAST FIFO
         RxObject.ulMsgID = (0x1 << 8) | 0; //xx1+ slave=0 
-        CANMessageSet(MODBUS_CAN, objNumber, &RxObject, MSG_OBJ_TYPE_RX);
+        for(i = 0; i < MODBUS_CAN_RX_BROADCAST_OBJECTS; i++)
+        {
+                RxObject.ulFlags = MSG_OBJ_USE_ID_FILTER | MSG_OBJ_RX_INT_ENABLE;
+#if MODBUS_CAN_SEQUENCE
+                //Only 29-bits message IDs; the mask still looks at the 9 lower bits
+                RxObject.ulFlags |= MSG_OBJ_EXTENDED_ID | MSG_OBJ_USE_EXT_FILTER;
+#endif
+                if(i < MODBUS_CAN_RX_BROADCAST_OBJECTS - 1)
+                        RxObject.ulFlags |= MSG_OBJ_FIFO;
+                CANMessageSet(MODBUS_CAN, MODBUS_CAN_RX_OBJECT + MODBUS_CAN_RX_UNICAST_OBJECTS + i, &RxObject, MSG_OBJ_TYPE_RX);
+        }
 }
 
-void Modbus_CAN_CallBack(void)
+#if MODBUS_CAN_SEQUENCE
+/**
+*     @brief Function to check the chunk number and total length of the segment read in RxObject.
+*
+*     The chunk number has to be the next one of the request and the total length the one announced by the beginning. If a chunk is
+*     missing, the request is thrown away; the master will resend it. Chunks of a long request whose beginning was not received are
+*     thrown away too.
+*     @return <b>0</b> if the segment has to be processed, <b>1</b> if it has to be thrown away.
+*/
+static unsigned char Modbus_CAN_Sequence_Check(void)
 {
-// I wait for xx1 | slave because the mask of the message object was 1FF;    
-    int i, numObj;
-    uint32_t new_data, mask;
-    numObj = 17;   
-    mask = 0x10000;
-    new_data = CANStatusGet(MODBUS_CAN, CAN_STS_NEWDAT);
-    if(modbus_broadcast)    
+    unsigned long header, sequence;
+    uint16_t length;
+    header = RxObject.ulMsgID & 0x700;
+    sequence = (RxObject.ulMsgID >> MODBUS_CAN_SEQ_SHIFT) & MODBUS_CAN_SEQ_MASK;
+    length = (RxObject.ulMsgID >> MODBUS_CAN_LENGTH_SHIFT) & MODBUS_CAN_LENGTH_MASK;
+    if(header == 0x100 || header == 0x300) //Individual or Beginning Long Frame
+    {
+        if(sequence != 0 || (header == 0x100 && length != RxObject.ulMsgLen))
+        {
+            modbus_expected_length = 0;
+            return 1;
+        }
+        modbus_expected_length = (header == 0x300) ? length : 0;
+        return 0;
+    }
+    if(!modbus_expected_length)
+        return 1; //Rest of a request already thrown away, or its beginning was lost
+    if(sequence != (modbus_index / MAX_FRAME) || length != modbus_expected_length
+       || (header == 0x700 && modbus_index + RxObject.ulMsgLen != modbus_expected_length))
     {
-        numObj = 18;    
-        mask = 0x20000;
+        //A chunk is missing: the request is thrown away
+        modbus_expected_length = 0;
+        modbus_index = 0;
+        return 1;
     }
-    if(( (new_data & mask) >> (numObj-1) ) == 1)//is there new data?
-    {              
-        CANMessageGet(MODBUS_CAN, numObj, &RxObject, true);       
+    if(header == 0x700)
+        modbus_expected_length = 0;
+    return 0;
+}
+#endif
+
+/**
+*     @brief Function to process the segment read in RxObject.
+*/
+static void Modbus_CAN_Segment_Process(void)
+{
+    int i;
+#if MODBUS_CAN_SEQUENCE
+        if(Modbus_CAN_Sequence_Check())
+        {
+            Modbus_App_Diag_Count(MODBUS_DIAG_BUS_ERRORS);
+            return;
+        }
+#endif
         //header should be 001:
         if( (RxObject.ulMsgID & 0x700) == 0x100) //Individual Frame
         {
               modbus_complete_reception = 1; 
+#if MODBUS_LATENCY
+              Modbus_Latency_Frame_End();
+#endif
               input_length = RxObject.ulMsgLen;
               modbus_index = input_length;//not needed
               for(i=0; i < RxObject.ulMsgLen; i++)
@@ -323,18 +456,77 @@ void Modbus_CAN_CallBack(void)
               if( (RxObject.ulMsgID & 0x700) == 0x700) // END LONG FRAME
               {                  
                   modbus_complete_reception = 1;  
+#if MODBUS_LATENCY
+                  Modbus_Latency_Frame_End();
+#endif
                   input_length = modbus_index;        
               }
         }                                  
         else
         {     // IT WAS EXPECTED A CONTINUATION OR AN END; IT SHOULD NOT ENTER HERE
+              Modbus_App_Diag_Count(MODBUS_DIAG_BUS_ERRORS);
               Modbus_SetMainState(MODBUS_ERROR);
         }        
+}
+
+/**
+*     @brief Function to drain a chain of receive message objects.
+*
+*     The CAN controller stores every segment in the lowest message object of the chain without new data, so an object already read
+*     can be filled again while a higher one is still waiting. The chain is read in FIFO order: from the object after the last one
+*     read up to the end of the chain, and only then from its beginning, until there is no new data left or a request is complete;
+*     in the last case, the rest of segments stay in the FIFO and the next call goes on from there. When the chain is empty the
+*     controller starts again from its first object, and so does the reading.
+*     @param first First message object of the chain.
+*     @param count Message objects of the chain.
+*     @param broadcast 1 if the chain receives broadcast requests.
+*/
+static void Modbus_CAN_RX_Drain(int first, int count, unsigned char broadcast)
+{
+    int i;
+    uint32_t pending;
+    unsigned char *next = &modbus_rx_next[broadcast];
+    while(!modbus_complete_reception)
+    {
+        pending = (CANStatusGet(MODBUS_CAN, CAN_STS_NEWDAT) >> (first - 1)) & ((1UL << count) - 1);
+        if(!pending)//is there new data?
+        {
+            *next = 0;
+            break;
+        }
+        //The oldest segment is the first one from the next object to the end of the chain, or else from its beginning
+        for(i = *next; i < count && !(pending & (1UL << i)); i++);
+        if(i == count)
+            for(i = 0; !(pending & (1UL << i)); i++);
+        *next = (i + 1 < count) ? i + 1 : 0;
+        CANMessageGet(MODBUS_CAN, first + i, &RxObject, true);       
+        if(RxObject.ulFlags & MSG_OBJ_DATA_LOST) //a segment was overwritten before it was read
+            Modbus_App_Diag_Count(MODBUS_DIAG_OVERRUNS);
+        modbus_broadcast = broadcast;
+        Modbus_CAN_Segment_Process();
+        if(modbus_complete_reception)
+        {
+            Modbus_App_Diag_Count(MODBUS_DIAG_BUS_MESSAGES);
+            Modbus_App_Diag_Count(MODBUS_DIAG_SLAVE_MESSAGES);
+            if(broadcast)
+                Modbus_App_Diag_Count(MODBUS_DIAG_NO_RESPONSES);
+        }
     }
-    else
-    {   // IT WAS EXPECTED NEW DATA; IT SHOULD NOT ENTER HERE
-        Modbus_SetMainState(MODBUS_ERROR);
-    }    
+}
+
+/**
+*     @brief Function called by the CAN interrupt to read the segments received.
+*
+*     The diagnostic counters (function 8) are kept here: every request complete counts as a bus message and a slave message, and the
+*     broadcasts as no response too; the segments out of sequence count as communication errors and the segments lost by the message
+*     objects as overruns. The controller only accepts the segments of this slave, so the requests of others are not counted.
+*     @sa Modbus_App_Diag_Count
+*/
+void Modbus_CAN_CallBack(void)
+{
+// I wait for xx1 | slave because the mask of the message objects was 1FF;    
+    Modbus_CAN_RX_Drain(MODBUS_CAN_RX_OBJECT, MODBUS_CAN_RX_UNICAST_OBJECTS, 0);
+    Modbus_CAN_RX_Drain(MODBUS_CAN_RX_OBJECT + MODBUS_CAN_RX_UNICAST_OBJECTS, MODBUS_CAN_RX_BROADCAST_OBJECTS, 1);
 }
 
 unsigned char Modbus_CAN_Controller(void)
@@ -353,6 +545,10 @@ unsigned char Modbus_CAN_Controller(void)
         Modbus_App_Send();
       }                 
       Modbus_SetMainState(MODBUS_IDLE);                        
+      //Segments of the next request may be waiting in the FIFO
+      IntDisable(INT_CAN0);
+      Modbus_CAN_CallBack();
+      IntEnable(INT_CAN0);
       return 1;
     }
   }
@@ -363,11 +559,6 @@ unsigned char Modbus_CAN_Controller(void)
   return 0;
 }
 
-void Modbus_CAN_Delay(void)
-{
-    SysCtlDelay(modbus_delay);
-}
-
 unsigned char Modbus_CAN_BroadCast_Get(void)
 {
     return modbus_broadcast;
@@ -0,0 +1,222 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+//******************************************************************************
+//! \defgroup Latency Modbus Latency
+//! \brief Modbus Latency Module
+//!
+//! In this Module the slave measures how long the requests wait inside it. Three
+//! instants of every request are stamped: the end of the frame (the 3,5T in OSL
+//! or the last segment in CAN), the dispatch to the App module and the first
+//! byte of the answer handed to the UART or to the CAN controller. The times from
+//! the end of the frame to the other two are kept in histograms, one per
+//! function code, of MODBUS_LATENCY_BUCKETS logarithmic buckets.
+//!
+//! The histograms have a fixed size and they can be read by the master as
+//! Input Registers from MODBUS_LATENCY_BASE (function 4). Every class takes
+//! MODBUS_LATENCY_CLASS_REGISTERS registers:
+//! > - 0: Function code of the class, 0 for the rest of function codes.
+//! > - 1: Requests dispatched.
+//! > - 2-3: Longest time to the dispatch, high word first.
+//! > - 4-5: Longest time to the first byte of the answer, high word first.
+//! > - 6...: Histogram to the dispatch, then the histogram to the first byte.
+//!
+//! Only one answer is followed at the same time; if another request is
+//! dispatched before the first byte of the previous answer leaves, the previous
+//! one does not count in the first byte histogram. The counters saturate.
+//!
+//! The times are taken with Modbus_Timer_Stamp, so the Timer Wheel must run;
+//! it is started by Modbus_Latency_Init. In CAN Mode the interrupt of the
+//! _Timer 0_ must call Modbus_Timer_IntHandler, as in the master.
+//******************************************************************************
+//! @{
+
+#include "Modbus_Latency.h"
+#include "Modbus_Timer.h"
+
+#if MODBUS_LATENCY
+
+//! Function codes with their own class, the last class is for the rest
+static const unsigned char Modbus_Latency_Functions[MODBUS_LATENCY_CLASSES - 1] =
+{
+  1, 2, 3, 4, 5, 6, 15, 16, 22, 23
+};
+
+//! Histograms of every class
+static struct Modbus_Latency_Histogram Modbus_Latency_Classes[MODBUS_LATENCY_CLASSES];
+//! Stamp of the end of the last frame received
+static volatile uint32_t Modbus_Latency_End;
+//! Stamp of the end of the frame of the answer being followed
+static uint32_t Modbus_Latency_Reply_End;
+//! Class of the answer being followed
+static unsigned char Modbus_Latency_Reply_Class;
+//! 1 while the first byte of an answer is awaited
+static volatile unsigned char Modbus_Latency_Pending;
+
+//*****************************************************************************
+//
+// Latency Module functions
+//
+//*****************************************************************************
+
+//! \brief Class of a function code
+//!
+//! \param Function Function code
+//! \return Index of the class, MODBUS_LATENCY_CLASSES - 1 for the rest
+static unsigned char Modbus_Latency_Class (unsigned char Function)
+{
+  unsigned char i;
+
+  for (i = 0; i < MODBUS_LATENCY_CLASSES - 1; i++)
+    if (Modbus_Latency_Functions[i] == Function)
+      return i;
+  return MODBUS_LATENCY_CLASSES - 1;
+}
+
+//! \brief Add a time to a histogram
+//!
+//! The bucket is the amount of bits of the time, cut down to the last bucket.
+//! \param *Buckets Histogram
+//! \param *Max     Longest time of the histogram
+//! \param Time     Time in microseconds
+static void Modbus_Latency_Add (uint16_t *Buckets, uint32_t *Max, uint32_t Time)
+{
+  unsigned char Bucket = 0;
+  uint32_t Rest = Time;
+
+  while (Rest && Bucket < MODBUS_LATENCY_BUCKETS - 1)
+  {
+    Rest >>= 1;
+    Bucket++;
+  }
+  if (Buckets[Bucket] != 0xFFFF)
+    Buckets[Bucket]++;
+  if (Time > *Max)
+    *Max = Time;
+}
+
+//! \brief Latency Setup
+//!
+//! Starts the Timer Wheel, if it was not running, and clears the histograms.
+//! \sa Modbus_Slave_Init
+void Modbus_Latency_Init (void)
+{
+  Modbus_Timer_Init();
+  Modbus_Latency_Reset();
+}
+
+//! \brief Stamp the end of a frame
+//!
+//! Called when a request is complete: from the 3,5T in OSL or when the last
+//! segment arrives in CAN.
+//! \sa Modbus_OSL_Reception_Complete, Modbus_CAN_Segment_Process
+void Modbus_Latency_Frame_End (void)
+{
+  Modbus_Latency_End = Modbus_Timer_Stamp();
+}
+
+//! \brief Stamp the dispatch of a request
+//!
+//! The time from the end of its frame is added to the histogram of its function
+//! code and, if it is answered, its answer is followed until the first byte.
+//! \param Function Function code of the request
+//! \param Reply    1 if it will be answered, 0 if it is a broadcast
+//! \sa Modbus_App_Manage_Request
+void Modbus_Latency_Dispatch (unsigned char Function, unsigned char Reply)
+{
+  struct Modbus_Latency_Histogram *Histogram;
+  uint32_t End = Modbus_Latency_End;
+
+  Modbus_Latency_Pending = 0;
+  Modbus_Latency_Reply_Class = Modbus_Latency_Class(Function);
+  Histogram = &Modbus_Latency_Classes[Modbus_Latency_Reply_Class];
+  if (Histogram->Requests != 0xFFFF)
+    Histogram->Requests++;
+  Modbus_Latency_Add(Histogram->Dispatch, &Histogram->Dispatch_Max,
+                     Modbus_Timer_Stamp() - End);
+  Modbus_Latency_Reply_End = End;
+  Modbus_Latency_Pending = Reply;
+}
+
+//! \brief Stamp the first byte of an answer
+//!
+//! Nothing is done if no answer is followed.
+//! \sa Modbus_OSL_Send, Modbus_CAN_TX_Start
+void Modbus_Latency_First_Byte (void)
+{
+  struct Modbus_Latency_Histogram *Histogram;
+
+  if (!Modbus_Latency_Pending)
+    return;
+  Modbus_Latency_Pending = 0;
+  Histogram = &Modbus_Latency_Classes[Modbus_Latency_Reply_Class];
+  Modbus_Latency_Add(Histogram->First_Byte, &Histogram->First_Byte_Max,
+                     Modbus_Timer_Stamp() - Modbus_Latency_Reply_End);
+}
+
+//! \brief Get the histograms of a function code
+//!
+//! \param Function   Function code, any code without its own class gives the class of the rest
+//! \param *Histogram Where the histograms are copied
+//! \return 1 The function code has its own class
+//! \return 0 The class of the rest was copied
+unsigned char Modbus_Latency_Get (unsigned char Function, struct Modbus_Latency_Histogram *Histogram)
+{
+  unsigned char Class = Modbus_Latency_Class(Function);
+
+  *Histogram = Modbus_Latency_Classes[Class];
+  return (Class != MODBUS_LATENCY_CLASSES - 1);
+}
+
+//! \brief Input Register of the latency map
+//!
+//! \param Index Register from MODBUS_LATENCY_BASE, below MODBUS_LATENCY_REGISTERS
+//! \return Value of the register
+//! \sa Modbus_App_Read_I_Registers
+uint16_t Modbus_Latency_Register (uint16_t Index)
+{
+  unsigned char Class = Index / MODBUS_LATENCY_CLASS_REGISTERS;
+  struct Modbus_Latency_Histogram *Histogram = &Modbus_Latency_Classes[Class];
+
+  Index %= MODBUS_LATENCY_CLASS_REGISTERS;
+  switch (Index)
+  {
+    case 0:
+      return (Class < MODBUS_LATENCY_CLASSES - 1) ? Modbus_Latency_Functions[Class] : 0;
+    case 1:
+      return Histogram->Requests;
+    case 2:
+      return Histogram->Dispatch_Max >> 16;
+    case 3:
+      return Histogram->Dispatch_Max;
+    case 4:
+      return Histogram->First_Byte_Max >> 16;
+    case 5:
+      return Histogram->First_Byte_Max;
+    default:
+      Index -= 6;
+      if (Index < MODBUS_LATENCY_BUCKETS)
+        return Histogram->Dispatch[Index];
+      return Histogram->First_Byte[Index - MODBUS_LATENCY_BUCKETS];
+  }
+}
+
+//! \brief Clear the histograms
+void Modbus_Latency_Reset (void)
+{
+  unsigned char i, j;
+
+  Modbus_Latency_Pending = 0;
+  for (i = 0; i < MODBUS_LATENCY_CLASSES; i++)
+  {
+    Modbus_Latency_Classes[i].Requests = 0;
+    Modbus_Latency_Classes[i].Dispatch_Max = 0;
+    Modbus_Latency_Classes[i].First_Byte_Max = 0;
+    for (j = 0; j < MODBUS_LATENCY_BUCKETS; j++)
+    {
+      Modbus_Latency_Classes[i].Dispatch[j] = 0;
+      Modbus_Latency_Classes[i].First_Byte[j] = 0;
+    }
+  }
+}
+
+#endif
+//! @}
@@ -0,0 +1,42 @@
+// Author: Francisco Javier Guzman Jimenez, <dejavits@gmail.com>
+#ifndef __Modbus_Latency_h
+#define __Modbus_Latency_h
+
+//! \addtogroup Latency
+//! @{
+
+#include "stdint.h"
+
+//! 1 to measure the latencies of the requests, 0 to leave them out
+#define MODBUS_LATENCY                  1
+//! First Input Register of the latency map, the Input Registers of the user must stay below it
+#define MODBUS_LATENCY_BASE             0xF000
+//! Buckets of every histogram; bucket 0 counts 0 us, bucket n from 2^(n-1) us to 2^n - 1 us and the last one the rest
+#define MODBUS_LATENCY_BUCKETS          16
+//! Function codes with their own histograms, plus one class for the rest
+#define MODBUS_LATENCY_CLASSES          11
+//! Input Registers of one class: function code, requests, two maximums of 32 bits and the two histograms
+#define MODBUS_LATENCY_CLASS_REGISTERS  (6 + 2 * MODBUS_LATENCY_BUCKETS)
+//! Input Registers of the latency map
+#define MODBUS_LATENCY_REGISTERS        (MODBUS_LATENCY_CLASSES * MODBUS_LATENCY_CLASS_REGISTERS)
+
+//! Latencies of the requests of one function code, the times are in microseconds
+struct Modbus_Latency_Histogram
+{
+  uint16_t Requests;                              //!< Requests dispatched
+  uint32_t Dispatch_Max;                          //!< Longest time from the end of the frame to the dispatch
+  uint32_t First_Byte_Max;                        //!< Longest time from the end of the frame to the first byte of the answer
+  uint16_t Dispatch[MODBUS_LATENCY_BUCKETS];      //!< Histogram from the end of the frame to the dispatch
+  uint16_t First_Byte[MODBUS_LATENCY_BUCKETS];    //!< Histogram from the end of the frame to the first byte of the answer
+};
+
+void Modbus_Latency_Init (void);
+void Modbus_Latency_Frame_End (void);
+void Modbus_Latency_Dispatch (unsigned char Function, unsigned char Reply);
+void Modbus_Latency_First_Byte (void);
+unsigned char Modbus_Latency_Get (unsigned char Function, struct Modbus_Latency_Histogram *Histogram);
+uint16_t Modbus_Latency_Register (uint16_t Index);
+void Modbus_Latency_Reset (void);
+
+//! @}
+#endif
@@ -32,10 +32,11 @@
 #include "driverlib/gpio.h"
 #include "driverlib/interrupt.h"
 #include "driverlib/uart.h"
-#include "driverlib/timer.h"
 #include "Modbus_App.h"
 #include "Modbus_OSL.h"                   
 #include "Modbus_OSL_RTU.h"
+#include "Modbus_Timer.h"
+#include "Modbus_Latency.h"
 
 //*****************************************************************************
 //
@@ -73,6 +74,10 @@ static unsigned char Modbus_OSL_Slave_Adress;
 static unsigned char Modbus_OSL_Response_ADU[256];
 //! Longitud del mensaje de Salida en el Slave.
 static unsigned char Modbus_OSL_L_Response_ADU;
+//! Índice del siguiente carácter del mensaje de Salida a entregar a la UART.
+static volatile unsigned char Modbus_OSL_Tx_Index;
+//! Timer de la rueda que espera a que la UART acabe de sacar el último carácter.
+static struct Modbus_Timer Modbus_OSL_Tx_Timer;
 //! Flag de Broadcast; se activa para evitar el envío de respuesta en el Slave.
 static unsigned char Modbus_OSL_BroadCast;
 
@@ -93,6 +98,9 @@ static volatile enum Modbus_OSL_States Modbus_OSL_State;
 static unsigned char Modbus_OSL_Processing_Msg(void);
 static void Modbus_OSL_RTU_to_App (void);
 static void Modbus_OSL_Send (unsigned char *mb_rsp_pdu, unsigned char L_pdu);
+static void Modbus_OSL_Tx_Next (void);
+static void Modbus_OSL_Tx_Check (void *Arg);
+static void Modbus_OSL_Tx_Done (void);
 static unsigned char Modbus_OSL_Receive_Request(void);
 
 //*****************************************************************************
@@ -294,6 +302,7 @@ unsigned char Modbus_OSL_Init (unsigned char Slave, enum Baud Baudrate,
     GPIO_PORTF_DEN_R = 0x01;
     
     // Habilita la interrupción de la UART, para Recepción y error de paridad.
+    // La de Transmisión se habilita sólo mientras se envía un mensaje.
     UARTIntEnable(UART1_BASE, UART_INT_RX | UART_INT_PE);
     IntEnable(INT_UART1);
     
@@ -305,28 +314,41 @@ unsigned char Modbus_OSL_Init (unsigned char Slave, enum Baud Baudrate,
       case MODBUS_OSL_MODE_ASCII:
         break;
     }
+    Modbus_Timer_Setup(&Modbus_OSL_Tx_Timer, Modbus_OSL_Tx_Check, 0);
     return 0;
 }
 
 //! \brief Interrupción por Recepción de Carácter.
 //! 
-//! Esta función se activa con la interrupción de la UART1. Enciende el LED1 
-//! para indicar que se esta produciendo la comunicación, limpia el status de
-//! la interrupción y comprueba si es de error de paridad para marcar la trama
+//! Esta función se activa con la interrupción de la UART1. Limpia el status
+//! de la interrupción y, si la UART puede aceptar otro carácter del mensaje
+//! de salida, se lo entrega mediante _Modbus_OSL_Tx_Next_. Para la recepción
+//! enciende el LED1 para indicar que se esta produciendo la comunicación y
+//! comprueba si es de error de paridad para marcar la trama
 //! como NOK; en caso contrario llama a la función de interrupción RTU/ASCII  
 //! que corresponda según el modo de comunicación Serie.
 //! \sa Modbus_OSL_Frame_Set, Modbus_OSL_Mode, Modbus_OSL_RTU_UART
+//! \sa Modbus_OSL_Tx_Next
 void UART1IntHandler(void)
 {
     unsigned long ulStatus;
     
-    // Enciende el Led1.
-    GPIO_PORTF_DATA_R |= 0x01;  
-    
     // Obtiene el estado de la interrupción y lo borra.
     ulStatus = UARTIntStatus(UART1_BASE, true);
     UARTIntClear(UART1_BASE, ulStatus);
     
+    // Hueco en la UART para el siguiente carácter del mensaje de salida.
+    if(ulStatus & UART_INT_TX)
+    {
+      Modbus_OSL_Tx_Next();
+      ulStatus &= ~UART_INT_TX;
+      if(!ulStatus)
+        return;
+    }
+    
+    // Enciende el Led1.
+    GPIO_PORTF_DATA_R |= 0x01;  
+    
     // Si el estado de la interrupción es UART_INT_PE (por error de paridad)
     // marca la trama como NOK; Si no, llama a la función correspondiente.
     if ((UART_INT_PE)==ulStatus)
@@ -429,9 +451,15 @@ void Modbus_Fatal_Error(unsigned char Error)
 //! @{
 
 //! \brief Activa el Flag de Mensaje Completo Recibido.
+//!
+//! Marca además el instante de fin de trama para los histogramas de latencia.
 //! \sa Modbus_OSL_Processing_Flag,Modbus_OSL_RTU_35T,Modbus_OSL_Processing_Msg
+//! \sa Modbus_Latency_Frame_End
 void Modbus_OSL_Reception_Complete(void)
 {
+#if MODBUS_LATENCY
+  Modbus_Latency_Frame_End();
+#endif
   Modbus_OSL_Processing_Flag = 1;
 }
 
@@ -479,11 +507,15 @@ static void Modbus_OSL_RTU_to_App (void)
 //! Si existe un mensaje entrante completo se comprueba el Nº Slave para saber
 //! si debe procesarse. De ser así se comprueba el CRC y si es correcto se 
 //! envía a App para su procesado mediante _Modbus_OSL_RTU_Control_CRC_ y se
-//! vuelve al estado _MODBUS_OSL_IDLE_ para seguir recibiendo mensajes
+//! vuelve al estado _MODBUS_OSL_IDLE_ para seguir recibiendo mensajes.
+//! Para los diagnósticos (función 8) se cuentan los errores de CRC (0x0C), los
+//! mensajes dirigidos al Slave y los BroadCast, que no tienen respuesta; la
+//! trama ya se contó como mensaje del bus (0x0B) en _Modbus_OSL_RTU_35T_. El
+//! CRC de las tramas dirigidas a otros Slaves no se comprueba.
 //! return 1 Un mensaje completo correcto ha sido enviado a App para su Lectura
 //! return 0 No hay mensaje o Ignorar mensaje incorrecto.
 //! \sa Modbus_OSL_Processing_Msg, Modbus_OSL_RTU_Char_Get
-//! \sa Modbus_OSL_RTU_Control_CRC 
+//! \sa Modbus_OSL_RTU_Control_CRC, Modbus_App_Diag_Count 
 static unsigned char Modbus_OSL_Receive_Request(void) 
 {
   unsigned char Modbus_OSL_Slave;
@@ -523,6 +555,9 @@ static unsigned char Modbus_OSL_Receive_Request(void)
                 if(Modbus_OSL_RTU_Control_CRC())                
                 {
                   //Debug_OSL_CRC_OK++;
+                  Modbus_App_Diag_Count(MODBUS_DIAG_SLAVE_MESSAGES);
+                  if(Modbus_OSL_BroadCast)
+                    Modbus_App_Diag_Count(MODBUS_DIAG_NO_RESPONSES);
                   Modbus_OSL_RTU_to_App();
                   return 1;  
                 }
@@ -531,6 +566,7 @@ static unsigned char Modbus_OSL_Receive_Request(void)
                   
                   /* Si se descarta el mensaje por CRC volver la comprobación de
                   trama a OK para no descartar siguientes mensajes y volver a IDLE. */
+                  Modbus_App_Diag_Count(MODBUS_DIAG_BUS_ERRORS);
                   Modbus_OSL_Frame_Set(MODBUS_OSL_Frame_OK);
                   Modbus_OSL_MainState_Set(MODBUS_OSL_IDLE);
                   return 0;
@@ -569,11 +605,13 @@ static unsigned char Modbus_OSL_Receive_Request(void)
 //! de Modbus, bien sea de petición o de respuesta. Se le añaden el Nº de Slave
 //! y el CRC mediante _Modbus_OSL_RTU_Mount_ADU_ (en caso de Modo ASCII se 
 //! deberá implementar la adición del LRC y la traducción del formato) y se 
-//! envía el mensaje mediante _Modbus_OSL_Send_.
+//! empieza el envío del mensaje mediante _Modbus_OSL_Send_. La función vuelve
+//! sin esperar: el resto de caracteres los entrega la interrupción de la UART
+//! y el timer de 3,5T lo arma _Modbus_OSL_Tx_Done_ al acabar el envío.
 //! \param *mb_rsp_pdu Puntero al vector con el Mensaje de Salida de App (PDU)
 //! \param L_pdu Longitud del Mensaje de Salida de App
 //! \sa Modbus_App_Send, Modbus_OSL_RTU_Mount_ADU, Modbus_OSL_L_Response_ADU
-//! \sa Modbus_OSL_Send 
+//! \sa Modbus_OSL_Send, Modbus_OSL_Tx_Done
 void Modbus_OSL_Output (unsigned char *mb_rsp_pdu, unsigned char L_pdu)
 { 
   switch (Modbus_OSL_Mode) 
@@ -592,38 +630,90 @@ void Modbus_OSL_Output (unsigned char *mb_rsp_pdu, unsigned char L_pdu)
           break;
   }    
   Modbus_OSL_Send(Modbus_OSL_Response_ADU, Modbus_OSL_L_Response_ADU);
-  
-  if (Modbus_OSL_Mode==MODBUS_OSL_MODE_RTU)
-  {
-    // En RTU se activa el Timer 0 para volver a IDLE cuando desborde.
-    TimerLoadSet(TIMER0_BASE, TIMER_A, Modbus_OSL_RTU_Get_Timeout_35());
-    TimerEnable(TIMER0_BASE, TIMER_A); 
-  }
 }
 
 //! \brief Función de Envio de Mensaje.
 //!
-//! Enciende el LED1 de comunicaciones y envía secuencialmente el numero de 
-//! caracteres indicado del vector señalado en los parámetros. Al terminar 
-//! apaga el LED de comunicaciones.
+//! Enciende el LED1 de comunicaciones, entrega a la UART el primer carácter
+//! del mensaje y habilita la interrupción de Transmisión, que entregará el
+//! resto mediante _Modbus_OSL_Tx_Next_ sin detener el programa. El mensaje
+//! se envía directamente desde su vector, que no cambia hasta la siguiente
+//! respuesta. El LED se apaga en _Modbus_OSL_Tx_Done_.
 //! \param *mb_rsp_adu Puntero al vector con el Mensaje de Salida completo(ADU)
 //! \param L_adu Longitud del Mensaje de Salida Completo.
-//! \sa Modbus_OSL_Output
+//! \sa Modbus_OSL_Output, Modbus_OSL_Response_ADU, Modbus_OSL_Tx_Index
 static void Modbus_OSL_Send (unsigned char *mb_rsp_adu, unsigned char L_adu)
 {
   // Enciende el LED1.
   GPIO_PORTF_DATA_R |= 0x01;        
     
-  unsigned char i;
-  for (i=0;i<L_adu;i++)
+#if MODBUS_LATENCY
+  // Instante del primer byte de la respuesta.
+  Modbus_Latency_First_Byte();
+#endif
+  IntDisable(INT_UART1);
+  UARTCharPutNonBlocking(UART1_BASE,mb_rsp_adu[0]);
+  Modbus_OSL_Tx_Index=1;
+  UARTIntEnable(UART1_BASE, UART_INT_TX);
+  IntEnable(INT_UART1);
+}
+
+//! \brief Entrega a la UART el siguiente carácter del mensaje de salida.
+//!
+//! Se llama desde la interrupción de Transmisión de la UART1. Con la FIFO
+//! desactivada cabe un carácter cada vez. Tras entregar el último se
+//! deshabilita la interrupción de Transmisión y se arma _Modbus_OSL_Tx_Timer_
+//! para el tiempo de dos caracteres, el que tarda la UART en sacarlos.
+//! \sa UART1IntHandler, Modbus_OSL_Send, Modbus_OSL_Tx_Check
+static void Modbus_OSL_Tx_Next (void)
+{
+  while(Modbus_OSL_Tx_Index<Modbus_OSL_L_Response_ADU && UARTSpaceAvail(UART1_BASE))
   {
     //Debug_OSL_OutChar++;
-    UARTCharPut(UART1_BASE,mb_rsp_adu[i]);
+    UARTCharPutNonBlocking(UART1_BASE,Modbus_OSL_Response_ADU[Modbus_OSL_Tx_Index]);
+    Modbus_OSL_Tx_Index++;
+  }
+  if(Modbus_OSL_Tx_Index>=Modbus_OSL_L_Response_ADU)
+  {
+    UARTIntDisable(UART1_BASE, UART_INT_TX);
+    Modbus_Timer_Arm(&Modbus_OSL_Tx_Timer,
+                     (2*MODBUS_OSL_RTU_BITS_CHAR*MODBUS_TIMER_TICK_HZ)/Modbus_OSL_Baudrate + 1);
   }
+}
+
+//! \brief Comprueba si la UART ha acabado de sacar el mensaje.
+//!
+//! Los microcontroladores usados no tienen interrupción de fin de
+//! transmisión, así que se consulta la UART desde la rueda de timers cada tick
+//! hasta que deja de estar ocupada.
+//! \param *Arg No se usa
+//! \sa Modbus_OSL_Tx_Next, Modbus_OSL_Tx_Done
+static void Modbus_OSL_Tx_Check (void *Arg)
+{
+  if(UARTBusy(UART1_BASE))
+    Modbus_Timer_Arm(&Modbus_OSL_Tx_Timer, 1);
+  else
+    Modbus_OSL_Tx_Done();
+}
+
+//! \brief Fin del envío del mensaje.
+//!
+//! El último carácter ha salido de la UART: se apaga el LED1 y en RTU se arma
+//! el timer de 3,5T para volver a IDLE cuando expire, que así cuenta desde el
+//! final real del envío.
+//! \sa Modbus_OSL_Tx_Check, Modbus_OSL_RTU_Start_35T
+static void Modbus_OSL_Tx_Done (void)
+{
   //Debug_OSL_OutMsg++;
   
   // Apaga el LED1.
   GPIO_PORTF_DATA_R &= ~(0x01);
+  
+  if (Modbus_OSL_Mode==MODBUS_OSL_MODE_RTU)
+  {
+    // En RTU se arma el timer de 3,5T para volver a IDLE cuando expire.
+    Modbus_OSL_RTU_Start_35T();
+  }
 }
 //! @}
 #endif
\ No newline at end of file
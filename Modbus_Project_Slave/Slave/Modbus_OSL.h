@@ -22,6 +22,9 @@ enum Baud
     B38400  = 38400,  //!< 38400 Bps
     B57600  = 57600,  //!< 57600 Bps
     B115200 = 115200, //!< 115200 Bps
+    B230400 = 230400, //!< 230400 Bps
+    B460800 = 460800, //!< 460800 Bps
+    B921600 = 921600, //!< 921600 Bps
     BDEFAULT          //!< 19200 Bps
 };
 
@@ -5,6 +5,9 @@
 
 #include "stdint.h"
 
+//! Bits por carácter en RTU: inicio, 8 de datos, paridad y parada.
+#define MODBUS_OSL_RTU_BITS_CHAR 11
+
 void Modbus_OSL_RTU_Mount_ADU (unsigned char *mb_pdu,unsigned char Slave,
                                unsigned char L_pdu, unsigned char *mb_adu);
 unsigned char Modbus_OSL_RTU_Control_CRC(void);
@@ -12,6 +15,7 @@ unsigned char Modbus_OSL_RTU_Control_CRC(void);
 void Modbus_OSL_RTU_Init (void); 
 void Modbus_OSL_RTU_15T (void);
 void Modbus_OSL_RTU_35T (void);
+void Modbus_OSL_RTU_Start_35T (void);
 void Modbus_OSL_RTU_UART(void);
 
 uint32_t Modbus_OSL_RTU_Get_Timeout_35 (void);
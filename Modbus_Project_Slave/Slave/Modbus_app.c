@@ -38,6 +38,7 @@
 //! @{
 
 #include "Modbus_App.h"
+#include "Modbus_Latency.h"
 
 //*****************************************************************************
 //
@@ -106,11 +107,20 @@ static uint16_t *Modbus_App_H_Registers;
 //! Pointer to the mapped input registers.
 static uint16_t *Modbus_App_I_Registers;
 
+//! Pointer to the packed bitmap of the coils, 0 if they are mapped one per byte in _Modbus_App_Coils_.
+static uint32_t *Modbus_App_Packed_Coils;
+
+//! Pointer to the packed bitmap of the discrete inputs, 0 if they are mapped one per byte in _Modbus_App_D_Inputs_.
+static uint32_t *Modbus_App_Packed_D_Inputs;
+
 //! Modbus communication mode; It is only implemented OSL with RTU codification and CAN.
 static enum Modbus_Comm_Modes Modbus_Comm_Mode;
 
 //! Bit rate range.
 enum Modbus_CAN_BitRate bit_rate_range;
+
+//! Counters of the Diagnostics function (8); they are increased from the interrupts as well.
+static volatile uint16_t Modbus_App_Diag[MODBUS_DIAG_COUNTERS];
 //! @}
 
 //*****************************************************************************
@@ -131,6 +141,7 @@ static unsigned char Modbus_App_Write_M_Coils_Check(void);
 static unsigned char Modbus_App_Write_M_Registers_Check(void);
 static unsigned char Modbus_App_Mask_Write_Register_Check(void);
 static unsigned char Modbus_App_Read_Write_M_Registers_Check(void);
+static unsigned char Modbus_App_Diagnostics_Check(void);
 
 // De Ejecución de las Acciones demandadas.
 
@@ -144,6 +155,9 @@ static void Modbus_App_Write_M_Coils(void);
 static void Modbus_App_Write_M_Registers(void);
 static void Modbus_App_Mask_Write_Register(void);
 static void Modbus_App_Read_Write_M_Registers(void);
+static void Modbus_App_Diagnostics(void);
+static void Modbus_App_Bits_Get(const uint32_t *Map, uint16_t First, uint16_t Count, unsigned char *Bytes);
+static void Modbus_App_Bits_Set(uint32_t *Map, uint16_t First, uint16_t Count, const unsigned char *Bytes);
   
 // De Control de la Aplicación.
 
@@ -233,6 +247,11 @@ unsigned char Modbus_Slave_Init(uint16_t N_Coils, unsigned char *Coils,
   Modbus_App_D_Inputs=D_Inputs;
   Modbus_App_H_Registers=H_Registers;
   Modbus_App_I_Registers=I_Registers;
+
+#if MODBUS_LATENCY
+  // Histogramas de latencia de las peticiones.
+  Modbus_Latency_Init();
+#endif
   
   // Modo por defecto: Serie.
   if (Com_Mode == CDEFAULT) 
@@ -293,6 +312,9 @@ void Modbus_Slave_Communication (void)
 //! \sa Modbus_App_Check_Request_Data, Modbus_App_Process_Action
 void Modbus_App_Manage_Request (void)
 {
+#if MODBUS_LATENCY
+  Modbus_Latency_Dispatch(Modbus_App_Msg[0],!Modbus_OSL_BroadCast_Get());
+#endif
   // Analizar la corrección de datos. Devuelve 0 si es correcto o el numero del
   // tipo de error detectado.
   switch(Modbus_App_Check_Request_Data())
@@ -413,6 +435,14 @@ static unsigned char Modbus_App_Check_Request_Data()
       else
         return 1;
       break;
+    //De los diagnósticos sólo Clear Counters (0x0A) admite BroadCast.
+    case 8:
+      if(Modbus_OSL_BroadCast_Get()==0 ||
+         (Modbus_App_Msg[1]==0 && Modbus_App_Msg[2]==0x0A))
+        return Modbus_App_Diagnostics_Check();
+      else
+        return 1;
+      break;
     default:
       return 1;
       break;
@@ -429,6 +459,8 @@ static unsigned char Modbus_App_Check_Request_Data()
 //! \sa Modbus_OSL_Output, Modbus_App_Response_pdu, Modbus_App_L_Response_pdu
 void Modbus_App_Send(void)
 {
+  if(Modbus_App_Response_pdu[0] & 128)
+    Modbus_App_Diag_Count(MODBUS_DIAG_EXCEPTIONS);
   Modbus_OSL_Output (Modbus_App_Response_pdu,Modbus_App_L_Response_pdu);
   //Debug_App_Sent++;
 }
@@ -482,6 +514,10 @@ unsigned char Modbus_Slave_Init(uint16_t N_Coils, unsigned char *Coils,
   Modbus_App_H_Registers=H_Registers;
   Modbus_App_I_Registers=I_Registers;
   bit_rate_range = bit_rate;
+#if MODBUS_LATENCY
+  // Latency histograms of the requests
+  Modbus_Latency_Init();
+#endif
   if(slave <= 247)
   {
     Modbus_CAN_Init(bit_rate_range, slave);
@@ -522,6 +558,9 @@ void Modbus_Slave_Communication (void)
 */
 void Modbus_App_Manage_Request (void)
 { 
+#if MODBUS_LATENCY
+  Modbus_Latency_Dispatch(Modbus_App_Msg[0], !Modbus_CAN_BroadCast_Get());
+#endif
   // Check the data. Return 0 if there is no error or the number of the error type.
   switch(Modbus_App_Check_Request_Data())
   {
@@ -636,6 +675,14 @@ static unsigned char Modbus_App_Check_Request_Data()
       else
         return 1;
       break;
+    // Of the diagnostics only Clear Counters (0x0A) accepts broadcast.
+    case 8:
+      if(Modbus_CAN_BroadCast_Get()==0 ||
+         (Modbus_App_Msg[1]==0 && Modbus_App_Msg[2]==0x0A))
+        return Modbus_App_Diagnostics_Check();
+      else
+        return 1;
+      break;
     default:
       return 1;
       break;  
@@ -652,6 +699,8 @@ static unsigned char Modbus_App_Check_Request_Data()
 */
 void Modbus_App_Send(void)
 {
+  if(Modbus_App_Response_pdu[0] & 128)
+    Modbus_App_Diag_Count(MODBUS_DIAG_EXCEPTIONS);
   Modbus_CAN_FixOutput (Modbus_App_Response_pdu, Modbus_App_L_Response_pdu);  
 }
 #endif
@@ -673,6 +722,7 @@ void Modbus_App_Send(void)
 *   @sa Modbus_App_Write_Coil, Modbus_App_Write_Register
 *   @sa Modbus_App_Write_M_Coils, Modbus_App_Write_M_Registers
 *   @sa Modbus_App_Mask_Write_Register, Modbus_App_Read_Write_M_Registers
+*   @sa Modbus_App_Diagnostics
 */
 static void Modbus_App_Process_Action(void)
 {
@@ -710,12 +760,36 @@ static void Modbus_App_Process_Action(void)
     case 23:
       Modbus_App_Read_Write_M_Registers();
       break;
+    case 8:
+      Modbus_App_Diagnostics();
+      break;
     default:
       Modbus_CAN_Error_Management(20);
       break;  
   }
 }
 
+/**
+*   @brief It maps the coils and discrete inputs to packed bitmaps.
+*   @ingroup App_Control
+*
+*   By default every coil and discrete input takes one byte of the vectors given to _Modbus_Slave_Init()_. With packed
+*   bitmaps the address n is the bit n%32 of the word n/32, eight times less memory, and the reads and writes of several
+*   bits are copied 32 bits at a time. The bitmaps need MODBUS_BITMAP_WORDS(N) words and the application reaches its bits
+*   with MODBUS_BIT_GET and MODBUS_BIT_SET.
+*
+*   It has to be called before _Modbus_Slave_Init()_, whose _Coils_ and _D_Inputs_ pointers are not used then for the
+*   packed types; the amounts are still given to _Modbus_Slave_Init()_.
+*   @param *Coils Packed bitmap of the coils, 0 to keep one byte per coil
+*   @param *D_Inputs Packed bitmap of the discrete inputs, 0 to keep one byte per input
+*   @sa Modbus_App_Packed_Coils, Modbus_App_Packed_D_Inputs, Modbus_App_Bits_Get, Modbus_App_Bits_Set
+*/
+void Modbus_Slave_Packed_Bits(uint32_t *Coils, uint32_t *D_Inputs)
+{
+  Modbus_App_Packed_Coils=Coils;
+  Modbus_App_Packed_D_Inputs=D_Inputs;
+}
+
 /**
 *   @brief It receives a char from another module.
 *   @ingroup App_Exchange
@@ -746,6 +820,20 @@ void Modbus_App_L_Msg_Set(unsigned char Index)
   Modbus_App_L_Msg=Index;
 }
 
+/**
+*   @brief Increase a diagnostic counter.
+*   @ingroup App_Exchange
+*
+*   It is called by the OSL/CAN layer when a frame is received or thrown away, and by _Modbus_App_Send()_ for the exceptions.
+*   The counters wrap around at 65535 and they are read and cleared by the master with the Diagnostics function (8).
+*   @param Counter Counter to increase
+*   @sa Modbus_App_Diag, Modbus_App_Diagnostics, Modbus_OSL_RTU_35T, Modbus_OSL_Receive_Request, Modbus_CAN_CallBack
+*/
+void Modbus_App_Diag_Count(enum Modbus_App_Diag_Counters Counter)
+{
+  Modbus_App_Diag[Counter]++;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 /**
 *   @defgroup App_Check Checking functions
@@ -848,6 +936,15 @@ static unsigned char Modbus_App_Read_I_Registers_Check (void)
   
   if(Modbus_App_Quantity>125  || Modbus_App_Quantity==0 || Modbus_App_L_Msg!=5)
     return 3;
+#if MODBUS_LATENCY
+  // Latency map, from MODBUS_LATENCY_BASE
+  if(Modbus_App_Adress>=MODBUS_LATENCY_BASE)
+  {
+    if( ((long)Modbus_App_Adress+(long)Modbus_App_Quantity)>MODBUS_LATENCY_BASE+MODBUS_LATENCY_REGISTERS)
+      return 2;
+    return 0;
+  }
+#endif
   if( ((long)Modbus_App_Adress+(long)Modbus_App_Quantity)>Modbus_App_N_I_Registers)
     return 2;
     
@@ -1024,6 +1121,46 @@ static unsigned char Modbus_App_Read_Write_M_Registers_Check (void)
   
   return 0;
 }
+
+/**
+*   @brief Data check of Diagnostics request.
+*
+*   It is stored in _Modbus_App_Value_ the sub-function and, for the counters, in _Modbus_App_Quantity_ the counter to be
+*   returned. The sub-functions implemented are Return Query Data (0x00), with any amount of data words, and Clear Counters (0x0A)
+*   and the counters 0x0B-0x0F and 0x12, whose data has to be 0x0000.
+*   @return 0 Correct Data
+*   @return 1 Sub-function not implemented
+*   @return 3 Function data error
+*   @sa Modbus_App_Msg, Modbus_App_L_Msg, Modbus_App_Value, Modbus_App_Quantity, Modbus_App_Diagnostics
+*/
+static unsigned char Modbus_App_Diagnostics_Check (void)
+{
+  Modbus_App_Value=Modbus_App_Msg[1]<<8|Modbus_App_Msg[2];
+  
+  if(Modbus_App_L_Msg<3 || (Modbus_App_L_Msg & 1)==0)
+    return 3;
+  switch(Modbus_App_Value)
+  {
+    case 0x00:
+      return 0;
+    case 0x0A:
+    case 0x0B:
+    case 0x0C:
+    case 0x0D:
+    case 0x0E:
+    case 0x0F:
+    case 0x12:
+      if(Modbus_App_L_Msg!=5 || Modbus_App_Msg[3]!=0 || Modbus_App_Msg[4]!=0)
+        return 3;
+      if(Modbus_App_Value==0x12)
+        Modbus_App_Quantity=MODBUS_DIAG_OVERRUNS;
+      else if(Modbus_App_Value!=0x0A)
+        Modbus_App_Quantity=Modbus_App_Value-0x0B+MODBUS_DIAG_BUS_MESSAGES;
+      return 0;
+    default:
+      return 1;
+  }
+}
 /** @} */
 
 /**
@@ -1033,6 +1170,75 @@ static unsigned char Modbus_App_Read_Write_M_Registers_Check (void)
 *   @{ 
 */
 
+/**
+*   @brief Copy a range of a packed bitmap into the bytes of a PDU.
+*
+*   The bits are taken 32 at a time, shifting the two words where they lie, and stored as Modbus wants: the first
+*   address in the lowest bit of the first byte; the unused bits of the last byte are 0.
+*   @param *Map Packed bitmap
+*   @param First First address to copy
+*   @param Count Addresses to copy
+*   @param *Bytes Where the (Count+7)/8 bytes are stored
+*   @sa Modbus_App_Read_Coils, Modbus_App_Read_D_Inputs
+*/
+static void Modbus_App_Bits_Get(const uint32_t *Map, uint16_t First, uint16_t Count, unsigned char *Bytes)
+{
+  const uint32_t *Word=&Map[First>>5];
+  unsigned char Shift=First & 31, n, i;
+  uint32_t Bits;
+  
+  while(Count)
+  {
+    n=(Count>32) ? 32 : Count;
+    Bits=Word[0]>>Shift;
+    // The rest of the bits are in the next word, which is not read if it is not needed.
+    if(Shift && n>32-Shift)
+      Bits|=Word[1]<<(32-Shift);
+    if(n<32)
+      Bits&=(1UL<<n)-1;
+    for(i=0;i<n;i+=8)
+    {
+      *Bytes++=Bits;
+      Bits>>=8;
+    }
+    Word++;
+    Count-=n;
+  }
+}
+
+/**
+*   @brief Copy the bytes of a PDU into a range of a packed bitmap.
+*
+*   The bits are gathered 32 at a time and written with a mask into the two words where they lie; the rest of the bits
+*   of those words are kept.
+*   @param *Map Packed bitmap
+*   @param First First address to write
+*   @param Count Addresses to write
+*   @param *Bytes The (Count+7)/8 bytes with the values, the first address in the lowest bit of the first byte
+*   @sa Modbus_App_Write_M_Coils
+*/
+static void Modbus_App_Bits_Set(uint32_t *Map, uint16_t First, uint16_t Count, const unsigned char *Bytes)
+{
+  uint32_t *Word=&Map[First>>5];
+  unsigned char Shift=First & 31, n, i;
+  uint32_t Bits, Mask;
+  
+  while(Count)
+  {
+    n=(Count>32) ? 32 : Count;
+    Bits=0;
+    for(i=0;i<n;i+=8)
+      Bits|=(uint32_t)*Bytes++<<i;
+    Mask=(n<32) ? (1UL<<n)-1 : 0xFFFFFFFF;
+    Bits&=Mask;
+    Word[0]=(Word[0] & ~(Mask<<Shift)) | (Bits<<Shift);
+    if(Shift && n>32-Shift)
+      Word[1]=(Word[1] & ~(Mask>>(32-Shift))) | (Bits>>(32-Shift));
+    Word++;
+    Count-=n;
+  }
+}
+
 /** 
 *   @brief Read the Coils and the values are wrapped in the response.
 *
@@ -1052,6 +1258,14 @@ static void Modbus_App_Read_Coils(void)
   else
     Modbus_App_Response_pdu[1]=(Modbus_App_Quantity/8)+1;
   
+  if(Modbus_App_Packed_Coils)
+  {
+    Modbus_App_Bits_Get(Modbus_App_Packed_Coils,Modbus_App_Adress,Modbus_App_Quantity,
+                        &Modbus_App_Response_pdu[2]);
+    Modbus_App_L_Response_pdu=2+Modbus_App_Response_pdu[1];
+    return;
+  }
+  
   // "k+2" marca la posición en el vector, "j" el índice en el vector de lectura y
   // limita cuando se llega a total de Coils a leer. "i" desplaza el bit a la
   // posición dentro del Byte de respuesta.
@@ -1085,6 +1299,14 @@ static void Modbus_App_Read_D_Inputs (void)
   else
     Modbus_App_Response_pdu[1]=(Modbus_App_Quantity/8)+1;
 
+  if(Modbus_App_Packed_D_Inputs)
+  {
+    Modbus_App_Bits_Get(Modbus_App_Packed_D_Inputs,Modbus_App_Adress,Modbus_App_Quantity,
+                        &Modbus_App_Response_pdu[2]);
+    Modbus_App_L_Response_pdu=2+Modbus_App_Response_pdu[1];
+    return;
+  }
+
   // "k+2" marca la posición en el vector, "j" el índice en el vector de lectura y
   // limita cuando se llega a total de Entradas a leer. "i" desplaza el bit a la
   // posición dentro del Byte de respuesta.  
@@ -1135,6 +1357,20 @@ static void Modbus_App_Read_I_Registers (void)
   Modbus_App_Response_pdu[0]=4;  
   Modbus_App_Response_pdu[1]=Modbus_App_Quantity*2;
   
+#if MODBUS_LATENCY
+  if(Modbus_App_Adress>=MODBUS_LATENCY_BASE)
+  {
+    uint16_t value;
+    for(i=0;i<Modbus_App_Quantity;i++)
+    {
+      value=Modbus_Latency_Register(Modbus_App_Adress-MODBUS_LATENCY_BASE+i);
+      Modbus_App_Response_pdu[2+2*i]=value>>8;
+      Modbus_App_Response_pdu[3+2*i]=value;
+    }
+    Modbus_App_L_Response_pdu=2+Modbus_App_Response_pdu[1];
+    return;
+  }
+#endif
   for(i=0;i<Modbus_App_Quantity;i++)
   {
     Modbus_App_Response_pdu[2+2*i]=Modbus_App_I_Registers[Modbus_App_Adress+i]>>8;
@@ -1158,13 +1394,19 @@ static void Modbus_App_Write_Coil (void)
   
   if(Modbus_App_Value==65280)
   {
-    Modbus_App_Coils[Modbus_App_Adress]=1;
+    if(Modbus_App_Packed_Coils)
+      MODBUS_BIT_SET(Modbus_App_Packed_Coils,Modbus_App_Adress,1);
+    else
+      Modbus_App_Coils[Modbus_App_Adress]=1;
     Modbus_App_Response_pdu[3]=255;
     Modbus_App_Response_pdu[4]=0;
   }
   if(Modbus_App_Value==0)
   {
-    Modbus_App_Coils[Modbus_App_Adress]=0;
+    if(Modbus_App_Packed_Coils)
+      MODBUS_BIT_SET(Modbus_App_Packed_Coils,Modbus_App_Adress,0);
+    else
+      Modbus_App_Coils[Modbus_App_Adress]=0;
     Modbus_App_Response_pdu[3]=0;
     Modbus_App_Response_pdu[4]=0;
   } 
@@ -1209,6 +1451,14 @@ static void Modbus_App_Write_M_Coils (void)
   Modbus_App_Response_pdu[2]=Modbus_App_Adress;
   Modbus_App_Response_pdu[3]=Modbus_App_Quantity>>8;
   Modbus_App_Response_pdu[4]=Modbus_App_Quantity; 
+  Modbus_App_L_Response_pdu=5;
+
+  if(Modbus_App_Packed_Coils)
+  {
+    Modbus_App_Bits_Set(Modbus_App_Packed_Coils,Modbus_App_Adress,Modbus_App_Quantity,
+                        &Modbus_App_Msg[6]);
+    return;
+  }
 
   // "6+i" marca la posición en la petición, "k+Adress" el índice donde escribir 
   //  "k" limita cuando se llega a total de Coils a escribir. 
@@ -1220,8 +1470,6 @@ static void Modbus_App_Write_M_Coils (void)
       Modbus_App_Coils[k+Modbus_App_Adress]=(Modbus_App_Msg[6+i]>>j) & 1;
       k++;
     }
-  
-  Modbus_App_L_Response_pdu=5;
 }
 
 /**
@@ -1311,4 +1559,32 @@ static void Modbus_App_Read_Write_M_Registers (void)
   
   Modbus_App_L_Response_pdu=2+Modbus_App_Response_pdu[1];
 }
+
+/**
+*   @brief The diagnostic is done and it answers with an echo of the request.
+*
+*   Return Query Data answers the data of the request as it is; Clear Counters sets all the counters to 0; for the rest of
+*   sub-functions the data field of the echo is replaced by the counter.
+*   @sa Modbus_App_Response_pdu, Modbus_App_L_Response_pdu, Modbus_App_Diag
+*   @sa Modbus_App_Value, Modbus_App_Quantity, Modbus_App_Diagnostics_Check
+*/
+static void Modbus_App_Diagnostics (void)
+{
+  unsigned char i;
+  
+  for(i=0;i<Modbus_App_L_Msg;i++)
+    Modbus_App_Response_pdu[i]=Modbus_App_Msg[i];
+  Modbus_App_L_Response_pdu=Modbus_App_L_Msg;
+  
+  if(Modbus_App_Value==0x0A)
+  {
+    for(i=0;i<MODBUS_DIAG_COUNTERS;i++)
+      Modbus_App_Diag[i]=0;
+  }
+  else if(Modbus_App_Value!=0x00)
+  {
+    Modbus_App_Response_pdu[3]=Modbus_App_Diag[Modbus_App_Quantity]>>8;
+    Modbus_App_Response_pdu[4]=Modbus_App_Diag[Modbus_App_Quantity];
+  }
+}
 /** @} */
\ No newline at end of file
@@ -14,9 +14,10 @@
 void init(void);
 
  static uint16_t coils_amount = 2000, discrete_inputs_amount = 2000, holding_registers_amount = 125, input_registers_amount = 125;
-       static unsigned char *coils, *discrete_inputs;
+       static uint32_t *coils, *discrete_inputs;
        static uint16_t *holding_registers, *input_registers;      
-       static unsigned char coils_data[2000], discrete_inputs_data[2000];
+       //packed bitmaps: one bit per coil/input instead of one byte
+       static uint32_t coils_data[MODBUS_BITMAP_WORDS(2000)], discrete_inputs_data[MODBUS_BITMAP_WORDS(2000)];
        static uint16_t holding_registers_data[125], input_registers_data[125];
       
 void main(void)
@@ -41,13 +42,13 @@ void init(void)
       num = 1;
       for(i=0; i < coils_amount; i++)
       {                  
-          coils_data[i] = num;
+          MODBUS_BIT_SET(coils_data, i, num);
           
       }
       num = 0;
       for(i=0; i < discrete_inputs_amount; i++)
       {
-          discrete_inputs_data[i] = num;
+          MODBUS_BIT_SET(discrete_inputs_data, i, num);
           num += 1;
           num= num % 2;
           if(i == 999)
@@ -65,8 +66,9 @@ void init(void)
       discrete_inputs = discrete_inputs_data;
       holding_registers = holding_registers_data;
       input_registers = input_registers_data;
-      Modbus_Slave_Init(coils_amount, coils,
-                                discrete_inputs_amount, discrete_inputs,
+      Modbus_Slave_Packed_Bits(coils, discrete_inputs);
+      Modbus_Slave_Init(coils_amount, 0,
+                                discrete_inputs_amount, 0,
                                 holding_registers_amount, holding_registers,
                                 input_registers_amount, input_registers,
                                 bit_rate, slave);